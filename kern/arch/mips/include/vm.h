@@ -112,11 +112,9 @@ void ram_getsize(paddr_t *lo, paddr_t *hi);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
 	struct addrspace *ts_addrspace;
 	vaddr_t ts_vaddr;
+	bool ts_allpages;	/* ignore ts_vaddr; drop all of the as */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -40,8 +40,12 @@
 #include <mainbus.h>
 #include <syscall.h>
 #include <opt-A3.h>
+#include "opt-dumbvm.h"
 #include <addrspace.h>
 #include <proc.h>
+#if !OPT_DUMBVM
+#include <loadctl.h>
+#endif
 
 
 /* in exception.S */
@@ -213,6 +217,10 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+		if (!iskern) {
+			/* Back to user mode; see below. */
+			goto done;
+		}
 		goto done2;
 	}
 
@@ -333,6 +341,17 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+#if !OPT_DUMBVM
+	if (!iskern) {
+		/*
+		 * About to go back to user mode, holding no locks: if
+		 * load control has deactivated the process, stop here
+		 * until it is let back in.
+		 */
+		loadctl_checkpoint();
+	}
+#endif
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -31,11 +31,13 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <copyinout.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
 #include <opt-A2.h>
+#include "opt-dumbvm.h"
 #include <addrspace.h>
 
 
@@ -84,6 +86,9 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if !OPT_DUMBVM
+	off_t offset;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -118,6 +123,20 @@ syscall(struct trapframe *tf)
 			  (int)tf->tf_a2,
 			  (int *)(&retval));
 	  break;
+#if OPT_A2
+	case SYS_open:
+	  err = sys_open((userptr_t)tf->tf_a0, (int)tf->tf_a1, &retval);
+	  break;
+	case SYS_read:
+	  err = sys_read((int)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (size_t)tf->tf_a2,
+			 &retval);
+	  break;
+	case SYS_close:
+	  err = sys_close((int)tf->tf_a0);
+	  break;
+#endif
 	case SYS__exit:
 	  sys__exit((int)tf->tf_a0);
 	  /* sys__exit does not return, execution should not get here */
@@ -138,6 +157,44 @@ syscall(struct trapframe *tf)
 	case SYS_execv:
 	    err=sys_execv((char *)tf->tf_a0, (char **) tf->tf_a1);
 	    break;
+#if !OPT_DUMBVM
+	case SYS_sbrk:
+	    err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+	    break;
+	case SYS_mmap:
+	    /* The 64-bit offset is the fifth argument, on the stack. */
+	    err = copyin((userptr_t)(tf->tf_sp + 16), &offset, sizeof(offset));
+	    if (err) {
+		break;
+	    }
+	    err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			   (int)tf->tf_a2, (int)tf->tf_a3, offset,
+			   (vaddr_t *)&retval);
+	    break;
+	case SYS_munmap:
+	    err = sys_munmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+	    break;
+	case SYS_msync:
+	    err = sys_msync((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			    (int)tf->tf_a2);
+	    break;
+	case SYS___vmstats:
+	    err = sys___vmstats((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+				(int)tf->tf_a2, &retval);
+	    break;
+	case SYS_shm_create:
+	    err = sys_shm_create((int)tf->tf_a0, (size_t)tf->tf_a1);
+	    break;
+	case SYS_shm_attach:
+	    err = sys_shm_attach((int)tf->tf_a0, (vaddr_t *)&retval);
+	    break;
+	case SYS_shm_detach:
+	    err = sys_shm_detach((vaddr_t)tf->tf_a0);
+	    break;
+	case SYS_shm_remove:
+	    err = sys_shm_remove((int)tf->tf_a0);
+	    break;
+#endif
 #endif // UW
 
 	    /* Add stuff here */
@@ -191,6 +248,7 @@ enter_forked_process(struct trapframe *tf)
     //kprintf("enter_forked_process \n");
     #if OPT_A2
         struct trapframe thisTF = *tf; //create tf on stack
+        sys_fork_freetf(tf); //back to sys_fork's trapframe cache
         thisTF.tf_v0 =0; //child returns with 0
         thisTF.tf_a3 =0; //error coding
         thisTF.tf_epc +=4; //counter
@@ -54,10 +54,15 @@
  *
  * These arrays are also used to start up new CPUs, for roughly the
  * same reasons.
+ *
+ * cpupagetables[] holds the page table of the address space each CPU
+ * is running, for the UTLB refill handler. The VM system sets it; if
+ * it's 0, every TLB miss goes through vm_fault.
  */
 
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
+vaddr_t cpupagetables[MAXCPUS];
 
 /*
  * Do machine-dependent initialization of the cpu structure or things
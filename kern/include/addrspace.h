@@ -36,17 +36,23 @@
 
 
 #include <vm.h>
+#include "opt-dumbvm.h"
+#if !OPT_DUMBVM
+#include <loadctl.h>
+#endif
 
 struct vnode;
+struct pagetable;
+struct pagecache;
 
 
 /* 
  * Address space - data structure associated with the virtual memory
  * space of a process.
- *
- * You write this.
  */
 
+#if OPT_DUMBVM
+
 struct addrspace {
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
@@ -61,6 +67,70 @@ struct addrspace {
   bool as_loaded;
 };
 
+#else
+
+/*
+ * Number of pages in the user stack region to begin with, and the
+ * most it can grow to. The stack grows down, a page at a time, as it
+ * faults below the bottom of the region; the heap may not grow past
+ * VM_STACKLIMIT.
+ */
+#define VM_STACKPAGES    12
+#define VM_STACKMAXPAGES 1024		/* 4M */
+#define VM_STACKLIMIT    (USERSTACK - VM_STACKMAXPAGES * PAGE_SIZE)
+
+/*
+ * Most neighbouring pages vm_fault loads into the TLB along with the
+ * one that faulted. 0 turns fault-around off.
+ */
+#define VM_FAULTAROUND_MAX 8
+
+/*
+ * A region is a page-aligned range of the address space with a single
+ * set of permissions. Pages of a region are not allocated until they
+ * are first touched (see vm_fault). If rg_vnode is set, the bytes
+ * [rg_fvaddr, rg_fvaddr + rg_filesize) of the region come from the
+ * file at rg_offset; everything else is zero-filled.
+ *
+ * A region made by mmap instead has rg_cache set, and maps the file
+ * from rg_cacheoffset on through its page cache. If rg_shared is set
+ * the frames of the cache are mapped directly; otherwise they are
+ * mapped copy-on-write. Read-only regions of an executable have both
+ * rg_vnode and rg_cache set, and take whichever of their pages they
+ * can from the executable's page cache.
+ */
+struct region {
+	vaddr_t rg_vbase;		/* page-aligned base address */
+	size_t rg_npages;		/* length in pages */
+	bool rg_readable;
+	bool rg_writeable;
+	bool rg_executable;
+
+	struct vnode *rg_vnode;		/* backing executable, or NULL */
+	off_t rg_offset;		/* file offset of rg_fvaddr */
+	vaddr_t rg_fvaddr;		/* (unaligned) start of file data */
+	size_t rg_filesize;		/* bytes of file data */
+
+	struct pagecache *rg_cache;	/* mapped file's page cache, or NULL */
+	off_t rg_cacheoffset;		/* file offset of rg_vbase */
+	bool rg_shared;			/* writes go back to the file */
+
+	struct region *rg_next;
+};
+
+struct addrspace {
+	struct region *as_regions;	/* list of defined regions */
+	struct region *as_stack;	/* the stack region (also on the list) */
+	struct region *as_heap;		/* the sbrk heap (also on the list) */
+	vaddr_t as_heapend;		/* the break; may not be page-aligned */
+	vaddr_t as_falast;		/* last page vm_fault loaded */
+	unsigned as_fawindow;		/* fault-around window, in pages */
+	struct pagetable *as_pt;	/* vaddr -> frame translations */
+	struct loadctl_state as_lc;	/* working set, for load control */
+};
+
+#endif /* OPT_DUMBVM */
+
 /*
  * Functions in addrspace.c:
  *
@@ -112,6 +182,51 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+/*
+ *    as_define_file - attach the part of executable V that belongs in
+ *                the region containing VADDR, so that its pages can
+ *                be read in on demand. Called by load_elf in place of
+ *                actually loading the segment.
+ *
+ *    as_find_region - return the region containing VADDR, or NULL.
+ *
+ *    as_grow_stack - if VADDR is below the stack but no further than
+ *                VM_STACKLIMIT, extend the stack region down to take
+ *                it in and return it. Otherwise return NULL.
+ *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes, and hand
+ *                back its old address in OLDBREAK. Pages given back
+ *                are freed. Returns EINVAL if the heap would end before
+ *                it starts, and ENOMEM if it would run into the stack
+ *                or a file mapping.
+ *
+ *    as_map    - map LEN bytes of the file with page cache PC, from
+ *                OFFSET on, somewhere between the heap and the stack,
+ *                and hand back the address in RET. The region takes
+ *                over the caller's reference to PC.
+ *
+ *    as_unmap  - remove the file mappings in [VADDR, VADDR+LEN),
+ *                writing back shared pages that were written. Each
+ *                mapping must be removed whole; EINVAL otherwise.
+ *
+ *    as_sync   - write back the written pages of shared file mappings
+ *                in [VADDR, VADDR+LEN).
+ */
+int               as_define_file(struct addrspace *as, struct vnode *v,
+                                 off_t offset, vaddr_t vaddr,
+                                 size_t filesize);
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+struct region    *as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_map(struct addrspace *as, struct pagecache *pc,
+                         off_t offset, size_t len, int prot, bool shared,
+                         vaddr_t *ret);
+int               as_unmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_sync(struct addrspace *as, vaddr_t vaddr, size_t len);
+#endif
+
 
 /*
  * Functions in loadelf.c
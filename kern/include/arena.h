@@ -0,0 +1,42 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+/*
+ * The kernel heap arena, where kmalloc gets objects too big for its
+ * object caches but no bigger than ARENA_MAXSIZE.
+ *
+ * The arena gets memory from alloc_kpages in spans of
+ * ARENA_SPANPAGES pages (or, if there isn't a run that long free, just
+ * as many as are needed), and carves them into blocks of any multiple
+ * of 16 bytes. Each block starts with a boundary tag giving its size
+ * and that of the block before it, so a freed block is merged with
+ * free neighbours straight away. Free blocks are kept on lists by size
+ * class, one per power of two, so finding one big enough looks at one
+ * list's worth of blocks at most. A span that is entirely free again
+ * goes back to the page allocator, except that one is kept in reserve.
+ *
+ * So a 3K buffer takes 3K and a bit rather than a whole page, and
+ * buffers of a few pages don't each need a free run of that many
+ * frames.
+ */
+
+#define ARENA_MAXSIZE    (64*1024)	/* largest allocation */
+#define ARENA_SPANPAGES  16		/* pages the arena grows by */
+
+/*
+ * arena_alloc      - allocate SIZE bytes, at most ARENA_MAXSIZE.
+ *                    Returns NULL if out of memory. The block is 8-byte
+ *                    aligned, and never page aligned (which is how
+ *                    kfree tells it from whole pages).
+ * arena_free       - free a block from arena_alloc.
+ * arena_blocksize  - how many bytes the block at PTR, which must be
+ *                    allocated, can actually hold.
+ * arena_printstats - print how much of the arena is in use, and how
+ *                    the free space is broken up.
+ */
+void *arena_alloc(size_t size);
+void arena_free(void *ptr);
+size_t arena_blocksize(void *ptr);
+void arena_printstats(void);
+
+#endif /* _ARENA_H_ */
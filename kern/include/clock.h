@@ -56,6 +56,9 @@
 #define HZ  100
 #endif
 
+/* hardclocks between calls to schedule() */
+#define SCHEDULE_HARDCLOCKS	4
+
 void hardclock_bootstrap(void);
 
 void hardclock(void);
@@ -0,0 +1,232 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical memory (frame) management.
+ *
+ * The coremap has one entry for every frame of physical memory that
+ * was left over once the kernel was loaded. Kernel pages come out of
+ * it through alloc_kpages/free_kpages (declared in vm.h); pages of
+ * user address spaces come out of it one frame at a time and remember
+ * which address space and virtual page they hold.
+ *
+ * A user frame can be shared copy-on-write by several address spaces
+ * after fork. cme_refcount counts the page table entries that map it,
+ * and cme_as is NULL while the frame has no single owner.
+ *
+ * Frames that same-page merging (pagemerge.h) has made shared have
+ * cme_merged set, until they have a single owner again.
+ *
+ * Frames that belong to a page cache (pagecache.h) have cme_cached
+ * set, and point back to their page cache entry instead. The cache's
+ * own reference is one of cme_refcount.
+ *
+ * kmalloc keeps a pointer to its record of each page it carves into
+ * objects (struct pageref, private to kmalloc.c) in the page's coremap
+ * entry, so that kfree can find it from an address in one step.
+ *
+ * Only user frames with a single owner can be evicted, and cached
+ * frames that no page table maps any more. Frames handed out by
+ * coremap_alloc_upage start out pinned, so that they are not evicted
+ * before the caller has put them in a page table.
+ */
+
+struct addrspace;
+struct pcpage;
+struct pageref;
+struct vmpolicy;
+
+struct coremap_entry {
+	union {
+		struct {
+			struct addrspace *as;	/* owning address space */
+			vaddr_t vaddr;		/* user virtual page held */
+		} u_user;			/* allocated user frame */
+		struct {
+			struct addrspace *as;	/* always NULL */
+			struct pcpage *page;	/* page cache entry */
+		} u_cached;			/* frame in a page cache */
+		struct {
+			unsigned next, prev;	/* free list links (frame numbers) */
+		} u_free;			/* first frame of a free block */
+		struct {
+			unsigned npages;	/* its size, or 0 if not first */
+			struct pageref *pageref; /* kmalloc's record of it */
+		} u_kernel;			/* frame of a kernel block */
+	} cme_u;
+	unsigned cme_refcount:16;	/* page table entries mapping a user frame */
+	unsigned cme_order:5;		/* first frame of a free block: log2 of its size */
+	unsigned cme_inuse:1;		/* frame is allocated */
+	unsigned cme_freehead:1;	/* frame is the first of a free block */
+	unsigned cme_kernel:1;		/* frame belongs to the kernel */
+	unsigned cme_pinned:1;		/* frame may not be evicted */
+	unsigned cme_busy:1;		/* frame is being evicted */
+	unsigned cme_ref:1;		/* referenced since the clock hand passed */
+	unsigned cme_used:1;		/* referenced since load control looked */
+	unsigned cme_cached:1;		/* user frame belongs to a page cache */
+	unsigned cme_merged:1;		/* shared because its pages were merged */
+};
+
+#define cme_as		cme_u.u_user.as
+#define cme_vaddr	cme_u.u_user.vaddr
+#define cme_cpage	cme_u.u_cached.page
+#define cme_free	cme_u.u_free
+#define cme_npages	cme_u.u_kernel.npages
+#define cme_pageref	cme_u.u_kernel.pageref
+
+/*
+ * coremap_bootstrap  - take over all remaining physical memory.
+ *                      Called from vm_bootstrap.
+ * coremap_alloc_upage - allocate one frame, pinned, for virtual page
+ *                      VA of AS. May evict a page, and so may sleep.
+ *                      Returns 0 if no memory is left.
+ * coremap_free_upage - drop one reference to a frame from
+ *                      coremap_alloc_upage; frees it at zero.
+ * coremap_try_kpage  - allocate a one-page kernel block if one is free,
+ *                      without evicting anything. Returns its physical
+ *                      address, or 0. Free it with free_kpages.
+ * coremap_adopt_kpage - turn the one-page kernel block at PA into a
+ *                      frame as from coremap_alloc_upage(AS, VA).
+ * coremap_reclaim    - evict a page, along with the dirty pages that
+ *                      follow it if it is dirty, and free their frames.
+ *                      For the pageout daemon. May sleep. Returns the
+ *                      number of frames freed; 0 if nothing could be
+ *                      evicted.
+ * coremap_swapout    - evict a run of pages of AS, as coremap_reclaim
+ *                      does, starting with the first that can be
+ *                      evicted at or after frame *CURSOR, and advance
+ *                      *CURSOR past it. For load control. May sleep.
+ *                      Returns the number of frames freed; 0 once no
+ *                      more of AS's pages can be evicted.
+ * coremap_wssample   - for load control: add up, in the loadctl_state
+ *                      of each address space, its resident pages and
+ *                      those used since the last call; then make the
+ *                      next use of each of those fault again, to be
+ *                      seen. Returns the number of frames user pages
+ *                      can have (all but the kernel's).
+ * coremap_setpolicy  - choose pages to evict with replacement policy
+ *                      VP (see vmpolicy.h) from now on. May sleep.
+ * coremap_getpolicy  - the replacement policy in use.
+ * coremap_freepages  - number of frames free, counting the zero pool.
+ * coremap_usedpages  - number of frames currently allocated.
+ * coremap_totalpages - number of frames the coremap manages.
+ * coremap_printstats - print the per-CPU frame cache hit/miss counts.
+ * coremap_set_pageref - for kmalloc: remember PR (or NULL) for the
+ *                      one-page kernel block at KVADDR. Returns false,
+ *                      remembering nothing, if the page isn't in the
+ *                      coremap (it was stolen before there was one).
+ * coremap_get_pageref - for kmalloc: return in *RET what was remembered
+ *                      for the kernel page holding KVADDR; NULL if
+ *                      nothing was, as for pages from alloc_kpages
+ *                      that kmalloc didn't carve up. Returns false if
+ *                      the page isn't in the coremap.
+ */
+void coremap_bootstrap(void);
+paddr_t coremap_alloc_upage(struct addrspace *as, vaddr_t va);
+void coremap_free_upage(paddr_t pa);
+paddr_t coremap_try_kpage(void);
+void coremap_adopt_kpage(paddr_t pa, struct addrspace *as, vaddr_t va);
+unsigned coremap_reclaim(void);
+unsigned coremap_swapout(struct addrspace *as, unsigned *cursor);
+unsigned coremap_wssample(void);
+void coremap_setpolicy(const struct vmpolicy *vp);
+const struct vmpolicy *coremap_getpolicy(void);
+unsigned coremap_freepages(void);
+unsigned coremap_usedpages(void);
+unsigned coremap_totalpages(void);
+void coremap_printstats(void);
+bool coremap_set_pageref(vaddr_t kvaddr, struct pageref *pr);
+bool coremap_get_pageref(vaddr_t kvaddr, struct pageref **ret);
+
+/*
+ * The coremap lock also protects the page table entries of resident
+ * pages (see pagetable.h). These are called with it held:
+ *
+ * coremap_wait_evict - sleep until some eviction finishes. Used to
+ *                      wait for PTE_BUSY to go away.
+ * coremap_unpin      - allow frame PA to be evicted again, once it
+ *                      is in a page table.
+ * coremap_touch      - set the reference bit of frame PA.
+ * coremap_drop_upage - coremap_free_upage, with the lock held.
+ * coremap_share_upage - add a reference to a user frame (for fork).
+ * coremap_cow_claim  - if AS holds the only reference to frame PA,
+ *                      record AS/VA as its owner and return true.
+ * coremap_cache_upage - hand the reference to frame PA, fresh from
+ *                      coremap_alloc_upage, to page cache entry PP,
+ *                      and unpin it unless PINNED (for anonymous
+ *                      caches, whose pages can't be evicted).
+ * coremap_uncache_upage - take frame PA back out of its page cache and
+ *                      drop the cache's reference. It lives on as a
+ *                      shared frame while page tables still map it.
+ * coremap_merged     - true if shared frame PA holds merged pages.
+ */
+void coremap_lock_acquire(void);
+void coremap_lock_release(void);
+void coremap_wait_evict(void);
+void coremap_unpin(paddr_t pa);
+void coremap_touch(paddr_t pa);
+void coremap_drop_upage(paddr_t pa);
+void coremap_share_upage(paddr_t pa);
+bool coremap_cow_claim(paddr_t pa, struct addrspace *as, vaddr_t va);
+void coremap_cache_upage(paddr_t pa, struct pcpage *pp, bool pinned);
+void coremap_uncache_upage(paddr_t pa);
+bool coremap_merged(paddr_t pa);
+
+/*
+ * For the same-page merging scanner (pagemerge.c). A frozen frame is
+ * one whose page nobody can use or change until it is thawed again,
+ * so that it can be compared with others. These may sleep.
+ *
+ * coremap_merge_next  - look at up to *COUNT frames, starting at
+ *                       *CURSOR, for a user frame with a single owner.
+ *                       Returns its address, and its owner and virtual
+ *                       page in AS and VA, or 0 if there was none.
+ *                       *CURSOR is advanced past the frames looked at,
+ *                       and *COUNT set to how many. The frame isn't
+ *                       frozen, so it may change (or change hands) at
+ *                       any time.
+ * coremap_merge_freeze - freeze PA, if it is still the frame of page
+ *                       VA of AS alone. Returns false if not.
+ * coremap_merge_getref - if PA is a shared copy-on-write frame, add a
+ *                       reference to it and return true. It can't
+ *                       change while shared.
+ * coremap_merge_thaw  - let frozen PA be used again, unchanged.
+ * coremap_merge_share - thaw PA as a shared copy-on-write frame, with
+ *                       a reference for the caller. Returns false (and
+ *                       frees PA) if its owner went away.
+ * coremap_merge_commit - map TARGET, whose reference the caller hands
+ *                       over, copy-on-write in place of frozen PA, and
+ *                       free PA.
+ */
+paddr_t coremap_merge_next(unsigned *cursor, unsigned *count,
+			   struct addrspace **as, vaddr_t *va);
+bool coremap_merge_freeze(paddr_t pa, struct addrspace *as, vaddr_t va);
+bool coremap_merge_getref(paddr_t pa);
+void coremap_merge_thaw(paddr_t pa);
+bool coremap_merge_share(paddr_t pa);
+void coremap_merge_commit(paddr_t pa, paddr_t target);
+
+/*
+ * For replacement policies (vmpolicy.h), which know frames by number.
+ * Called with the coremap lock held.
+ *
+ * coremap_pstate   - what the policy needs to know of frame FRAME: 0
+ *                    if it can't be evicted now, otherwise
+ *                    COREMAP_EVICTABLE, with COREMAP_REF if it has been
+ *                    used since its bit was last cleared and
+ *                    COREMAP_DIRTY if it must be written to swap.
+ * coremap_clearref - clear the reference bit of evictable frame FRAME,
+ *                    and make the next use of its page fault so that
+ *                    the bit is set again. Other CPUs' TLBs are shot
+ *                    down once coremap_evict drops the lock; if too
+ *                    many pages are waiting for that, the bit is left
+ *                    set.
+ */
+#define COREMAP_EVICTABLE  1
+#define COREMAP_REF        2
+#define COREMAP_DIRTY      4
+
+unsigned coremap_pstate(unsigned frame);
+void coremap_clearref(unsigned frame);
+
+#endif /* _COREMAP_H_ */
@@ -82,10 +82,16 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_seq counts the shootdowns ever queued for this
+	 * cpu; c_shootdown_done is set to it each time the queue has
+	 * been processed.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_seq;
+	volatile unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
 };
 
@@ -152,6 +158,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * It returns a ticket to pass to ipi_tlbshootdown_wait, which spins
+ * until the target has carried out the shootdown. Don't wait while
+ * holding a spinlock: the target may be spinning for it with
+ * interrupts off, and never take the IPI.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -165,7 +175,9 @@ void cpu_halt(void);
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
-void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown(struct cpu *target,
+			  const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,26 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap(), munmap(), and msync().
+ */
+
+/* Protection: any combination of these. */
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define PROT_EXEC     4
+
+/* Mapping type: exactly one of these. */
+#define MAP_SHARED    1		/* writes go back to the file */
+#define MAP_PRIVATE   2		/* writes are copy-on-write */
+
+/* Flags for msync. Writes are always synchronous. */
+#define MS_SYNC       1
+#define MS_ASYNC      2
+#define MS_INVALIDATE 4
+
+/* Returned by the libc mmap on error. */
+#define MAP_FAILED    ((void *)-1)
+
+#endif /* _KERN_MMAN_H_ */
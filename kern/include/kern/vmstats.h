@@ -0,0 +1,59 @@
+#ifndef _KERN_VMSTATS_H_
+#define _KERN_VMSTATS_H_
+
+/*
+ * VM statistics counters, shared with userlevel so that programs can
+ * read them with __vmstats(). The names that go with them are in
+ * kern/vm/uw-vmstats.c.
+ */
+
+/* DO NOT ADD OR CHANGE WITHOUT ALSO CHANGING stats_names in uw-vmstats.c */
+#define VMSTAT_TLB_FAULT              (0)
+#define VMSTAT_TLB_FAULT_FREE         (1)
+#define VMSTAT_TLB_FAULT_REPLACE      (2)
+#define VMSTAT_TLB_INVALIDATE         (3)
+#define VMSTAT_TLB_RELOAD             (4)
+#define VMSTAT_PAGE_FAULT_ZERO        (5)
+#define VMSTAT_PAGE_FAULT_DISK        (6)
+#define VMSTAT_ELF_FILE_READ          (7)
+#define VMSTAT_SWAP_FILE_READ         (8)
+#define VMSTAT_SWAP_FILE_WRITE        (9)
+#define VMSTAT_COW_FAULT             (10)
+#define VMSTAT_COW_COPY              (11)
+#define VMSTAT_COW_SHARED            (12)
+#define VMSTAT_PAGE_EVICT            (13)
+#define VMSTAT_PAGE_EVICT_USEC       (14)
+#define VMSTAT_ZERO_POOL_HIT         (15)
+#define VMSTAT_ZERO_POOL_MISS        (16)
+#define VMSTAT_FAULT_AROUND          (17)
+#define VMSTAT_PAGECACHE_HIT         (18)
+#define VMSTAT_PAGECACHE_MISS        (19)
+#define VMSTAT_FAULT_TEXT            (20)
+#define VMSTAT_FAULT_DATA            (21)
+#define VMSTAT_FAULT_HEAP            (22)
+#define VMSTAT_FAULT_STACK           (23)
+#define VMSTAT_FAULT_MMAP            (24)
+#define VMSTAT_TLB_SHOOTDOWN         (25)
+#define VMSTAT_FRAME_CACHE_HIT       (26)
+#define VMSTAT_FRAME_CACHE_MISS      (27)
+#define VMSTAT_PAGEOUT_RUN           (28)
+#define VMSTAT_PAGEOUT_EVICT         (29)
+#define VMSTAT_SWAP_CLUSTER_WRITE    (30)
+#define VMSTAT_ZSWAP_STORE           (31)
+#define VMSTAT_ZSWAP_REJECT          (32)
+#define VMSTAT_ZSWAP_LOAD            (33)
+#define VMSTAT_ZSWAP_SPILL           (34)
+#define VMSTAT_ZSWAP_BYTES           (35)
+#define VMSTAT_ZSWAP_USEC            (36)
+#define VMSTAT_MERGE_SCAN            (37)
+#define VMSTAT_MERGE_SHARE           (38)
+#define VMSTAT_MERGE_UNSHARE         (39)
+#define VMSTAT_LOADCTL_DEACTIVATE    (40)
+#define VMSTAT_LOADCTL_REACTIVATE    (41)
+#define VMSTAT_LOADCTL_SWAPOUT       (42)
+#define VMSTAT_COUNT                 (43)
+
+/* Flags for __vmstats() */
+#define VMSTATS_RESET  1	/* start counting from zero again afterwards */
+
+#endif /* _KERN_VMSTATS_H_ */
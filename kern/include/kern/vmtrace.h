@@ -0,0 +1,42 @@
+#ifndef _KERN_VMTRACE_H_
+#define _KERN_VMTRACE_H_
+
+/*
+ * Format of the page reference traces the kernel records with the
+ * "vmtrace" menu command, shared with the tools that read them (see
+ * vmsim). All fields are 32-bit big-endian words.
+ *
+ * A trace is a header followed by records. Each record is one page
+ * reference the kernel saw, that is, one TLB miss that came to
+ * vm_fault (while tracing, all of them do). References that hit in
+ * the TLB are invisible to the kernel, and so to the replacement
+ * policies, and aren't recorded either.
+ *
+ * vtr_space identifies the address space; the same value may be used
+ * again for a new one after a VMTRACE_EXIT record for the old one.
+ * vtr_page holds the page-aligned virtual address, with the record
+ * type and flags in its low bits.
+ */
+
+#define VMTRACE_MAGIC    0x564d5452	/* "VMTR" */
+#define VMTRACE_VERSION  1
+
+struct vmtrace_header {
+	uint32_t vth_magic;
+	uint32_t vth_version;
+	uint32_t vth_pagesize;
+	uint32_t vth_nframes;		/* frames of memory the kernel had */
+};
+
+struct vmtrace_record {
+	uint32_t vtr_space;
+	uint32_t vtr_page;
+};
+
+#define VMTRACE_TYPE(page)  ((page) & 0x3)
+#define VMTRACE_REF      0	/* the page was resident */
+#define VMTRACE_FAULT    1	/* the page had to be read in or zeroed */
+#define VMTRACE_EXIT     2	/* the address space was destroyed */
+#define VMTRACE_WRITE    0x4	/* flag: the reference was a write */
+
+#endif /* _KERN_VMTRACE_H_ */
@@ -0,0 +1,59 @@
+#ifndef _KMPROF_H_
+#define _KMPROF_H_
+
+/*
+ * kmalloc profiler, built in with "options kmprof".
+ *
+ * Every kmalloc is charged to its call site (the address kmalloc
+ * returns to) and to the size class that served it: one of kmalloc's
+ * object caches, the arena, or whole pages. Each live block is
+ * remembered, with the site and how much was asked for and how much
+ * was handed out, so kfree can take it off the same counts. What a
+ * site has live and has never freed is what it is leaking; what a
+ * class hands out beyond what was asked for is its internal
+ * fragmentation.
+ *
+ * Call sites are kept in a fixed open-addressed table of
+ * KMPROF_NSITES; once it is full, new sites are charged to one
+ * catch-all entry. Live blocks are kept in a fixed hash table of
+ * KMPROF_MAXLIVE; blocks allocated while it is full are not tracked,
+ * and nor are frees of blocks that weren't (or of objects that came
+ * from objcache_alloc), but both are counted. Nothing here calls
+ * kmalloc.
+ *
+ * Sites are printed as addresses; os161-addr2line on the kernel turns
+ * them into file and line. Allocations made through wrappers such as
+ * kstrdup and array_setsize are charged to the wrapper.
+ *
+ * kmprof_bootstrap - start the clock for rates. Called from boot once
+ *                    the clock device is up; counts made before then
+ *                    are kept.
+ * kmprof_alloc     - record that kmalloc at CALLER asked for SIZE bytes
+ *                    and got PTR, from size class CLASS (a name that
+ *                    must stay valid) where it can hold GRANTED bytes.
+ *                    PTR may be NULL if kmalloc failed.
+ * kmprof_free      - record that PTR is about to be freed. Must be
+ *                    called before the block is given back, lest it be
+ *                    handed out again and recorded before it is
+ *                    forgotten.
+ * kmprof_print     - print the NTOP sites with the most bytes live, and
+ *                    for each size class the fragmentation and the rate
+ *                    of allocation, since the last reset and since the
+ *                    last print.
+ * kmprof_reset     - clear the counts of allocations and frees, and
+ *                    restart the clock for rates. What is live stays
+ *                    recorded, so later frees still balance.
+ */
+
+#define KMPROF_NSITES   256	/* call sites */
+#define KMPROF_MAXLIVE  4096	/* live blocks */
+#define KMPROF_MAXTOP   20	/* most sites kmprof_print shows */
+
+void kmprof_bootstrap(void);
+void kmprof_alloc(const void *caller, void *ptr, size_t size,
+		  size_t granted, const char *class);
+void kmprof_free(void *ptr);
+void kmprof_print(unsigned ntop);
+void kmprof_reset(void);
+
+#endif /* _KMPROF_H_ */
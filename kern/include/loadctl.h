@@ -0,0 +1,75 @@
+#ifndef _LOADCTL_H_
+#define _LOADCTL_H_
+
+/*
+ * Load control.
+ *
+ * When the working sets of the processes that are running add up to
+ * more memory than there is, every one of them spends its time waiting
+ * for pages the others just pushed out, and the system thrashes. Load
+ * control then deactivates whole processes until the rest fit: their
+ * threads are stopped the next time they would return to user mode,
+ * and their pages are swapped out. Once paging has calmed down and a
+ * deactivated process's working set fits again, it is let back in.
+ *
+ * A kernel thread takes a sample every LOADCTL_INTERVAL seconds. The
+ * working set of an address space is estimated as the pages it used
+ * since the last sample, as seen by the coremap (coremap_wssample),
+ * plus the pages it had to read back from swap. The system is taken
+ * to be thrashing when the estimates of the processes still running
+ * exceed the memory available to user pages, while those processes
+ * read pages back from swap at LOADCTL_THRASH a second or more.
+ *
+ * The process deactivated is the one most recently (re)activated, so
+ * that the ones that have been running longest get to finish; the one
+ * reactivated is the one that has been out longest. The last process
+ * running is never deactivated.
+ *
+ * Load control is on at boot. The "loadctl" menu command turns it off
+ * (reactivating everything) and on again.
+ */
+
+#define LOADCTL_INTERVAL  1	/* seconds between samples */
+#define LOADCTL_THRASH    32	/* swap-ins a second that mean thrashing */
+#define LOADCTL_CALM      8	/* and fewer than this, that it's over */
+
+struct addrspace;
+
+/*
+ * What load control keeps in each address space. The counts are
+ * protected by the coremap lock; the rest by load control's own.
+ */
+struct loadctl_state {
+	struct addrspace *lc_next;	/* on the list of address spaces */
+	unsigned lc_rss;		/* resident pages at the last sample */
+	unsigned lc_used;		/* pages used since the last sample */
+	unsigned lc_swapins;		/* pages read back from swap since */
+	unsigned lc_ws;			/* working set estimate */
+	unsigned lc_seq;		/* when last (de)activated */
+	volatile bool lc_inactive;	/* deactivated */
+	bool lc_swapping;		/* being swapped out */
+};
+
+/*
+ * loadctl_bootstrap  - start the load control thread. Called from
+ *                      vm_bootstrap.
+ * loadctl_register   - start watching AS. Called from as_create.
+ * loadctl_unregister - stop watching AS. Called from as_destroy;
+ *                      waits if AS is being swapped out.
+ * loadctl_checkpoint - if the current process has been deactivated,
+ *                      wait until it is reactivated. Called just
+ *                      before returning to user mode, when no locks
+ *                      are held.
+ * loadctl_enable     - turn load control on or off.
+ * loadctl_enabled    - whether it is on.
+ * loadctl_print      - print what load control knows of each process.
+ */
+void loadctl_bootstrap(void);
+void loadctl_register(struct addrspace *as);
+void loadctl_unregister(struct addrspace *as);
+void loadctl_checkpoint(void);
+void loadctl_enable(bool on);
+bool loadctl_enabled(void);
+void loadctl_print(void);
+
+#endif /* _LOADCTL_H_ */
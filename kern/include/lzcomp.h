@@ -0,0 +1,40 @@
+#ifndef _LZCOMP_H_
+#define _LZCOMP_H_
+
+/*
+ * Small, fast LZ77 compressor (in the style of LZF), for squeezing
+ * pages in memory.
+ *
+ * The compressed data is a sequence of items, each starting with a
+ * control byte C:
+ *     C < 32    C+1 literal bytes follow.
+ *     C >= 32   a back reference: copy L+2 bytes from D+1 bytes back in
+ *               the output, where L is C>>5 (if that's 7, the next byte
+ *               is added to it) and D is (C&31)<<8 plus the byte after.
+ *
+ * Matches are found through a hash table of recent 3-byte sequences,
+ * and only the first candidate is tried, so compressing costs a few
+ * instructions per input byte. Data that doesn't shrink is detected
+ * as soon as the output fills up.
+ *
+ * Functions:
+ *     lz_compress   - compress INLEN bytes at IN into at most OUTMAX
+ *                     bytes at OUT. WORK is scratch space of
+ *                     LZ_WORKSIZE bytes. Returns the compressed size,
+ *                     or 0 if it wouldn't fit in OUTMAX.
+ *     lz_decompress - decompress INLEN bytes at IN into at most OUTMAX
+ *                     bytes at OUT. Returns the size of the result, or
+ *                     0 if the input is corrupt or too big for OUT.
+ *
+ * Input may be at most 64K long.
+ */
+
+#define LZ_HASHBITS  10
+#define LZ_WORKSIZE  ((1 << LZ_HASHBITS) * sizeof(uint16_t))
+
+size_t lz_compress(const void *in, size_t inlen, void *out, size_t outmax,
+		   void *work);
+size_t lz_decompress(const void *in, size_t inlen, void *out,
+		     size_t outmax);
+
+#endif /* _LZCOMP_H_ */
@@ -0,0 +1,88 @@
+#ifndef _OBJCACHE_H_
+#define _OBJCACHE_H_
+
+/*
+ * Object caches.
+ *
+ * An object cache hands out objects of one fixed size, packed as
+ * tightly into whole pages as alignment allows (so a 148-byte object
+ * takes 152 bytes, not the 256 of the next kmalloc size). kmalloc's
+ * own size classes are object caches too; kmalloc.c holds both.
+ *
+ * Each CPU keeps a magazine of up to OBJCACHE_MAGSIZE free objects
+ * for every cache it uses, so most allocations and frees touch only
+ * that CPU's magazine. An empty magazine is refilled, and a full one
+ * emptied, half a magazine at a time from the cache's pages, under
+ * the cache's lock.
+ *
+ * If the cache has a constructor, it is called once on each object
+ * when the page holding it is set up, and objects are expected to be
+ * freed in the state it leaves them in: constructed state survives
+ * a free and the next allocation. Objects of caches without one are
+ * filled with 0xdeadbeef when freed.
+ *
+ * A page is given back as soon as none of its objects are allocated
+ * or in a magazine.
+ *
+ * Caches can be created at run time with objcache_create, or defined
+ * statically with OBJCACHE_INITIALIZER, which needs no setup and so
+ * works from the first kmalloc on. Static caches can't be destroyed.
+ *
+ * kfree also takes an object from any cache; the coremap entry of the
+ * object's page leads to its cache.
+ */
+
+#include <spinlock.h>
+#include <platform/maxcpus.h>
+
+#define OBJCACHE_MAGSIZE  14	/* objects in a magazine */
+#define OBJCACHE_ALIGN    8	/* alignment of objects */
+
+struct objcache_mag;
+struct pageref;
+
+struct objcache {
+	const char *oc_name;
+	size_t oc_size;			/* size asked for */
+	void (*oc_ctor)(void *);	/* constructor, or NULL */
+	bool oc_static;			/* from OBJCACHE_INITIALIZER */
+
+	/* Fixed once the cache has been set up. */
+	bool oc_ready;			/* set up */
+	size_t oc_objsize;		/* space each object takes */
+	size_t oc_linkoff;		/* where the free list link goes */
+	unsigned oc_perpage;		/* objects per page */
+	struct objcache *oc_next;	/* on the list of all caches */
+
+	/* Protected by oc_lock. */
+	struct spinlock oc_lock;
+	struct pageref *oc_partial;	/* pages with free objects */
+	struct pageref *oc_full;	/* pages without */
+	unsigned oc_npages;		/* how many pages in all */
+	unsigned oc_nfree;		/* free objects on them */
+
+	/* One magazine per CPU; each is protected by its own lock. */
+	struct objcache_mag *oc_mags[MAXCPUS];
+};
+
+#define OBJCACHE_INITIALIZER(name, size, ctor) \
+	{ name, size, ctor, true, false, 0, 0, 0, NULL, \
+	  SPINLOCK_INITIALIZER, NULL, NULL, 0, 0, { NULL } }
+
+/*
+ * objcache_create  - make a cache of objects of SIZE bytes (at most
+ *                    2048), called NAME (which is not copied), with
+ *                    constructor CTOR (which may be NULL). Returns
+ *                    NULL if out of memory.
+ * objcache_destroy - destroy a cache made by objcache_create. All its
+ *                    objects must have been freed.
+ * objcache_alloc   - allocate an object. Returns NULL if out of memory.
+ * objcache_free    - free an object allocated from OC.
+ */
+struct objcache *objcache_create(const char *name, size_t size,
+				 void (*ctor)(void *));
+void objcache_destroy(struct objcache *oc);
+void *objcache_alloc(struct objcache *oc);
+void objcache_free(struct objcache *oc, void *ptr);
+
+#endif /* _OBJCACHE_H_ */
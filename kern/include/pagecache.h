@@ -0,0 +1,77 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for memory-mapped files and executables.
+ *
+ * Every file that is mapped somewhere, or run, has one page cache,
+ * shared by all of its mappings, which holds the frames of the file's
+ * pages that have been touched. Processes mapping the same page of the
+ * same file use the same frame. For executables this is done for the
+ * pages of read-only segments (see vm_page_in), so the text of a
+ * program is only in memory once however many processes run it.
+ *
+ * Cached frames are user frames with cme_cached set (see coremap.h).
+ * The cache holds one reference to each, and every page table entry
+ * mapping it holds another. A frame that is still mapped somewhere is
+ * never evicted; once nothing maps it, it stays cached, and the clock
+ * may evict it like any other page.
+ *
+ * A page cache lives on after the last region mapping its file goes
+ * away, so that the next process to run the program finds its pages.
+ * It is freed once its last page is evicted.
+ *
+ * Anonymous page caches (pagecache_anon) hold memory that belongs to
+ * no file, for shared memory segments (shm.h). Their pages start out
+ * zeroed and, having nowhere to be written back to, are never evicted;
+ * they go when the last reference to the cache does.
+ *
+ * Dirty pages are not tracked here; whoever mapped them writable and
+ * wrote them (see as_sync) writes them back with pagecache_writeback
+ * before letting go of them, so unmapped pages are always clean.
+ */
+
+struct vnode;
+struct pagecache;
+struct pcpage;
+
+/*
+ * pagecache_bootstrap - set up. Called from vm_bootstrap.
+ * pagecache_open      - return the page cache of file V, making it if
+ *                       there isn't one, with a reference for the
+ *                       caller. The cache keeps its own reference to V.
+ * pagecache_anon      - make an anonymous page cache, with a reference
+ *                       for the caller.
+ * pagecache_isanon    - true if PC is anonymous.
+ * pagecache_lastref   - true if the caller's reference to PC is the
+ *                       only one.
+ * pagecache_incref    - add a reference to a page cache.
+ * pagecache_decref    - drop a reference to a page cache.
+ * pagecache_getpage   - return the frame holding the page of the file
+ *                       at OFFSET (page-aligned), reading it in if it
+ *                       isn't cached, with a reference for the caller's
+ *                       page table entry. Bytes past the end of the file
+ *                       read as zero. May sleep.
+ * pagecache_writeback - write the page at OFFSET, held in frame PA,
+ *                       back to the file. Never makes the file longer.
+ *                       Does nothing for anonymous caches. May sleep.
+ * pagecache_purge     - drop every page of files nobody has mapped, and
+ *                       with them the references to their vnodes. Called
+ *                       at shutdown, before unmounting.
+ * pagecache_unlink    - take page PP out of its cache, for coremap_evict.
+ *                       Called with the coremap lock held; the caller
+ *                       frees PP.
+ */
+void pagecache_bootstrap(void);
+int pagecache_open(struct vnode *v, struct pagecache **ret);
+int pagecache_anon(struct pagecache **ret);
+bool pagecache_isanon(struct pagecache *pc);
+bool pagecache_lastref(struct pagecache *pc);
+void pagecache_incref(struct pagecache *pc);
+void pagecache_decref(struct pagecache *pc);
+int pagecache_getpage(struct pagecache *pc, off_t offset, paddr_t *ret);
+int pagecache_writeback(struct pagecache *pc, off_t offset, paddr_t pa);
+void pagecache_purge(void);
+void pagecache_unlink(struct pcpage *pp);
+
+#endif /* _PAGECACHE_H_ */
@@ -0,0 +1,37 @@
+#ifndef _PAGEMERGE_H_
+#define _PAGEMERGE_H_
+
+/*
+ * Same-page merging.
+ *
+ * A kernel thread walks the coremap a few pages at a time looking for
+ * user pages with identical contents, such as the buffers many
+ * processes zero-fill or the pages of a fan-out of forked children
+ * that have each written the same thing. Identical pages are merged
+ * into a single frame shared copy-on-write, as fork shares pages; the
+ * first write to one gives that process a private copy again.
+ *
+ * Pages are hashed as they are found, without stopping anyone using
+ * them. Only when the hash matches that of a merged frame, or of
+ * another page seen earlier in the same pass over memory, are the two
+ * frozen (see coremap.h) and compared byte for byte, and merged if
+ * they are still the same.
+ *
+ * The scanner looks at pagemerge_rate frames a second; PAGEMERGE_RATE
+ * is the rate at boot, and 0 turns it off. The "merge" menu command
+ * changes it.
+ */
+
+#define PAGEMERGE_RATE      256	/* frames looked at per second */
+#define PAGEMERGE_NBUCKETS  256	/* hash chains per table */
+
+/*
+ * pagemerge_bootstrap - start the scanner. Called from vm_bootstrap.
+ * pagemerge_setrate   - scan PAGES frames a second from now on.
+ * pagemerge_getrate   - the current scan rate.
+ */
+void pagemerge_bootstrap(void);
+void pagemerge_setrate(unsigned pages);
+unsigned pagemerge_getrate(void);
+
+#endif /* _PAGEMERGE_H_ */
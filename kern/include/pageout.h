@@ -0,0 +1,34 @@
+#ifndef _PAGEOUT_H_
+#define _PAGEOUT_H_
+
+/*
+ * The pageout daemon.
+ *
+ * A kernel thread that keeps a reserve of free frames, so that page
+ * faults seldom have to evict a page themselves, and wait for it to be
+ * written to swap, before they can go on. It is woken when free memory
+ * (coremap_freepages) drops below the low watermark, and evicts pages
+ * with coremap_reclaim until it is back up to the high watermark.
+ * Dirty pages are written out in runs of neighbouring pages, one swap
+ * request per run.
+ *
+ * The watermarks are fractions of memory, with a floor so that small
+ * machines still keep a few frames in hand. If memory runs out before
+ * the daemon catches up, faults evict for themselves as before.
+ */
+
+#define PAGEOUT_LOW_DIV   32	/* wake below 1/32 of memory free */
+#define PAGEOUT_HIGH_DIV  16	/* reclaim up to 1/16 */
+#define PAGEOUT_LOW_MIN   8	/* but never below this many frames */
+
+/*
+ * pageout_bootstrap - set the watermarks and start the daemon. Called
+ *                     from vm_bootstrap.
+ * pageout_check     - wake the daemon if free memory is below the low
+ *                     watermark. Called by the coremap as it hands out
+ *                     frames. Does not sleep.
+ */
+void pageout_bootstrap(void);
+void pageout_check(void);
+
+#endif /* _PAGEOUT_H_ */
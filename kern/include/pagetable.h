@@ -0,0 +1,100 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-address-space page table.
+ *
+ * Two levels, split the same way as the MIPS virtual page number:
+ * the top 10 bits of a user address index the directory, the next 10
+ * bits index a second-level table of page table entries. Second-level
+ * tables are only allocated once some page in their 4M range is used.
+ *
+ * A page table entry is laid out like the low word of a TLB entry so
+ * that it can be loaded into the TLB as-is:
+ *
+ *    PTE_FRAME    physical address of the frame holding the page
+ *    PTE_WRITE    writes are allowed (TLBLO_DIRTY)
+ *    PTE_VALID    the page is resident in PTE_FRAME (TLBLO_VALID)
+ *    PTE_COW      the frame is shared copy-on-write; PTE_WRITE is
+ *                 clear until the first write makes a private copy
+ *    PTE_DIRTY    the page differs from where it was loaded from, so
+ *                 it must go to swap if it is evicted
+ *    PTE_SWAPPED  the page is in swap, in slot PTE_SLOT (which takes
+ *                 the place of PTE_FRAME)
+ *    PTE_BUSY     the frame in PTE_FRAME is being evicted
+ *    PTE_UNREF    the clock hand has cleared the frame's reference
+ *                 bit; the next miss on the page must go to vm_fault
+ *                 so that the reference is seen
+ *    PTE_SHARED   the frame belongs to the page cache of a shared
+ *                 file mapping (see pagecache.h); it stays shared
+ *                 across fork, and writes to it go back to the file
+ *
+ * PTE_WRITE is left clear until the first write to a page, even in a
+ * writable region, so that vm_fault sees the write and sets PTE_DIRTY.
+ *
+ * An all-zero entry is a page that has never been touched, or a clean
+ * page that was evicted; either way it is refilled from its region.
+ *
+ * The UTLB refill handler in exception-mips1.S walks the table of the
+ * address space in cpupagetables[] directly, and loads any entry that
+ * has PTE_VALID set and PTE_BUSY and PTE_UNREF clear. Everything else
+ * goes through vm_fault. The handler knows these bit values too.
+ *
+ * Because eviction changes entries of other address spaces, entries
+ * with PTE_VALID or PTE_BUSY set may only be read or changed while
+ * holding the coremap lock (see vmprivate.h).
+ */
+
+#include <mips/tlb.h>
+
+struct addrspace;
+
+#define PT_NENTRIES      1024
+#define PT_DIR_INDEX(va) (((va) >> 22) & 0x3ff)
+#define PT_TBL_INDEX(va) (((va) >> 12) & 0x3ff)
+
+#define PTE_FRAME   TLBLO_PPAGE
+#define PTE_WRITE   TLBLO_DIRTY
+#define PTE_VALID   TLBLO_VALID
+#define PTE_COW     0x00000001
+#define PTE_DIRTY   0x00000002
+#define PTE_SWAPPED 0x00000004
+#define PTE_BUSY    0x00000008
+#define PTE_UNREF   0x00000010
+#define PTE_SHARED  0x00000020
+
+#define PTE_SLOT(pte)   ((pte) >> 12)
+#define SLOT_TO_PTE(s)  (((pte_t)(s) << 12) | PTE_SWAPPED)
+
+/* The bits of an entry that belong in the TLB. */
+#define PTE_TLBBITS (PTE_FRAME | PTE_WRITE | PTE_VALID)
+
+typedef uint32_t pte_t;
+
+struct pagetable {
+	pte_t *pt_dir[PT_NENTRIES];	/* second-level tables, or NULL */
+};
+
+/*
+ * pt_create  - make an empty page table.
+ * pt_destroy - free a page table, along with every frame and swap
+ *              slot it uses.
+ * pt_lookup  - return a pointer to the entry for VA. If there is no
+ *              second-level table for VA yet, one is made if CREATE
+ *              is true; otherwise NULL is returned. Also returns NULL
+ *              if out of memory.
+ * pt_unmap   - free the pages in [START, END) and zero their entries.
+ *              START must be page-aligned.
+ * pt_copy    - fill NEW (empty) with the resident pages of OLD. The
+ *              frames are shared copy-on-write rather than copied, so
+ *              writable pages become read-only in OLD as well, except
+ *              for PTE_SHARED pages, which are just shared. Pages in
+ *              swap are copied to new slots.
+ */
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t va, bool create);
+void pt_unmap(struct pagetable *pt, vaddr_t start, vaddr_t end);
+int pt_copy(struct pagetable *old, struct pagetable *new);
+
+#endif /* _PAGETABLE_H_ */
@@ -42,6 +42,11 @@
 
 struct addrspace;
 struct vnode;
+
+#if OPT_A2
+#define PROC_FIRSTFD  3		/* 0-2 are the console */
+#define PROC_MAXFILES 16
+#endif
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -74,6 +79,10 @@ struct proc {
 	#if OPT_A2
 	//the id of this process
 	pid_t pid;
+	//files opened for reading with open(); fd PROC_FIRSTFD+i is slot i
+	//not inherited by fork, closed in proc_destroy
+	struct vnode *p_files[PROC_MAXFILES];
+	off_t p_offsets[PROC_MAXFILES];
 	#endif
 };
 
@@ -102,6 +111,10 @@ int findPInfo(pid_t givPid);
 //this is done only when the specific proc is finished AND its parent is finished
 void removePInfo(int ploc);
 
+//undoes what proc_create_runprogram set up for a child of the current proc
+//this is only run when the child never got to run (fork failed)
+void forgetChild(pid_t childPid);
+
 //checks if any children of current proc need to be removed
 //this is only run when the current proc is ending
 int checkChildren(int ploc);
@@ -0,0 +1,47 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+/*
+ * Shared memory segments.
+ *
+ * A segment is a run of anonymous memory with an integer key. Any
+ * process that knows the key can attach the segment, which maps the
+ * same frames into its address space, shared and writable, wherever
+ * there is room between the heap and the stack (as mmap does). The
+ * frames come from an anonymous page cache (pagecache.h), so they are
+ * reference counted in the coremap like those of mapped files, and
+ * fork shares them with the child.
+ *
+ * A segment lasts until it is removed and the last process detaches
+ * it (or exits). Removing it frees its key straight away.
+ *
+ * Segment memory can't be evicted, so there are at most SHM_MAXSEGS
+ * segments that haven't been removed, holding at most 1/SHM_MAXDIV of
+ * memory between them and the removed ones still attached.
+ */
+
+#define SHM_MAXSEGS  64
+#define SHM_MAXDIV   4
+
+struct addrspace;
+
+/*
+ * shm_bootstrap - set up. Called from vm_bootstrap.
+ * shm_create    - make a segment of LEN bytes (rounded up to whole
+ *                 pages) with key KEY. Returns EEXIST if there is one
+ *                 already, ENOSPC if there are too many segments, and
+ *                 ENOMEM if they would take too much memory.
+ * shm_attach    - map the segment with key KEY into AS, and hand back
+ *                 its address in RET. Returns ENOENT if there is none.
+ * shm_detach    - unmap the segment attached at ADDR in AS. Returns
+ *                 EINVAL if there is none.
+ * shm_remove    - remove the segment with key KEY. Returns ENOENT if
+ *                 there is none.
+ */
+void shm_bootstrap(void);
+int shm_create(int key, size_t len);
+int shm_attach(struct addrspace *as, int key, vaddr_t *ret);
+int shm_detach(struct addrspace *as, vaddr_t addr);
+int shm_remove(int key);
+
+#endif /* _SHM_H_ */
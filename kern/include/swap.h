@@ -0,0 +1,49 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Backing store for evicted user pages.
+ *
+ * Swap space is a whole raw disk, divided into page-sized slots. A
+ * bitmap records which slots hold a page. If the disk isn't there the
+ * system runs without swap, and only clean pages can be evicted.
+ *
+ * Pages that compress well are kept in memory, in the compressed tier
+ * (zswap.h), rather than written to disk; their slot stays reserved
+ * so that they can be spilled to it later. Callers don't see the
+ * difference, except that swap_read says where the page came from.
+ */
+
+#define SWAP_DEVICE "lhd1raw:"
+
+/* Most pages swap_write_cluster writes in one request. */
+#define SWAP_MAXCLUSTER 8
+
+/*
+ * swap_bootstrap - open the swap disk. Called from vm_bootstrap.
+ * swap_alloc     - reserve a free slot. Returns ENOSPC if there is
+ *                  none. Does not sleep.
+ * swap_alloc_cluster - reserve NPAGES consecutive free slots, and
+ *                  return the first in SLOT. Returns ENOSPC if there
+ *                  is no such run. Does not sleep.
+ * swap_free      - release a slot. Does not sleep.
+ * swap_read      - read slot SLOT into the frame at PA. Sets
+ *                  COMPRESSED if it came from the compressed tier
+ *                  rather than the disk.
+ * swap_write     - write the frame at PA to slot SLOT.
+ * swap_write_cluster - write the NPAGES frames at PAS[] to the slots
+ *                  starting at SLOT. Those that don't compress go to
+ *                  disk, in one request per run of them.
+ * swap_copy      - copy slot FROM into a newly allocated slot, which
+ *                  is returned in TO.
+ */
+void swap_bootstrap(void);
+int swap_alloc(unsigned *slot);
+int swap_alloc_cluster(unsigned npages, unsigned *slot);
+void swap_free(unsigned slot);
+int swap_read(paddr_t pa, unsigned slot, bool *compressed);
+int swap_write(paddr_t pa, unsigned slot);
+int swap_write_cluster(const paddr_t *pas, unsigned npages, unsigned slot);
+int swap_copy(unsigned from, unsigned *to);
+
+#endif /* _SWAP_H_ */
@@ -46,6 +46,11 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
 
+#ifdef UW
+/* Give back the trapframe sys_fork handed to enter_forked_process. */
+void sys_fork_freetf(struct trapframe *tf);
+#endif
+
 /* Enter user mode. Does not return. */
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
@@ -60,12 +65,27 @@ int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_open(userptr_t path, int flags, int *retval);
+int sys_read(int fdesc, userptr_t ubuf, size_t nbytes, int *retval);
+int sys_close(int fdesc);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(const char *program, char ** args);
 
+/* in vm_syscalls.c; not in dumbvm */
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(userptr_t path, size_t len, int prot, int flags, off_t offset,
+	     vaddr_t *retval);
+int sys_munmap(vaddr_t addr, size_t len);
+int sys_msync(vaddr_t addr, size_t len, int flags);
+int sys___vmstats(userptr_t counts, size_t ncounts, int flags, int *retval);
+int sys_shm_create(int key, size_t len);
+int sys_shm_attach(int key, vaddr_t *retval);
+int sys_shm_detach(vaddr_t addr);
+int sys_shm_remove(int key);
+
 #endif // UW
 
 #endif /* _SYSCALL_H_ */
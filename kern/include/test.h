@@ -78,6 +78,9 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int objcachetest(int, char **);
+int arenatest(int, char **);
+int coremaptest(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
@@ -84,6 +84,15 @@ struct thread {
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 
+	/*
+	 * Scheduling fields; see schedule() in thread.c. Changed only
+	 * by the thread itself while running, or under the run queue
+	 * lock of t_cpu while it is on that run queue.
+	 */
+	unsigned t_priority;		/* Queue level, 0 (highest) and up */
+	unsigned t_ticks;		/* Hardclocks run at this level */
+	unsigned t_waited;		/* Hardclocks ready since last run */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -152,11 +161,25 @@ void thread_exit(void);
 
 /*
  * Cause the current thread to yield to the next runnable thread, but
- * itself stay runnable.
+ * itself stay runnable. It drops to the lowest priority level, so
+ * that every other runnable thread gets to go first.
  * Interrupts need not be disabled.
  */
 void thread_yield(void);
 
+/*
+ * Return true if other threads are waiting to run on this cpu. For
+ * background threads that only want time nobody else is using.
+ */
+bool thread_others_runnable(void);
+
+/*
+ * Charge the current thread for a hardclock, and yield if it has used
+ * up its time slice or a thread of higher priority is waiting. Called
+ * from the timer interrupt.
+ */
+void thread_timeslice(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -12,31 +12,23 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions (except vmstats_print) whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines) by running with interrupts off.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally (except vmstats_print).
  *
  * Generally you will use the functions whose names
  * do not begin with '_'.
+ *
+ * Each CPU counts in its own slots, so counting takes no lock; the
+ * slots are only added up when the stats are read.
  */
 
 
 /* These are the different stats that get tracked.
  * See vmstats.c for strings corresponding to each stat.
+ * The numbers are in kern/vmstats.h so that user programs can use them too.
  */
-
-/* DO NOT ADD OR CHANGE WITHOUT ALSO CHANGING vmstats.h */
-#define VMSTAT_TLB_FAULT              (0)
-#define VMSTAT_TLB_FAULT_FREE         (1)
-#define VMSTAT_TLB_FAULT_REPLACE      (2)
-#define VMSTAT_TLB_INVALIDATE         (3)
-#define VMSTAT_TLB_RELOAD             (4)
-#define VMSTAT_PAGE_FAULT_ZERO        (5)
-#define VMSTAT_PAGE_FAULT_DISK        (6)
-#define VMSTAT_ELF_FILE_READ          (7)
-#define VMSTAT_SWAP_FILE_READ         (8)
-#define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#include <kern/vmstats.h>
 
 /* ----------------------------------------------------------------------- */
 
@@ -52,7 +44,19 @@ void _vmstats_init(void);                    /* atomicity must be ensured elsewh
 void vmstats_inc(unsigned int index);    /* uses locking */
 void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
 
+/* Add an amount to the specified count (for counts that are not events,
+ * like VMSTAT_PAGE_EVICT_USEC)
+ */
+void vmstats_add(unsigned int index, unsigned int amount);    /* uses locking */
+void _vmstats_add(unsigned int index, unsigned int amount);   /* atomicity must be ensured elsewhere */
+
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print(void);                    /* Does NOT use locking */
 
+/* Copy the totals since the last reset into COUNTS (VMSTAT_COUNT of them),
+ * and start the totals from zero again if RESET is set. This is what
+ * __vmstats() sees; vmstats_print always shows everything since boot.
+ */
+void vmstats_snapshot(unsigned int *counts, bool reset);   /* uses locking */
+
 #endif /* VM_STATS_H */
@@ -59,5 +59,8 @@ void free_kpages(vaddr_t addr);
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Print per-CPU TLB shootdown counts (not in dumbvm) */
+void vm_tlb_printstats(void);
+
 
 #endif /* _VM_H_ */
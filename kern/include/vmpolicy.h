@@ -0,0 +1,88 @@
+#ifndef _VMPOLICY_H_
+#define _VMPOLICY_H_
+
+/*
+ * Page replacement policies.
+ *
+ * The coremap decides what can be evicted (see coremap.h); a policy
+ * decides which of those pages goes first. The coremap tells the
+ * policy in use about every user frame as it comes and goes and each
+ * time its page is used, and asks it for a victim when a page has to
+ * be evicted. These are:
+ *
+ *   fifo    first in, first out; ignores use entirely.
+ *   clock   second chance: a page used since the hand last passed
+ *           is skipped once. The default.
+ *   eclock  enhanced clock: like clock, but prefers clean pages to
+ *           dirty ones, which have to be written to swap first.
+ *   2q      2Q: new pages go on a FIFO queue; a page evicted from it
+ *           that comes back soon after is taken to be in the working
+ *           set and goes on a second, LRU-like queue instead, from
+ *           which it is evicted only when the FIFO queue is short.
+ *
+ * MIPS has no reference bits, so "used" means loaded into the TLB by
+ * vm_fault (see the comment in coremap.c). The pages the hand passes
+ * are made to fault again on their next use so that it notices.
+ *
+ * The policy is chosen at boot with the "vmpolicy" menu command (on
+ * the kernel command line), and can be changed later.
+ *
+ * Every operation is called with the coremap lock held, so none may
+ * sleep or allocate memory.
+ *
+ * vp_reset  - forget every frame. The coremap then vp_inserts the
+ *             frames already in use.
+ * vp_insert - frame FRAME now holds page VA of AS, or a page cache
+ *             page if AS is NULL. It starts out used.
+ * vp_touch  - frame FRAME has been used.
+ * vp_remove - frame FRAME has been freed. May be called for frames
+ *             the policy no longer has.
+ * vp_evict  - frame FRAME, chosen by vp_victim (or written out with
+ *             it), is being evicted. AS and VA are as for vp_insert.
+ * vp_victim - return the frame to evict next, or -1 if nothing can
+ *             be evicted. Only frames coremap_pstate says are
+ *             evictable may be returned, and if CLEANONLY, only
+ *             clean ones. The frame stays the policy's until
+ *             vp_evict.
+ */
+
+struct addrspace;
+
+struct vmpolicy {
+	const char *vp_name;
+	void (*vp_reset)(void);
+	void (*vp_insert)(unsigned frame, struct addrspace *as, vaddr_t va);
+	void (*vp_touch)(unsigned frame);
+	void (*vp_remove)(unsigned frame);
+	void (*vp_evict)(unsigned frame, struct addrspace *as, vaddr_t va);
+	int (*vp_victim)(bool cleanonly);
+};
+
+/* Policy at boot. */
+#define VMPOLICY_DEFAULT "clock"
+
+/* 2Q: share of memory for the FIFO queue, and pages remembered. */
+#define VMPOLICY_2Q_INDIV   4	/* FIFO queue: 1/4 of the frames */
+#define VMPOLICY_2Q_OUTDIV  2	/* evicted pages: 1/2 as many */
+
+/*
+ * The clock policy needs no memory of its own, so the coremap can use
+ * it from the start, before vmpolicy_bootstrap.
+ */
+extern const struct vmpolicy vmpolicy_clock;
+
+/*
+ * vmpolicy_bootstrap - allocate what the other policies need, and
+ *                      switch to VMPOLICY_DEFAULT. Called from
+ *                      vm_bootstrap.
+ * vmpolicy_select    - switch to the policy called NAME. Returns
+ *                      ENOENT if there is none.
+ * vmpolicy_current   - the name of the policy in use.
+ * vmpolicy_list      - print the names of the policies.
+ */
+void vmpolicy_bootstrap(void);
+int vmpolicy_select(const char *name);
+const char *vmpolicy_current(void);
+void vmpolicy_list(void);
+
+#endif /* _VMPOLICY_H_ */
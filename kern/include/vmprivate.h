@@ -0,0 +1,42 @@
+#ifndef _VMPRIVATE_H_
+#define _VMPRIVATE_H_
+
+struct addrspace;
+
+/*
+ * Subsystem-private VM defs.
+ *
+ * Only the files in kern/vm should include this. It lives in the
+ * public include directory for the same reason threadprivate.h does.
+ */
+
+/* Invalidate every entry in this CPU's TLB. */
+void vm_tlb_flush(void);
+
+/*
+ * vm_tlb_activate - make sure this CPU's TLB holds nothing but AS's
+ *                   translations, flushing it if it holds another's.
+ * vm_tlb_forget   - note that no TLB may keep AS's translations, so
+ *                   they are flushed before AS is used again.
+ * vm_tlb_invalidate - invalidate this CPU's TLB entry for page VA of
+ *                   AS, if it has one.
+ * vm_tlb_shootdown - invalidate the NPAGES pages of AS from VA on in
+ *                   all TLBs, after their page table entries are taken
+ *                   away or changed, and wait until every CPU has done
+ *                   so. If there are more than TLBSHOOTDOWN_MAX pages,
+ *                   whole TLBs are flushed instead. Only CPUs that have
+ *                   run AS are asked. Must not be called while holding
+ *                   a spinlock (such as the coremap lock).
+ * vm_tlb_shootdown_page - the same, for the single page VA.
+ * vm_tlb_slowpath - stop the UTLB handler refilling any CPU's TLB
+ *                   until the CPU next activates an address space,
+ *                   so that every miss goes to vm_fault.
+ */
+void vm_tlb_activate(struct addrspace *as);
+void vm_tlb_forget(struct addrspace *as);
+void vm_tlb_invalidate(struct addrspace *as, vaddr_t va);
+void vm_tlb_shootdown(struct addrspace *as, vaddr_t va, unsigned npages);
+void vm_tlb_shootdown_page(struct addrspace *as, vaddr_t va);
+void vm_tlb_slowpath(void);
+
+#endif /* _VMPRIVATE_H_ */
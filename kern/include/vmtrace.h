@@ -0,0 +1,40 @@
+#ifndef _VMTRACE_H_
+#define _VMTRACE_H_
+
+/*
+ * Page reference tracing.
+ *
+ * While tracing is on, vm_fault records each page reference it sees
+ * in a ring buffer, and a kernel thread writes them to a file in the
+ * format of <kern/vmtrace.h>, for replaying against the replacement
+ * policies (vmpolicy.h) with vmsim. The ring is written out whenever
+ * it is half full; if it fills up anyway, references are dropped and
+ * counted.
+ *
+ * So that the trace shows every TLB miss, not just the few the UTLB
+ * handler can't deal with, the handler is bypassed while tracing,
+ * and so is fault-around. Both make tracing slow.
+ *
+ * vmtrace_bootstrap - set up. Called from vm_bootstrap.
+ * vmtrace_start     - start recording to file PATH, which is created
+ *                     or truncated. Returns EBUSY if already tracing.
+ * vmtrace_stop      - stop, write out what's left, close the file and
+ *                     print how many references were recorded. Returns
+ *                     EINVAL if not tracing, or any error writing.
+ * vmtrace_active    - true while tracing.
+ * vmtrace_record    - record a reference to page VA of AS, or the end
+ *                     of AS; TYPE is as in <kern/vmtrace.h>. Must not
+ *                     be called with a spinlock held.
+ */
+
+struct addrspace;
+
+#define VMTRACE_NBUF 8192	/* references in the ring */
+
+void vmtrace_bootstrap(void);
+int vmtrace_start(const char *path);
+int vmtrace_stop(void);
+bool vmtrace_active(void);
+void vmtrace_record(struct addrspace *as, vaddr_t va, unsigned type);
+
+#endif /* _VMTRACE_H_ */
@@ -0,0 +1,39 @@
+#ifndef _ZEROPOOL_H_
+#define _ZEROPOOL_H_
+
+/*
+ * Pool of pre-zeroed frames.
+ *
+ * A kernel thread zeroes free frames in time its CPU would otherwise
+ * spend idle, and keeps up to ZEROPOOL_SIZE of them here. Pages that
+ * are zero-filled on first touch take a frame from the pool instead
+ * of zeroing one on the fault path. When the pool drops below
+ * ZEROPOOL_LOW the thread is woken to top it up.
+ *
+ * The thread only takes frames that are free; it never evicts. When
+ * memory runs out, coremap_alloc_upage takes pooled frames before it
+ * evicts anything.
+ */
+
+#define ZEROPOOL_SIZE 64
+#define ZEROPOOL_LOW  32
+
+struct addrspace;
+
+/*
+ * zeropool_bootstrap  - start the zeroing thread. Called from
+ *                       vm_bootstrap.
+ * zeropool_get        - take a zeroed frame, a one-page kernel block,
+ *                       out of the pool. Returns its physical address,
+ *                       or 0 if the pool is empty.
+ * zeropool_available - number of frames in the pool, roughly.
+ * zeropool_alloc_upage - like coremap_alloc_upage, but the frame is
+ *                       zero-filled: from the pool if possible, or
+ *                       else zeroed here.
+ */
+void zeropool_bootstrap(void);
+paddr_t zeropool_get(void);
+unsigned zeropool_available(void);
+paddr_t zeropool_alloc_upage(struct addrspace *as, vaddr_t va);
+
+#endif /* _ZEROPOOL_H_ */
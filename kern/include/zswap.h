@@ -0,0 +1,59 @@
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+/*
+ * Compressed swap tier.
+ *
+ * Pages on their way to swap are first compressed (with lz_compress)
+ * and, if they shrink to at most half a page, kept in memory instead
+ * of being written to the swap disk. Zero-filled buffers and sparse
+ * arrays shrink to almost nothing, so many evicted pages never cost a
+ * disk write, and paging them back in is a decompression rather than
+ * a disk read.
+ *
+ * The tier sits in front of the swap disk and is indexed by swap slot:
+ * every page in it also has a slot on disk reserved (see swap.c), so a
+ * page can always be moved ("spilled") there. When the tier is full,
+ * the pages that have been in it longest are spilled to make room;
+ * pages leave the tier when their slot is freed, so those are the
+ * coldest.
+ *
+ * Compressed pages are packed into pool pages, ZSWAP_CHUNK bytes at a
+ * time. The pool takes free pages only (never evicting for itself)
+ * and is at most 1/ZSWAP_DIV of memory. Pool pages that empty out are
+ * given back when the tier is next used.
+ */
+
+#define ZSWAP_CHUNK 128		/* allocation unit in pool pages */
+#define ZSWAP_DIV   8		/* pool is at most this fraction of memory */
+
+/*
+ * zswap_bootstrap  - set up the tier for NSLOTS swap slots. Called
+ *                    from swap_bootstrap.
+ * zswap_store      - compress the page at KVA and keep it as slot
+ *                    SLOT's. Returns E2BIG if it doesn't compress well
+ *                    enough, or ENOSPC if there's no room for it.
+ * zswap_load       - decompress slot SLOT's page into KVA. Returns
+ *                    ENOENT if the tier doesn't hold it (it is on disk).
+ * zswap_free       - forget slot SLOT's page, if the tier has it.
+ *                    Returns false if it is being spilled: then the
+ *                    slot isn't free until zswap_spill_end says so.
+ *                    Does not sleep.
+ * zswap_spill_begin - choose the coldest page to go to disk, and
+ *                    decompress it into KVA. Returns its slot in SLOT,
+ *                    or ENOENT if the tier is empty. The page can still
+ *                    be loaded until zswap_spill_end.
+ * zswap_spill_end  - the page of slot SLOT is on disk now; drop it.
+ *                    Returns true if the slot was freed meanwhile, and
+ *                    the caller must now release it.
+ *
+ * All but zswap_free may sleep.
+ */
+void zswap_bootstrap(unsigned nslots);
+int zswap_store(vaddr_t kva, unsigned slot);
+int zswap_load(vaddr_t kva, unsigned slot);
+bool zswap_free(unsigned slot);
+int zswap_spill_begin(vaddr_t kva, unsigned *slot);
+bool zswap_spill_end(unsigned slot);
+
+#endif /* _ZSWAP_H_ */
@@ -0,0 +1,164 @@
+/*
+ * LZ compressor. See lzcomp.h for the format.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <lzcomp.h>
+
+#define LZ_MAXLIT    32			/* longest literal run */
+#define LZ_MAXOFF    (1 << 13)		/* farthest back reference */
+#define LZ_MAXMATCH  (7 + 255 + 2)	/* longest back reference */
+
+#define LZ_HASH(p) \
+	((((uint32_t)(p)[0] << 16 | (uint32_t)(p)[1] << 8 | (p)[2]) * \
+	  2654435761U) >> (32 - LZ_HASHBITS))
+
+size_t
+lz_compress(const void *in, size_t inlen, void *out, size_t outmax,
+	    void *work)
+{
+	const uint8_t *ip, *iend, *ref;
+	uint8_t *op, *oend, *litp;
+	uint16_t *htab;
+	unsigned h, off, len, maxlen, lit;
+
+	KASSERT(inlen < 65536);
+
+	if (outmax == 0) {
+		return 0;
+	}
+
+	/* Table entries are input positions plus one; 0 is empty. */
+	htab = work;
+	bzero(htab, LZ_WORKSIZE);
+
+	ip = in;
+	iend = ip + inlen;
+	op = out;
+	oend = op + outmax;
+
+	/* Every literal run starts with a control byte; keep room for it. */
+	lit = 0;
+	litp = op++;
+
+	while (ip < iend) {
+		if (iend - ip >= 3) {
+			h = LZ_HASH(ip);
+			ref = htab[h] ? (const uint8_t *)in + htab[h] - 1 : NULL;
+			htab[h] = ip - (const uint8_t *)in + 1;
+
+			if (ref != NULL && ip - ref <= LZ_MAXOFF &&
+			    ref[0] == ip[0] && ref[1] == ip[1] &&
+			    ref[2] == ip[2]) {
+				off = ip - ref - 1;
+				maxlen = iend - ip;
+				if (maxlen > LZ_MAXMATCH) {
+					maxlen = LZ_MAXMATCH;
+				}
+				for (len = 3; len < maxlen; len++) {
+					if (ref[len] != ip[len]) {
+						break;
+					}
+				}
+				ip += len;
+				len -= 2;
+
+				/* Finish the literal run, if there was one. */
+				if (lit > 0) {
+					*litp = lit - 1;
+				}
+				else {
+					op--;
+				}
+				/* Reference, and the next run's control byte */
+				if (oend - op < (len < 7 ? 2 : 3) + 1) {
+					return 0;
+				}
+				if (len < 7) {
+					*op++ = (off >> 8) | (len << 5);
+				}
+				else {
+					*op++ = (off >> 8) | (7 << 5);
+					*op++ = len - 7;
+				}
+				*op++ = off & 0xff;
+
+				lit = 0;
+				litp = op++;
+				continue;
+			}
+		}
+
+		if (op >= oend) {
+			return 0;
+		}
+		*op++ = *ip++;
+		lit++;
+		if (lit == LZ_MAXLIT) {
+			*litp = lit - 1;
+			if (op >= oend) {
+				return 0;
+			}
+			lit = 0;
+			litp = op++;
+		}
+	}
+
+	if (lit > 0) {
+		*litp = lit - 1;
+	}
+	else {
+		op--;
+	}
+	return op - (uint8_t *)out;
+}
+
+size_t
+lz_decompress(const void *in, size_t inlen, void *out, size_t outmax)
+{
+	const uint8_t *ip, *iend;
+	uint8_t *op, *oend, *ref;
+	unsigned c, len, off;
+
+	ip = in;
+	iend = ip + inlen;
+	op = out;
+	oend = op + outmax;
+
+	while (ip < iend) {
+		c = *ip++;
+		if (c < LZ_MAXLIT) {
+			len = c + 1;
+			if (len > (size_t)(oend - op) || len > (size_t)(iend - ip)) {
+				return 0;
+			}
+			memcpy(op, ip, len);
+			op += len;
+			ip += len;
+			continue;
+		}
+
+		len = c >> 5;
+		if (len == 7) {
+			if (ip >= iend) {
+				return 0;
+			}
+			len += *ip++;
+		}
+		if (ip >= iend) {
+			return 0;
+		}
+		off = ((c & 0x1f) << 8) + *ip++ + 1;
+		len += 2;
+		if (off > (size_t)(op - (uint8_t *)out) ||
+		    len > (size_t)(oend - op)) {
+			return 0;
+		}
+		/* Byte by byte: the source may overlap what we're writing. */
+		for (ref = op - off; len > 0; len--) {
+			*op++ = *ref++;
+		}
+	}
+	return op - (uint8_t *)out;
+}
@@ -52,12 +52,17 @@
 #include <kern/fcntl.h>  
 #include <kern/errno.h>
 #include <limits.h>
+#include <objcache.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/* Where proc structures come from. */
+static struct objcache proc_cache =
+	OBJCACHE_INITIALIZER("proc", sizeof(struct proc), NULL);
+
 /*
  * Mechanism for making the kernel menu thread sleep while processes are running
  */
@@ -91,13 +96,13 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = objcache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		objcache_free(&proc_cache, proc);
 		return NULL;
 	}
 
@@ -114,6 +119,12 @@ proc_create(const char *name)
 	proc->console = NULL;
 #endif // UW
 
+#if OPT_A2
+	for (int i=0; i<PROC_MAXFILES; i++) {
+		proc->p_files[i] = NULL;
+	}
+#endif
+
 	return proc;
 }
 
@@ -174,11 +185,19 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
+#if OPT_A2
+	for (int i=0; i<PROC_MAXFILES; i++) {
+		if (proc->p_files[i] != NULL) {
+			vfs_close(proc->p_files[i]);
+		}
+	}
+#endif
+
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	objcache_free(&proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
@@ -485,6 +504,31 @@ void removePInfo(int pInfoLoc) {
     array_remove(globalProcs, pInfoLoc);
 }
 
+//undoes what proc_create_runprogram set up for a child of the current proc
+//this is only run when the child never got to run (fork failed)
+void forgetChild(pid_t childPid) {
+    struct procInfo *pI;
+    int *cI;
+    lock_acquire(availPidLock);
+    //take it out of our own list of children
+    pI = array_get(globalProcs, findPInfo(curproc->pid));
+    for(int i=array_num(pI->childPids)-1; i>=0; i--) {
+        cI = array_get(pI->childPids, i);
+        if(*cI == childPid) {
+            array_remove(pI->childPids, i);
+            kfree(cI);
+            break;
+        }
+    }
+    //and its own procInfo, so the pid can be handed out again
+    int spot = findPInfo(childPid);
+    KASSERT(spot != -1);
+    pI = array_get(globalProcs, spot);
+    removePInfo(spot);
+    kfree(pI);
+    lock_release(availPidLock);
+}
+
 //checks if any children of current proc need to be removed
 //this is only run when the current proc is ending
 int checkChildren(int pInfoLoc) {
@@ -50,6 +50,16 @@
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-dumbvm.h"
+#include "opt-kmprof.h"
+#if !OPT_DUMBVM
+#include <coremap.h>
+#include <pagecache.h>
+#include <uw-vmstats.h>
+#endif
+#if OPT_KMPROF
+#include <kmprof.h>
+#endif
 
 
 /*
@@ -124,6 +134,9 @@ boot(void)
 	/* Late phase of initialization. */
 	vm_bootstrap();
 	kprintf_bootstrap();
+#if OPT_KMPROF
+	kmprof_bootstrap();
+#endif
 	thread_start_cpus();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
@@ -146,6 +159,14 @@ shutdown(void)
 {
 
 	kprintf("Shutting down.\n");
+
+#if !OPT_DUMBVM
+	vmstats_print();
+	coremap_printstats();
+	vm_tlb_printstats();
+	/* Let go of the vnodes of cached programs, so they can unmount. */
+	pagecache_purge();
+#endif
 	
 	vfs_clearbootfs();
 	vfs_clearcurdir();
@@ -45,6 +45,20 @@
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
+#include "opt-kmprof.h"
+
+#if !OPT_DUMBVM
+#include <vm.h>
+#include <coremap.h>
+#include <pagemerge.h>
+#include <vmpolicy.h>
+#include <vmtrace.h>
+#include <loadctl.h>
+#endif
+#if OPT_KMPROF
+#include <kmprof.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -403,10 +417,133 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if !OPT_DUMBVM
+	coremap_printstats();
+	vm_tlb_printstats();
+#endif
 	
 	return 0;
 }
 
+#if OPT_KMPROF
+/*
+ * Command for showing where kmalloc'd memory went, or starting the
+ * counts over.
+ */
+static
+int
+cmd_kmprof(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kmprof_print(10);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kmprof_reset();
+		return 0;
+	}
+	if (nargs == 2 && atoi(args[1]) > 0) {
+		kmprof_print(atoi(args[1]));
+		return 0;
+	}
+	kprintf("Usage: kp [nsites|reset]\n");
+	return EINVAL;
+}
+#endif
+
+#if !OPT_DUMBVM
+/*
+ * Command for showing or setting the same-page merging scan rate.
+ */
+static
+int
+cmd_merge(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("Merging scans %u pages per second\n",
+			pagemerge_getrate());
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: merge [pages-per-second]\n");
+		return EINVAL;
+	}
+
+	pagemerge_setrate(atoi(args[1]));
+	return 0;
+}
+
+/*
+ * Command for showing or choosing the page replacement policy.
+ */
+static
+int
+cmd_vmpolicy(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 1) {
+		kprintf("Replacement policy: %s\n", vmpolicy_current());
+		kprintf("Available: ");
+		vmpolicy_list();
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: vmpolicy [policy]\n");
+		return EINVAL;
+	}
+
+	result = vmpolicy_select(args[1]);
+	if (result) {
+		kprintf("vmpolicy: %s: No such policy; available: ", args[1]);
+		vmpolicy_list();
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Command for starting and stopping page reference tracing.
+ */
+static
+int
+cmd_vmtrace(int nargs, char **args)
+{
+	if (nargs == 3 && !strcmp(args[1], "start")) {
+		return vmtrace_start(args[2]);
+	}
+	if (nargs == 2 && !strcmp(args[1], "stop")) {
+		return vmtrace_stop();
+	}
+	kprintf("Usage: vmtrace start file\n");
+	kprintf("       vmtrace stop\n");
+	return EINVAL;
+}
+
+/*
+ * Command for showing load control, or turning it on or off.
+ */
+static
+int
+cmd_loadctl(int nargs, char **args)
+{
+	if (nargs == 1) {
+		loadctl_print();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		loadctl_enable(true);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		loadctl_enable(false);
+		return 0;
+	}
+	kprintf("Usage: loadctl [on|off]\n");
+	return EINVAL;
+}
+#endif
+
 
 ////////////////////////////////////////
 //
@@ -468,6 +605,11 @@ static const char *testmenu[] = {
 	"[bt]  Bitmap test                   ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+#if !OPT_DUMBVM
+	"[km3] Page allocator throughput     ",
+#endif
+	"[km4] Object cache test             ",
+	"[km5] Kernel heap arena test        ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -516,6 +658,15 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_KMPROF
+	"[kp] kmalloc profile                ",
+#endif
+#if !OPT_DUMBVM
+	"[merge] Same-page merging rate      ",
+	"[vmpolicy] Page replacement policy  ",
+	"[vmtrace] Page reference tracing    ",
+	"[loadctl] Load control              ",
+#endif
 	"[q] Quit and shut down              ",
 	"[dth] Turn on DB_THREADS debugging  ",
 	NULL
@@ -573,12 +724,26 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_KMPROF
+	{ "kp",		cmd_kmprof },
+#endif
+#if !OPT_DUMBVM
+	{ "merge",	cmd_merge },
+	{ "vmpolicy",	cmd_vmpolicy },
+	{ "vmtrace",	cmd_vmtrace },
+	{ "loadctl",	cmd_loadctl },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+#if !OPT_DUMBVM
+	{ "km3",	coremaptest },
+#endif
+	{ "km4",	objcachetest },
+	{ "km5",	arenatest },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -8,6 +8,10 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <copyinout.h>
+#include <opt-A2.h>
 
 /* handler for write() system call                  */
 /*
@@ -58,3 +62,108 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   KASSERT(*retval >= 0);
   return 0;
 }
+
+#if OPT_A2
+/*
+ * open(), read() and close(), for reading files only. There are no
+ * file objects: each process has a small table of vnodes and offsets
+ * (p_files), which fork does not copy.
+ */
+
+/* the slot of file descriptor FDESC in curproc's table, or -1 */
+static
+int
+file_slot(int fdesc)
+{
+  int i = fdesc - PROC_FIRSTFD;
+
+  if (i < 0 || i >= PROC_MAXFILES || curproc->p_files[i] == NULL) {
+    return -1;
+  }
+  return i;
+}
+
+int
+sys_open(userptr_t path, int flags, int *retval)
+{
+  struct vnode *v;
+  char *kpath;
+  int i, res;
+
+  if (flags != O_RDONLY) {
+    return EUNIMP;
+  }
+  for (i=0; i<PROC_MAXFILES; i++) {
+    if (curproc->p_files[i] == NULL) {
+      break;
+    }
+  }
+  if (i == PROC_MAXFILES) {
+    return EMFILE;
+  }
+
+  kpath = kmalloc(PATH_MAX);
+  if (kpath == NULL) {
+    return ENOMEM;
+  }
+  res = copyinstr(path, kpath, PATH_MAX, NULL);
+  if (res == 0) {
+    /* vfs_open may sleep, so the slot is only taken once it's done */
+    res = vfs_open(kpath, O_RDONLY, 0, &v);
+  }
+  kfree(kpath);
+  if (res) {
+    return res;
+  }
+
+  curproc->p_files[i] = v;
+  curproc->p_offsets[i] = 0;
+  *retval = i + PROC_FIRSTFD;
+  return 0;
+}
+
+int
+sys_read(int fdesc, userptr_t ubuf, size_t nbytes, int *retval)
+{
+  struct iovec iov;
+  struct uio u;
+  int i, res;
+
+  i = file_slot(fdesc);
+  if (i < 0) {
+    return EBADF;
+  }
+
+  iov.iov_ubase = ubuf;
+  iov.iov_len = nbytes;
+  u.uio_iov = &iov;
+  u.uio_iovcnt = 1;
+  u.uio_offset = curproc->p_offsets[i];
+  u.uio_resid = nbytes;
+  u.uio_segflg = UIO_USERSPACE;
+  u.uio_rw = UIO_READ;
+  u.uio_space = curproc->p_addrspace;
+
+  res = VOP_READ(curproc->p_files[i], &u);
+  if (res) {
+    return res;
+  }
+  curproc->p_offsets[i] = u.uio_offset;
+  *retval = nbytes - u.uio_resid;
+  return 0;
+}
+
+int
+sys_close(int fdesc)
+{
+  int i;
+
+  i = file_slot(fdesc);
+  if (i < 0) {
+    return EBADF;
+  }
+  vfs_close(curproc->p_files[i]);
+  curproc->p_files[i] = NULL;
+  return 0;
+}
+#endif
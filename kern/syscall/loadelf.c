@@ -59,7 +59,9 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include "opt-dumbvm.h"
 
+#if OPT_DUMBVM
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -144,6 +146,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	
 	return result;
 }
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -288,9 +291,19 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_DUMBVM
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#else
+		/*
+		 * Don't read anything yet; just tell the address space
+		 * where the segment lives so vm_fault can read each
+		 * page in the first time it is touched.
+		 */
+		result = as_define_file(as, v, ph.p_offset, ph.p_vaddr,
+					ph.p_filesz);
+#endif
 		if (result) {
 			return result;
 		}
@@ -17,6 +17,7 @@
 #include <test.h>
 #include <kern/fcntl.h>
 #include <limits.h>
+#include <objcache.h>
 
 extern struct array *globalProcs;
   /* this implementation of sys__exit does not do anything with the exit code */
@@ -127,6 +128,14 @@ sys_waitpid(pid_t pid,
     Create a copy of the current process
     Return 0 for the child process and the PID of the child to the parent
 */
+/* Trapframes handed from sys_fork to the child (see enter_forked_process). */
+static struct objcache trapframe_cache =
+	OBJCACHE_INITIALIZER("trapframe", sizeof(struct trapframe), NULL);
+
+void sys_fork_freetf(struct trapframe *tf) {
+    objcache_free(&trapframe_cache, tf);
+}
+
 int sys_fork(struct trapframe *tf, pid_t *retval) {
     //kprintf("now running sys_fork \n");
     //create process structure for child
@@ -138,14 +147,23 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
     } else if(newProc == (struct proc *)ENPROC) {
         return (ENPROC);
     }
-    as_copy(curproc->p_addrspace, &newProc->p_addrspace);//TODO verify usage
+    int result;
+    result = as_copy(curproc->p_addrspace, &newProc->p_addrspace);
+    if(result) {
+        //no memory left to share the parent's pages with the child
+        #if OPT_A2
+        forgetChild(newProc->pid);
+        #endif
+        proc_destroy(newProc);
+        return (result);
+    }
     
     //attach newly created as to child structure
     //newProc->p_addrspace = newAs;
     
     //create thread for child
     struct trapframe *newTf;
-    newTf = kmalloc(sizeof(struct trapframe));
+    newTf = objcache_alloc(&trapframe_cache);
     //almost forgot to actually copy the tf!!
     //memcpy(newTf, tf, sizeof(struct trapframe));//deep memory copy of the exact trap frame!
     *newTf = *tf;
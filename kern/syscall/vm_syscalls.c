@@ -0,0 +1,190 @@
+/*
+ * Memory system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <limits.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <addrspace.h>
+#include <pagecache.h>
+#include <shm.h>
+#include <uw-vmstats.h>
+#include <syscall.h>
+
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_sbrk(as, amount, retval);
+}
+
+/*
+ * There is no file table, so the file is named by PATH rather than by
+ * a file descriptor.
+ */
+int
+sys_mmap(userptr_t path, size_t len, int prot, int flags, off_t offset,
+	 vaddr_t *retval)
+{
+	struct addrspace *as;
+	struct vnode *v;
+	struct pagecache *pc;
+	char *kpath;
+	bool shared;
+	int result;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+		return EINVAL;
+	}
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	shared = flags == MAP_SHARED;
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(path, kpath, PATH_MAX, NULL);
+	if (result) {
+		kfree(kpath);
+		return result;
+	}
+
+	/* Only shared writable mappings ever write to the file. */
+	result = vfs_open(kpath, (shared && (prot & PROT_WRITE)) ?
+			  O_RDWR : O_RDONLY, 0, &v);
+	kfree(kpath);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_MMAP(v);
+	if (result == 0) {
+		result = pagecache_open(v, &pc);
+	}
+	/* The page cache has its own reference. */
+	vfs_close(v);
+	if (result) {
+		return result;
+	}
+
+	result = as_map(as, pc, offset, len, prot, shared, retval);
+	if (result) {
+		pagecache_decref(pc);
+	}
+	return result;
+}
+
+int
+sys_munmap(vaddr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return as_unmap(as, addr, len);
+}
+
+int
+sys_msync(vaddr_t addr, size_t len, int flags)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	if ((flags & MS_SYNC) && (flags & MS_ASYNC)) {
+		return EINVAL;
+	}
+	/*
+	 * Writes are always done before returning. All mappings share
+	 * the page cache, so there's nothing to invalidate.
+	 */
+	return as_sync(as, addr, len);
+}
+
+int
+sys_shm_create(int key, size_t len)
+{
+	return shm_create(key, len);
+}
+
+int
+sys_shm_attach(int key, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return shm_attach(as, key, retval);
+}
+
+int
+sys_shm_detach(vaddr_t addr)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return shm_detach(as, addr);
+}
+
+int
+sys_shm_remove(int key)
+{
+	return shm_remove(key);
+}
+
+/*
+ * Copy out as many as NCOUNTS of the VM counters, as they stand since
+ * the last reset, and return how many counters there are.
+ */
+int
+sys___vmstats(userptr_t counts, size_t ncounts, int flags, int *retval)
+{
+	unsigned snapshot[VMSTAT_COUNT];
+	int result;
+
+	if (flags & ~VMSTATS_RESET) {
+		return EINVAL;
+	}
+	if (ncounts > VMSTAT_COUNT) {
+		ncounts = VMSTAT_COUNT;
+	}
+
+	vmstats_snapshot(snapshot, (flags & VMSTATS_RESET) != 0);
+	if (ncounts > 0) {
+		result = copyout(snapshot, counts, ncounts * sizeof(unsigned));
+		if (result) {
+			return result;
+		}
+	}
+
+	*retval = VMSTAT_COUNT;
+	return 0;
+}
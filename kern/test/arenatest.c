@@ -0,0 +1,150 @@
+/*
+ * Test for the kmalloc arena.
+ *
+ * Has NTHREADS threads kmalloc and kfree buffers of sizes between
+ * LARGEST_SUBPAGE_SIZE and ARENA_MAXSIZE, filling each with a pattern
+ * of its own. Checks that buffers are aligned and not page aligned,
+ * and that no buffer's pattern is disturbed while it is in use, so
+ * splitting and coalescing never hand out overlapping blocks.
+ */
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <vm.h>
+#include <arena.h>
+#include <test.h>
+
+#define NTHREADS  4
+#define NROUNDS   30
+#define NBUFS     4		/* live at once, per thread */
+
+#define MINSIZE   2048
+
+static
+uint32_t
+arenatest_pattern(unsigned long num, unsigned i, unsigned word)
+{
+	return (num << 24) ^ (i << 16) ^ word ^ 0xa5a5a5a5;
+}
+
+static
+bool
+arenatest_check(unsigned long num, unsigned i, uint32_t *buf, size_t size)
+{
+	unsigned j;
+
+	for (j=0; j<size/sizeof(uint32_t); j++) {
+		if (buf[j] != arenatest_pattern(num, i, j)) {
+			kprintf("thread %lu: %p (%lu bytes) overwritten at "
+				"word %u\n", num, buf, (unsigned long)size, j);
+			return false;
+		}
+	}
+	return true;
+}
+
+static
+void
+arenathread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	uint32_t *bufs[NBUFS];
+	size_t sizes[NBUFS];
+	unsigned i, j, round;
+	uint32_t seed;
+	bool ok;
+
+	for (i=0; i<NBUFS; i++) {
+		bufs[i] = NULL;
+		sizes[i] = 0;
+	}
+
+	seed = num * 2654435761U + 1;
+	ok = true;
+	for (round=0; round<NROUNDS && ok; round++) {
+		for (i=0; i<NBUFS; i++) {
+			/* Replace about half the buffers each round. */
+			seed = seed * 1103515245 + 12345;
+			if (bufs[i] != NULL && (seed >> 16) % 2 == 0) {
+				continue;
+			}
+			if (bufs[i] != NULL) {
+				if (!arenatest_check(num, i, bufs[i],
+						     sizes[i])) {
+					ok = false;
+				}
+				kfree(bufs[i]);
+			}
+
+			seed = seed * 1103515245 + 12345;
+			sizes[i] = MINSIZE +
+				(seed >> 8) % (ARENA_MAXSIZE - MINSIZE + 1);
+			bufs[i] = kmalloc(sizes[i]);
+			if (bufs[i] == NULL) {
+				kprintf("thread %lu: kmalloc(%lu) failed\n",
+					num, (unsigned long)sizes[i]);
+				ok = false;
+				break;
+			}
+			if ((vaddr_t)bufs[i] % 8 != 0 ||
+			    (vaddr_t)bufs[i] % PAGE_SIZE == 0) {
+				kprintf("thread %lu: %p is misaligned\n",
+					num, bufs[i]);
+				ok = false;
+			}
+			for (j=0; j<sizes[i]/sizeof(uint32_t); j++) {
+				bufs[i][j] = arenatest_pattern(num, i, j);
+			}
+		}
+		thread_yield();
+	}
+
+	for (i=0; i<NBUFS; i++) {
+		if (bufs[i] != NULL) {
+			if (!arenatest_check(num, i, bufs[i], sizes[i])) {
+				ok = false;
+			}
+			kfree(bufs[i]);
+		}
+	}
+
+	if (!ok) {
+		kprintf("thread %lu: FAILED\n", num);
+	}
+	V(sem);
+}
+
+int
+arenatest(int nargs, char **args)
+{
+	struct semaphore *sem;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	sem = sem_create("arenatest", 0);
+	if (sem == NULL) {
+		panic("arenatest: sem_create failed\n");
+	}
+
+	kprintf("Starting arena test...\n");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("arenatest", NULL,
+				     arenathread, sem, i);
+		if (result) {
+			panic("arenatest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(sem);
+	}
+	sem_destroy(sem);
+
+	arena_printstats();
+	kprintf("Arena test done\n");
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Throughput test for the physical page allocator.
+ *
+ * Fills memory with kernel pages a bit at a time, and at each level
+ * times a batch of alloc_kpages/free_kpages calls of a few sizes. With
+ * a good allocator the cost per call should not grow as memory fills.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h>
+#include <coremap.h>
+#include <test.h>
+
+#define NCALLS    1000		/* alloc/free pairs timed per level */
+
+static const unsigned fill_levels[] = { 0, 25, 50, 75, 90 };	/* percent */
+static const unsigned run_sizes[] = { 1, 3, 8 };		/* pages */
+
+#define NLEVELS (sizeof(fill_levels) / sizeof(fill_levels[0]))
+#define NSIZES  (sizeof(run_sizes) / sizeof(run_sizes[0]))
+
+/*
+ * Time NCALLS allocations and frees of NPAGES pages. Returns the
+ * number of allocations that failed, and the elapsed time in USECS.
+ */
+static
+unsigned
+time_allocs(unsigned npages, unsigned *usecs)
+{
+	time_t s0, s1, ds;
+	uint32_t ns0, ns1, dns;
+	vaddr_t addr;
+	unsigned i, failures;
+
+	failures = 0;
+	gettime(&s0, &ns0);
+	for (i=0; i<NCALLS; i++) {
+		addr = alloc_kpages(npages);
+		if (addr == 0) {
+			failures++;
+			continue;
+		}
+		free_kpages(addr);
+	}
+	gettime(&s1, &ns1);
+
+	getinterval(s0, ns0, s1, ns1, &ds, &dns);
+	*usecs = ds * 1000000 + dns / 1000;
+	return failures;
+}
+
+int
+coremaptest(int nargs, char **args)
+{
+	vaddr_t *ballast;
+	unsigned nballast, total, level, i, j, usecs, failures;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting page allocator throughput test...\n");
+
+	total = coremap_totalpages();
+	ballast = kmalloc(total * sizeof(vaddr_t));
+	if (ballast == NULL) {
+		kprintf("coremaptest: Out of memory\n");
+		return 0;
+	}
+	nballast = 0;
+
+	for (i=0; i<NLEVELS; i++) {
+		level = total / 100 * fill_levels[i];
+		while (coremap_usedpages() < level) {
+			ballast[nballast] = alloc_kpages(1);
+			if (ballast[nballast] == 0) {
+				break;
+			}
+			nballast++;
+		}
+		kprintf("%u%% full (%u of %u pages in use):\n",
+			fill_levels[i], coremap_usedpages(), total);
+
+		for (j=0; j<NSIZES; j++) {
+			failures = time_allocs(run_sizes[j], &usecs);
+			kprintf("  %u-page blocks: %u calls in %u usec",
+				run_sizes[j], NCALLS, usecs);
+			if (failures > 0) {
+				kprintf(" (%u failed)", failures);
+			}
+			kprintf("\n");
+		}
+	}
+
+	for (i=0; i<nballast; i++) {
+		free_kpages(ballast[i]);
+	}
+	kfree(ballast);
+
+	kprintf("page allocator throughput test done\n");
+	return 0;
+}
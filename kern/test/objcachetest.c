@@ -0,0 +1,147 @@
+/*
+ * Test for object caches.
+ *
+ * Makes a cache of odd-sized objects with a constructor, and has
+ * NTHREADS threads allocate and free them in batches. Checks that
+ * objects are aligned, that no two live objects overlap, and that what
+ * the constructor set up survives being freed and allocated again.
+ */
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <objcache.h>
+#include <test.h>
+
+#define NTHREADS  6
+#define NROUNDS   40
+#define NOBJS     60		/* live at once, per thread */
+
+#define OBJMAGIC  0x0bcac4e5
+
+struct testobj {
+	uint32_t to_magic;		/* set by the constructor only */
+	unsigned to_owner;		/* thread using it */
+	unsigned to_index;		/* where it is in that thread's array */
+	char to_pad[136];		/* 148 bytes in all */
+};
+
+static struct objcache *testcache;
+static volatile unsigned testctors;
+static struct spinlock testlock = SPINLOCK_INITIALIZER;
+
+static
+void
+testobj_ctor(void *ptr)
+{
+	struct testobj *obj = ptr;
+
+	obj->to_magic = OBJMAGIC;
+	spinlock_acquire(&testlock);
+	testctors++;
+	spinlock_release(&testlock);
+}
+
+static
+void
+objcachethread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	struct testobj *objs[NOBJS];
+	unsigned i, j, round;
+	bool ok;
+
+	ok = true;
+	for (round=0; round<NROUNDS && ok; round++) {
+		for (i=0; i<NOBJS; i++) {
+			objs[i] = objcache_alloc(testcache);
+			if (objs[i] == NULL) {
+				kprintf("thread %lu: objcache_alloc failed\n",
+					num);
+				ok = false;
+				break;
+			}
+			if ((vaddr_t)objs[i] % OBJCACHE_ALIGN != 0) {
+				kprintf("thread %lu: %p is misaligned\n",
+					num, objs[i]);
+				ok = false;
+			}
+			if (objs[i]->to_magic != OBJMAGIC) {
+				kprintf("thread %lu: %p lost its constructed "
+					"state\n", num, objs[i]);
+				ok = false;
+			}
+			objs[i]->to_owner = num;
+			objs[i]->to_index = i;
+		}
+
+		/* Free every other one, then check the rest are intact. */
+		for (j=0; j<i; j+=2) {
+			objcache_free(testcache, objs[j]);
+			objs[j] = NULL;
+		}
+		for (j=1; j<i; j+=2) {
+			if (objs[j]->to_owner != num ||
+			    objs[j]->to_index != j) {
+				kprintf("thread %lu: %p was overwritten\n",
+					num, objs[j]);
+				ok = false;
+			}
+		}
+		for (j=1; j<i; j+=2) {
+			objcache_free(testcache, objs[j]);
+		}
+		thread_yield();
+	}
+
+	if (!ok) {
+		kprintf("thread %lu: FAILED\n", num);
+	}
+	V(sem);
+}
+
+int
+objcachetest(int nargs, char **args)
+{
+	struct semaphore *sem;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	sem = sem_create("objcachetest", 0);
+	if (sem == NULL) {
+		panic("objcachetest: sem_create failed\n");
+	}
+	testcache = objcache_create("objcachetest", sizeof(struct testobj),
+				    testobj_ctor);
+	if (testcache == NULL) {
+		panic("objcachetest: objcache_create failed\n");
+	}
+	testctors = 0;
+
+	kprintf("Starting object cache test...\n");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("objcachetest", NULL,
+				     objcachethread, sem, i);
+		if (result) {
+			panic("objcachetest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(sem);
+	}
+
+	kprintf("%u objects constructed for %u live at most\n",
+		testctors, NTHREADS * NOBJS);
+
+	/* Panics if any object was not given back. */
+	objcache_destroy(testcache);
+	testcache = NULL;
+	sem_destroy(sem);
+
+	kprintf("Object cache test done\n");
+	return 0;
+}
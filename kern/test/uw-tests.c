@@ -208,19 +208,23 @@ vmstats_thread(void *junk, unsigned long num)
             break;
 
           case VMSTAT_TLB_RELOAD:
-            vmstats_inc(j);
+            if (i % 2 == 0) {
+               vmstats_inc(j);
+            }
             break;
 
-          /* VMSTAT_TLB_FAULT = VMSTAT_TLB_RELOAD + VMSTAT_PAGE_FAULT_DISK + VMSTAT_SWAP_FILE_ZERO */
+          /* VMSTAT_TLB_FAULT = VMSTAT_TLB_RELOAD + VMSTAT_PAGE_FAULT_DISK + VMSTAT_SWAP_FILE_ZERO
+           *                    + VMSTAT_PAGECACHE_HIT + VMSTAT_ZSWAP_LOAD */
           case VMSTAT_PAGE_FAULT_ZERO:
             if (i % 2 == 0) {
                vmstats_inc(j);
             }
             break;
 
-          /* VMSTAT_PAGE_FAULT_DISK = VMSTAT_ELF_FILE_READ + VMSTAT_SWAP_FILE_READ */
+          /* VMSTAT_PAGE_FAULT_DISK = VMSTAT_ELF_FILE_READ + VMSTAT_SWAP_FILE_READ
+           *                          + VMSTAT_PAGECACHE_MISS */
           case VMSTAT_PAGE_FAULT_DISK:
-            if (i % 2 == 0) {
+            if (i % 4 != 3) {
                vmstats_inc(j);
             }
             break;
@@ -243,6 +247,168 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
+          /* VMSTAT_COW_SHARED >= VMSTAT_COW_COPY */
+          case VMSTAT_COW_FAULT:
+          case VMSTAT_COW_SHARED:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_COW_COPY:
+            if (i % 2 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          /* VMSTAT_PAGE_EVICT >= VMSTAT_SWAP_FILE_WRITE */
+          case VMSTAT_PAGE_EVICT:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_PAGE_EVICT_USEC:
+            if (i % 4 == 0) {
+               vmstats_add(j, 100);
+            }
+            break;
+
+          /* VMSTAT_ZERO_POOL_HIT + VMSTAT_ZERO_POOL_MISS = VMSTAT_PAGE_FAULT_ZERO */
+          case VMSTAT_ZERO_POOL_HIT:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_ZERO_POOL_MISS:
+            if (i % 4 == 2) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_FAULT_AROUND:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_PAGECACHE_HIT:
+            if (i % 8 == 1) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_PAGECACHE_MISS:
+            if (i % 4 == 2) {
+               vmstats_inc(j);
+            }
+            break;
+
+          /* VMSTAT_FAULT_TEXT + DATA + HEAP + STACK + MMAP = VMSTAT_TLB_FAULT */
+          case VMSTAT_FAULT_TEXT:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_FAULT_DATA:
+            if (i % 4 == 1) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_FAULT_HEAP:
+          case VMSTAT_FAULT_MMAP:
+            if (i % 2 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_FAULT_STACK:
+            if (i % 2 == 1) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_TLB_SHOOTDOWN:
+          case VMSTAT_FRAME_CACHE_HIT:
+          case VMSTAT_FRAME_CACHE_MISS:
+          case VMSTAT_PAGEOUT_RUN:
+            vmstats_inc(j);
+            break;
+
+          /* VMSTAT_PAGE_EVICT >= VMSTAT_PAGEOUT_EVICT + VMSTAT_LOADCTL_SWAPOUT */
+          case VMSTAT_PAGEOUT_EVICT:
+            if (i % 8 == 4) {
+               vmstats_inc(j);
+            }
+            break;
+
+          /* VMSTAT_SWAP_FILE_WRITE >= VMSTAT_SWAP_CLUSTER_WRITE */
+          case VMSTAT_SWAP_CLUSTER_WRITE:
+            if (i % 16 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_ZSWAP_LOAD:
+            if (i % 8 == 5) {
+               vmstats_inc(j);
+            }
+            break;
+
+          /* VMSTAT_SWAP_FILE_WRITE = VMSTAT_ZSWAP_REJECT + VMSTAT_ZSWAP_SPILL */
+          case VMSTAT_ZSWAP_REJECT:
+            if (i % 16 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_ZSWAP_SPILL:
+            if (i % 16 == 8) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_ZSWAP_STORE:
+          case VMSTAT_ZSWAP_BYTES:
+          case VMSTAT_ZSWAP_USEC:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_MERGE_SCAN:
+            vmstats_inc(j);
+            break;
+
+          /* VMSTAT_MERGE_SCAN >= VMSTAT_MERGE_SHARE */
+          case VMSTAT_MERGE_SHARE:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_MERGE_UNSHARE:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_LOADCTL_DEACTIVATE:
+            if (i % 4 == 1) {
+               vmstats_inc(j);
+            }
+            break;
+
+          /* VMSTAT_LOADCTL_DEACTIVATE >= VMSTAT_LOADCTL_REACTIVATE */
+          case VMSTAT_LOADCTL_REACTIVATE:
+            if (i % 8 == 1) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_LOADCTL_SWAPOUT:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
           default:
             kprintf("Unknown stat %d\n", j);
             break;
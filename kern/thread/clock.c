@@ -48,9 +48,8 @@
 
 /*
  * Timing constants. These should be tuned along with any work done on
- * the scheduler.
+ * the scheduler. SCHEDULE_HARDCLOCKS is in clock.h.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
@@ -99,7 +98,7 @@ hardclock(void)
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	thread_timeslice();
 }
 
 /*
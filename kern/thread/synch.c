@@ -38,12 +38,16 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <objcache.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+static struct objcache sem_cache =
+	OBJCACHE_INITIALIZER("semaphore", sizeof(struct semaphore), NULL);
+
 struct semaphore *
 sem_create(const char *name, int initial_count)
 {
@@ -51,21 +55,21 @@ sem_create(const char *name, int initial_count)
 
         KASSERT(initial_count >= 0);
 
-        sem = kmalloc(sizeof(struct semaphore));
+        sem = objcache_alloc(&sem_cache);
         if (sem == NULL) {
                 return NULL;
         }
 
         sem->sem_name = kstrdup(name);
         if (sem->sem_name == NULL) {
-                kfree(sem);
+                objcache_free(&sem_cache, sem);
                 return NULL;
         }
 
 	sem->sem_wchan = wchan_create(sem->sem_name);
 	if (sem->sem_wchan == NULL) {
 		kfree(sem->sem_name);
-		kfree(sem);
+		objcache_free(&sem_cache, sem);
 		return NULL;
 	}
 
@@ -84,7 +88,7 @@ sem_destroy(struct semaphore *sem)
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
         kfree(sem->sem_name);
-        kfree(sem);
+        objcache_free(&sem_cache, sem);
 }
 
 void 
@@ -147,19 +151,22 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+static struct objcache lock_cache =
+	OBJCACHE_INITIALIZER("lock", sizeof(struct lock), NULL);
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
 
-        lock = kmalloc(sizeof(struct lock));
+        lock = objcache_alloc(&lock_cache);
         if (lock == NULL) {
                 return NULL;
         }
 
         lock->lk_name = kstrdup(name);
         if (lock->lk_name == NULL) {
-                kfree(lock);
+                objcache_free(&lock_cache, lock);
                 return NULL;
         }
         
@@ -168,12 +175,13 @@ lock_create(const char *name)
     lock->lock_wchan = wchan_create(lock->lk_name);
 	if (lock->lock_wchan == NULL) {//the creation process did not go well
 		kfree(lock->lk_name);//clear space allocated fro the name
-		kfree(lock);//clear the actual lock from memory
+		objcache_free(&lock_cache, lock);//clear the actual lock from memory
 		return NULL;
 	}
 	
 	//now we need a spinlock to use when attempting to acquire things
 	spinlock_init(&lock->lock_splock);//initializes a spinlock
+	lock->lock_thread = NULL;
 	
 	//completed everything we need, so return our new lock
     return lock;
@@ -191,7 +199,7 @@ lock_destroy(struct lock *lock)
         spinlock_cleanup(&lock->lock_splock);//clear up the associated spinlock
         wchan_destroy(lock->lock_wchan);//wchan must be empty
         lock->lock_thread=NULL;//make it point to nothing
-        kfree(lock);
+        objcache_free(&lock_cache, lock);
 }
 
 void
@@ -242,20 +250,22 @@ lock_do_i_hold(struct lock *lock)
 //
 // CV
 
+static struct objcache cv_cache =
+	OBJCACHE_INITIALIZER("cv", sizeof(struct cv), NULL);
 
 struct cv *
 cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = objcache_alloc(&cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
         cv->cv_name = kstrdup(name);
         if (cv->cv_name==NULL) {
-                kfree(cv);
+                objcache_free(&cv_cache, cv);
                 return NULL;
         }
         
@@ -263,7 +273,7 @@ cv_create(const char *name)
     cv->cv_wchan=wchan_create(cv->cv_name);
 	if (cv->cv_wchan == NULL) {//the creation process did not go well
 		kfree(cv->cv_name);//clear space allocated fro the name
-		kfree(cv);//clear the actual lock from memory
+		objcache_free(&cv_cache, cv);//clear the actual lock from memory
 		return NULL;
 	}
 	
@@ -282,7 +292,7 @@ cv_destroy(struct cv *cv)
     wchan_destroy(cv->cv_wchan);//wchan must be empty(wchan checks for us)
         
         kfree(cv->cv_name);
-        kfree(cv);
+        objcache_free(&cv_cache, cv);
 }
 
 void
@@ -37,6 +37,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <array.h>
+#include <clock.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -50,6 +51,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <objcache.h>
 
 #include "opt-synchprobs.h"
 
@@ -57,6 +59,14 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduling constants; see schedule(). These should be tuned along
+ * with HZ and SCHEDULE_HARDCLOCKS in clock.h.
+ */
+#define SCHED_NLEVELS	4		/* priority levels */
+#define SCHED_QUANTUM(level)	(1U << (level))	/* hardclocks per slice */
+#define SCHED_AGE_HARDCLOCKS	HZ	/* wait before moving up a level */
+
 /* Wait channel. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -72,6 +82,12 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Where threads and wait channels come from. */
+static struct objcache thread_cache =
+	OBJCACHE_INITIALIZER("thread", sizeof(struct thread), NULL);
+static struct objcache wchan_cache =
+	OBJCACHE_INITIALIZER("wchan", sizeof(struct wchan), NULL);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -123,14 +139,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = objcache_alloc(&thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		objcache_free(&thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -143,6 +159,9 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_waited = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -187,6 +206,8 @@ cpu_create(unsigned hardware_number)
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_seq = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -259,7 +280,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	objcache_free(&thread_cache, thread);
 }
 
 /*
@@ -426,6 +447,30 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put a thread on a run queue, behind every thread of the same or
+ * higher priority. Run queues are short, and the threads of lowest
+ * priority are at the end, so search from there.
+ */
+static
+void
+thread_enqueue(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (tln = c->c_runqueue.tl_tail.tln_prev;
+	     tln != &c->c_runqueue.tl_head; tln = tln->tln_prev) {
+		if (tln->tln_self->t_priority <= t->t_priority) {
+			threadlist_insertafter(&c->c_runqueue,
+					       tln->tln_self, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
 /*
  * Make a thread runnable.
  *
@@ -450,7 +495,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_enqueue(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -573,7 +618,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
+	/*
+	 * Micro-optimization: if nothing to do, just return. A thread
+	 * that yields lets anything waiting run, whatever its priority;
+	 * thread_timeslice only yields to those it should.
+	 */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
@@ -588,6 +637,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		/* Threads that block are interactive; move up a level. */
+		if (cur->t_priority > 0) {
+			cur->t_priority--;
+			cur->t_ticks = 0;
+		}
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -640,6 +694,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	next->t_waited = 0;
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -810,29 +865,137 @@ thread_exit(void)
 
 /*
  * Yield the cpu to another process, but stay runnable.
+ *
+ * The run queue is in order of level, so a thread that yields drops
+ * to the lowest one; otherwise it would go back ahead of any thread
+ * of lower priority and be picked again. It moves back up when it
+ * next blocks, or by aging.
  */
 void
 thread_yield(void)
 {
+	int spl;
+
+	spl = splhigh();
+	curthread->t_priority = SCHED_NLEVELS - 1;
+	curthread->t_ticks = 0;
+	splx(spl);
+
 	thread_switch(S_READY, NULL);
 }
 
+bool
+thread_others_runnable(void)
+{
+	bool ret;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	ret = !threadlist_isempty(&curcpu->c_runqueue);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return ret;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Each CPU's run queue is a multi-level feedback queue: threads have
+ * a priority level from 0 (highest) to SCHED_NLEVELS-1, and the run
+ * queue is kept in order of level, round-robin within each level, so
+ * the thread picked to run is always one of the highest level ready.
+ *
+ * New threads start at level 0. A thread at level L gets a time
+ * slice of SCHED_QUANTUM(L) hardclocks; if it uses that up it drops
+ * a level, so CPU hogs sink and get longer, rarer slices. A thread
+ * that blocks moves up a level, so interactive threads, which mostly
+ * wait for input, stay near the top and run as soon as they wake.
+ * A thread that becomes ready at a higher level than the one running
+ * takes the CPU at the next hardclock. A thread that yields drops to
+ * the lowest level, behind everything else ready.
+ *
+ * To keep hogs from starving, a thread that has been ready for
+ * SCHED_AGE_HARDCLOCKS without getting to run moves up a level.
  */
 
 void
-schedule(void)
+thread_timeslice(void)
 {
+	struct thread *cur, *first;
+	bool yield;
+
+	cur = curthread;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (curcpu->c_isidle) {
+		/* Nobody is using the CPU. */
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return;
+	}
+
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+	}
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Yield if a thread of higher priority is waiting, or at the
+	 * end of the slice if one of the same priority is. If only
+	 * lower-priority threads are waiting, keep running.
 	 */
+	yield = false;
+	if (!threadlist_isempty(&curcpu->c_runqueue)) {
+		first = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+		yield = first->t_priority < cur->t_priority ||
+			(first->t_priority == cur->t_priority &&
+			 cur->t_ticks == 0);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (yield) {
+		/* (not thread_yield, which would give up our level) */
+		thread_switch(S_READY, NULL);
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). It ages the threads
+ * on the current CPU's run queue, moving up those that have waited
+ * too long, and puts them back in order.
+ */
+void
+schedule(void)
+{
+	struct threadlist aged;
+	struct threadlistnode *tln, *next;
+	struct thread *t;
+
+	threadlist_init(&aged);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (tln = curcpu->c_runqueue.tl_head.tln_next;
+	     tln != &curcpu->c_runqueue.tl_tail; tln = next) {
+		next = tln->tln_next;
+		t = tln->tln_self;
+
+		t->t_waited += SCHEDULE_HARDCLOCKS;
+		if (t->t_waited >= SCHED_AGE_HARDCLOCKS && t->t_priority > 0) {
+			t->t_priority--;
+			t->t_ticks = 0;
+			t->t_waited = 0;
+			threadlist_remove(&curcpu->c_runqueue, t);
+			threadlist_addtail(&aged, t);
+		}
+	}
+	while ((t = threadlist_remhead(&aged)) != NULL) {
+		thread_enqueue(curcpu->c_self, t);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	threadlist_cleanup(&aged);
 }
 
 /*
@@ -924,7 +1087,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			thread_enqueue(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1111,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			thread_enqueue(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -976,7 +1139,7 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = objcache_alloc(&wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
@@ -995,7 +1158,7 @@ wchan_destroy(struct wchan *wc)
 {
 	spinlock_cleanup(&wc->wc_lock);
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	objcache_free(&wchan_cache, wc);
 }
 
 /*
@@ -1140,26 +1303,44 @@ ipi_broadcast(int code)
 	}
 }
 
-void
+unsigned
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
+	unsigned ticket;
 	int n;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
+	if (n == TLBSHOOTDOWN_ALL) {
+		/* Already flushing everything. */
+	}
+	else if (n == TLBSHOOTDOWN_MAX) {
 		target->c_numshootdown = TLBSHOOTDOWN_ALL;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
+	ticket = ++target->c_shootdown_seq;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+
+	return ticket;
+}
+
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket)
+{
+	KASSERT(curthread->t_iplhigh_count == 0);
+
+	/* Compare by difference, in case the counters wrap. */
+	while ((int)(target->c_shootdown_done - ticket) < 0) {
+		/* spin */
+	}
 }
 
 void
@@ -1202,6 +1383,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_seq;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -0,0 +1,668 @@
+/*
+ * Address spaces for the demand-paged VM system.
+ *
+ * An address space is a list of regions plus a page table. Defining
+ * a region allocates no memory at all; frames are only allocated by
+ * vm_fault, one page at a time, when the page is first touched.
+ *
+ * Two regions change size. The heap starts out empty just above the
+ * executable's last segment and is moved with sbrk. The stack starts
+ * at VM_STACKPAGES pages and grows down when it faults below its
+ * bottom, as far as VM_STACKLIMIT.
+ *
+ * Files mapped with mmap go in the space in between, as high up as
+ * they fit, so the heap has as much room as possible to grow into.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/vmtrace.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <pagecache.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <vmtrace.h>
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as;
+
+	as = kmalloc(sizeof(struct addrspace));
+	if (as == NULL) {
+		return NULL;
+	}
+
+	as->as_regions = NULL;
+	as->as_stack = NULL;
+	as->as_heap = NULL;
+	as->as_heapend = 0;
+	as->as_falast = 0;
+	as->as_fawindow = 0;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	loadctl_register(as);
+
+	return as;
+}
+
+static
+struct region *
+region_create(vaddr_t vbase, size_t npages,
+	      bool readable, bool writeable, bool executable)
+{
+	struct region *rg;
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return NULL;
+	}
+	rg->rg_vbase = vbase;
+	rg->rg_npages = npages;
+	rg->rg_readable = readable;
+	rg->rg_writeable = writeable;
+	rg->rg_executable = executable;
+	rg->rg_vnode = NULL;
+	rg->rg_offset = 0;
+	rg->rg_fvaddr = 0;
+	rg->rg_filesize = 0;
+	rg->rg_cache = NULL;
+	rg->rg_cacheoffset = 0;
+	rg->rg_shared = false;
+	rg->rg_next = NULL;
+	return rg;
+}
+
+static
+void
+region_destroy(struct region *rg)
+{
+	if (rg->rg_vnode != NULL) {
+		VOP_DECREF(rg->rg_vnode);
+	}
+	if (rg->rg_cache != NULL) {
+		pagecache_decref(rg->rg_cache);
+	}
+	kfree(rg);
+}
+
+/*
+ * Write back the written pages in [START, END) of RG, a shared file
+ * mapping, and make them read-only again so that the next write to
+ * one is seen.
+ */
+static
+int
+as_sync_region(struct addrspace *as, struct region *rg,
+	       vaddr_t start, vaddr_t end)
+{
+	pte_t *pte;
+	paddr_t pa;
+	vaddr_t va;
+	int result;
+
+	KASSERT(rg->rg_cache != NULL && rg->rg_shared);
+
+	if (pagecache_isanon(rg->rg_cache)) {
+		/* Shared memory; there's no file to write to. */
+		return 0;
+	}
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			/* No second-level table; skip to the next one. */
+			va |= PT_NENTRIES * PAGE_SIZE - PAGE_SIZE;
+			continue;
+		}
+
+		/*
+		 * Page cache frames are never evicted, so only we change
+		 * this entry, and our reference keeps the frame around
+		 * while it's written.
+		 */
+		coremap_lock_acquire();
+		if ((*pte & (PTE_VALID | PTE_DIRTY)) != (PTE_VALID | PTE_DIRTY)) {
+			coremap_lock_release();
+			continue;
+		}
+		KASSERT(*pte & PTE_SHARED);
+		*pte &= ~(PTE_WRITE | PTE_DIRTY);
+		pa = *pte & PTE_FRAME;
+		coremap_lock_release();
+
+		vm_tlb_shootdown_page(as, va);
+
+		result = pagecache_writeback(rg->rg_cache,
+					     rg->rg_cacheoffset + (va - rg->rg_vbase),
+					     pa);
+		if (result) {
+			coremap_lock_acquire();
+			*pte |= PTE_DIRTY;
+			coremap_lock_release();
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Add RG to the end of AS's region list.
+ */
+static
+void
+as_add_region(struct addrspace *as, struct region *rg)
+{
+	struct region **rgp;
+
+	for (rgp = &as->as_regions; *rgp != NULL; rgp = &(*rgp)->rg_next) {
+		/* nothing */
+	}
+	*rgp = rg;
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	struct region *rg;
+	int result;
+
+	/* Shared file mappings keep what was written to them. */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_cache == NULL || !rg->rg_shared) {
+			continue;
+		}
+		result = as_sync_region(as, rg, rg->rg_vbase,
+					rg->rg_vbase + rg->rg_npages * PAGE_SIZE);
+		if (result) {
+			kprintf("vm: writing back mapped file: %s\n",
+				strerror(result));
+		}
+	}
+
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		region_destroy(rg);
+	}
+	loadctl_unregister(as);
+	/*
+	 * Don't let a new address space at the same address inherit
+	 * TLBs, or the UTLB handler walk the page table once it's freed.
+	 */
+	vm_tlb_forget(as);
+	pt_destroy(as->as_pt);
+	vmtrace_record(as, 0, VMTRACE_EXIT);
+	kfree(as);
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	struct region *oldrg, *newrg;
+	int result;
+
+	new = as_create();
+	if (new==NULL) {
+		return ENOMEM;
+	}
+
+	for (oldrg = old->as_regions; oldrg != NULL; oldrg = oldrg->rg_next) {
+		newrg = region_create(oldrg->rg_vbase, oldrg->rg_npages,
+				      oldrg->rg_readable, oldrg->rg_writeable,
+				      oldrg->rg_executable);
+		if (newrg == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		if (oldrg->rg_vnode != NULL) {
+			VOP_INCREF(oldrg->rg_vnode);
+			newrg->rg_vnode = oldrg->rg_vnode;
+			newrg->rg_offset = oldrg->rg_offset;
+			newrg->rg_fvaddr = oldrg->rg_fvaddr;
+			newrg->rg_filesize = oldrg->rg_filesize;
+		}
+		if (oldrg->rg_cache != NULL) {
+			pagecache_incref(oldrg->rg_cache);
+			newrg->rg_cache = oldrg->rg_cache;
+			newrg->rg_cacheoffset = oldrg->rg_cacheoffset;
+			newrg->rg_shared = oldrg->rg_shared;
+		}
+		as_add_region(new, newrg);
+		if (oldrg == old->as_stack) {
+			new->as_stack = newrg;
+		}
+		if (oldrg == old->as_heap) {
+			new->as_heap = newrg;
+		}
+	}
+	new->as_heapend = old->as_heapend;
+
+	/*
+	 * Share the resident pages copy-on-write. pt_copy takes write
+	 * permission away from OLD's pages, so get rid of any TLB
+	 * entries that still grant it.
+	 */
+	result = pt_copy(old->as_pt, new->as_pt);
+	vm_tlb_forget(old);
+	if (old == curproc_getas()) {
+		as_activate();
+	}
+	if (result) {
+		as_destroy(new);
+		return result;
+	}
+
+	*ret = new;
+	return 0;
+}
+
+void
+as_activate(void)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+#ifdef UW
+        /* Kernel threads don't have an address spaces to activate */
+#endif
+	if (as == NULL) {
+		/* Leave the TLB as it is; we may well come back to it. */
+		return;
+	}
+
+	vm_tlb_activate(as);
+}
+
+void
+as_deactivate(void)
+{
+	/* nothing */
+}
+
+/*
+ * Set up a segment at virtual address VADDR of size MEMSIZE. The
+ * segment in memory extends from VADDR up to (but not including)
+ * VADDR+MEMSIZE.
+ *
+ * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
+ * write, or execute permission should be set on the segment.
+ */
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	struct region *rg;
+	size_t npages;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+
+	/*
+	 * Nothing is copied through uiomove any more, so catch
+	 * executables that want to be loaded into kernel space here.
+	 */
+	if (vaddr >= USERSPACETOP || sz > USERSPACETOP - vaddr) {
+		return EFAULT;
+	}
+
+	rg = region_create(vaddr, npages,
+			   readable != 0, writeable != 0, executable != 0);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	as_add_region(as, rg);
+	return 0;
+}
+
+int
+as_define_file(struct addrspace *as, struct vnode *v,
+	       off_t offset, vaddr_t vaddr, size_t filesize)
+{
+	struct region *rg;
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL) {
+		return EFAULT;
+	}
+	if (filesize > rg->rg_vbase + rg->rg_npages * PAGE_SIZE - vaddr) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = rg->rg_vbase + rg->rg_npages * PAGE_SIZE - vaddr;
+	}
+	KASSERT(rg->rg_vnode == NULL);
+
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_offset = offset;
+	rg->rg_fvaddr = vaddr;
+	rg->rg_filesize = filesize;
+
+	/*
+	 * Nobody writes to text, so every process running this program
+	 * can use the same copy of it.
+	 */
+	if (!rg->rg_writeable) {
+		return pagecache_open(v, &rg->rg_cache);
+	}
+	return 0;
+}
+
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr - rg->rg_vbase < rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Nothing to do: pages are allocated as they are touched. */
+	(void)as;
+	return 0;
+}
+
+/*
+ * Now that the executable's regions are all defined, put the (empty)
+ * heap just above the highest of them.
+ */
+int
+as_complete_load(struct addrspace *as)
+{
+	struct region *rg;
+	vaddr_t top, end;
+
+	KASSERT(as->as_heap == NULL);
+
+	top = 0;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (end > top) {
+			top = end;
+		}
+	}
+	if (top > VM_STACKLIMIT) {
+		return ENOMEM;
+	}
+
+	rg = region_create(top, 0, true, true, false);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	as_add_region(as, rg);
+	as->as_heap = rg;
+	as->as_heapend = top;
+	return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	struct region *rg;
+
+	KASSERT(as->as_stack == NULL);
+
+	rg = region_create(USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			   VM_STACKPAGES, true, true, false);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	as_add_region(as, rg);
+	as->as_stack = rg;
+
+	/* Initial user-level stack pointer */
+	*stackptr = USERSTACK;
+
+	return 0;
+}
+
+struct region *
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack, *rg;
+	vaddr_t base;
+
+	stack = as->as_stack;
+	if (stack == NULL || vaddr < VM_STACKLIMIT || vaddr >= stack->rg_vbase) {
+		return NULL;
+	}
+	base = vaddr & PAGE_FRAME;
+
+	/* Don't grow over anything else. */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg != stack && rg->rg_vbase < stack->rg_vbase &&
+		    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > base) {
+			return NULL;
+		}
+	}
+
+	stack->rg_npages += (stack->rg_vbase - base) / PAGE_SIZE;
+	stack->rg_vbase = base;
+	return stack;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap, *rg;
+	vaddr_t newbreak, oldend, newend;
+
+	heap = as->as_heap;
+	if (heap == NULL) {
+		/* No executable loaded, so nowhere to put a heap. */
+		return ENOMEM;
+	}
+
+	if (amount < 0) {
+		if ((vaddr_t)0 - (vaddr_t)amount > as->as_heapend - heap->rg_vbase) {
+			return EINVAL;
+		}
+	}
+	else if ((vaddr_t)amount > VM_STACKLIMIT - as->as_heapend) {
+		return ENOMEM;
+	}
+	newbreak = as->as_heapend + amount;
+
+	oldend = heap->rg_vbase + heap->rg_npages * PAGE_SIZE;
+	newend = (newbreak + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	/* Don't grow into a file mapping. */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg != heap && rg->rg_vbase >= heap->rg_vbase &&
+		    rg->rg_vbase < newend) {
+			return ENOMEM;
+		}
+	}
+
+	if (newend < oldend) {
+		/*
+		 * Only this process's own thread runs in AS, and it's in
+		 * here, so the pages can go before the TLB entries do.
+		 */
+		pt_unmap(as->as_pt, newend, oldend);
+		vm_tlb_shootdown(as, newend, (oldend - newend) / PAGE_SIZE);
+	}
+
+	heap->rg_npages = (newend - heap->rg_vbase) / PAGE_SIZE;
+	*oldbreak = as->as_heapend;
+	as->as_heapend = newbreak;
+	return 0;
+}
+
+/*
+ * Find NPAGES pages of unused address space between the heap and
+ * VM_STACKLIMIT, as high up as possible, and return the lowest in
+ * *RET. Returns false if there isn't room.
+ */
+static
+bool
+as_find_hole(struct addrspace *as, size_t npages, vaddr_t *ret)
+{
+	struct region *rg;
+	vaddr_t floor, base, size;
+	bool moved;
+
+	if (as->as_heap == NULL) {
+		return false;
+	}
+	floor = as->as_heap->rg_vbase + as->as_heap->rg_npages * PAGE_SIZE;
+	size = npages * PAGE_SIZE;
+	if (npages > (VM_STACKLIMIT - floor) / PAGE_SIZE) {
+		return false;
+	}
+
+	/* Slide down below anything in the way until nothing is. */
+	base = VM_STACKLIMIT - size;
+	do {
+		moved = false;
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			if (rg->rg_vbase >= base + size ||
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE <= base) {
+				continue;
+			}
+			if (rg->rg_vbase < floor + size) {
+				return false;
+			}
+			base = rg->rg_vbase - size;
+			moved = true;
+		}
+	} while (moved);
+
+	*ret = base;
+	return true;
+}
+
+int
+as_map(struct addrspace *as, struct pagecache *pc, off_t offset, size_t len,
+       int prot, bool shared, vaddr_t *ret)
+{
+	struct region *rg;
+	size_t npages;
+	vaddr_t base;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (npages == 0 || npages < len / PAGE_SIZE) {
+		return EINVAL;
+	}
+	if (!as_find_hole(as, npages, &base)) {
+		return ENOMEM;
+	}
+
+	rg = region_create(base, npages, (prot & PROT_READ) != 0,
+			   (prot & PROT_WRITE) != 0, (prot & PROT_EXEC) != 0);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_cache = pc;
+	rg->rg_cacheoffset = offset;
+	rg->rg_shared = shared;
+	as_add_region(as, rg);
+
+	*ret = base;
+	return 0;
+}
+
+int
+as_unmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg, **rgp;
+	vaddr_t end, rgend;
+	int result;
+
+	if ((vaddr & PAGE_FRAME) != vaddr || len == 0 ||
+	    len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	end = (vaddr + len + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	/* Check the whole range first, so we don't stop halfway. */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (rg->rg_vbase >= end || rgend <= vaddr) {
+			continue;
+		}
+		if (rg->rg_cache == NULL || rg->rg_vnode != NULL ||
+		    rg->rg_vbase < vaddr || rgend > end) {
+			return EINVAL;
+		}
+	}
+
+	rgp = &as->as_regions;
+	while (*rgp != NULL) {
+		rg = *rgp;
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (rg->rg_vbase >= end || rgend <= vaddr) {
+			rgp = &rg->rg_next;
+			continue;
+		}
+		if (rg->rg_shared) {
+			result = as_sync_region(as, rg, rg->rg_vbase, rgend);
+			if (result) {
+				return result;
+			}
+		}
+		*rgp = rg->rg_next;
+		pt_unmap(as->as_pt, rg->rg_vbase, rgend);
+		vm_tlb_shootdown(as, rg->rg_vbase, rg->rg_npages);
+		region_destroy(rg);
+	}
+	return 0;
+}
+
+int
+as_sync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	vaddr_t end, lo, hi;
+	int result;
+
+	if ((vaddr & PAGE_FRAME) != vaddr || len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	end = (vaddr + len + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_cache == NULL || !rg->rg_shared) {
+			continue;
+		}
+		lo = rg->rg_vbase > vaddr ? rg->rg_vbase : vaddr;
+		hi = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (hi > end) {
+			hi = end;
+		}
+		if (lo >= hi) {
+			continue;
+		}
+		result = as_sync_region(as, rg, lo, hi);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,422 @@
+/*
+ * The kernel heap arena. See arena.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <arena.h>
+
+/*
+ * Every block, free or allocated, starts with a boundary tag. Sizes
+ * include the tag and are multiples of ARENA_QUANTUM, so the low bit
+ * of at_size is free to mark free blocks. The block before another is
+ * at_prevsize bytes before it; the first block of a span has
+ * at_prevsize 0. At the end of each span is a sentinel tag of size 0
+ * that is never free, so the last block needs no special case either.
+ */
+struct arena_tag {
+	uint32_t at_size;		/* bytes in the block, | ARENA_FREE */
+	uint32_t at_prevsize;		/* bytes in the block before, or 0 */
+};
+
+#define ARENA_FREE     1
+#define TAG_SIZE(t)    ((t)->at_size & ~(uint32_t)ARENA_FREE)
+#define TAG_ISFREE(t)  (((t)->at_size & ARENA_FREE) != 0)
+
+/* A free block: its tag, then its links on its size class's list. */
+struct arena_freeblk {
+	struct arena_tag af_tag;
+	struct arena_freeblk *af_next;
+	struct arena_freeblk *af_prev;
+};
+
+/*
+ * The start of a span. Blocks start right after it, so they are
+ * 16-byte aligned and what they hand out, after the tag, is 8 bytes
+ * past that: aligned enough, and never page aligned.
+ */
+struct arena_span {
+	struct arena_span *as_next;	/* on arena_spans */
+	unsigned as_npages;		/* pages in the span */
+	uint32_t as_pad[2];
+};
+
+#define ARENA_QUANTUM   16
+#define ARENA_SENTINEL  16		/* space for the sentinel at the end */
+#define ARENA_OVERHEAD  (sizeof(struct arena_span) + ARENA_SENTINEL)
+
+/* Don't split off free blocks smaller than this; nothing would fit. */
+#define ARENA_MINSPLIT  256
+
+/*
+ * Free lists: class k holds free blocks of at least 2^(k+4) bytes and
+ * less than twice that.
+ */
+#define ARENA_MINSHIFT  4
+#define ARENA_NCLASSES  14
+
+/* Fully free spans kept rather than given back. */
+#define ARENA_KEEP      1
+
+static struct arena_freeblk *arena_freelists[ARENA_NCLASSES];
+static struct arena_span *arena_spans;
+static unsigned arena_nspans;		/* spans */
+static unsigned arena_npages;		/* pages in them */
+static unsigned arena_nidle;		/* spans entirely free */
+static unsigned arena_inuse;		/* bytes in allocated blocks */
+static unsigned arena_nallocs;		/* allocated blocks */
+
+/* Protects all of the above, and the blocks themselves. */
+static struct spinlock arena_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * The size class free blocks of SIZE bytes go in.
+ */
+static
+unsigned
+arena_class(uint32_t size)
+{
+	unsigned k;
+
+	KASSERT(size >= ARENA_QUANTUM);
+	for (k=0; k+1 < ARENA_NCLASSES; k++) {
+		if (size < ((uint32_t)1 << (k + 1 + ARENA_MINSHIFT))) {
+			break;
+		}
+	}
+	return k;
+}
+
+static
+struct arena_tag *
+arena_next(struct arena_tag *t)
+{
+	return (struct arena_tag *)((vaddr_t)t + TAG_SIZE(t));
+}
+
+/*
+ * Put free block FB, whose tag is set, on its free list.
+ */
+static
+void
+arena_insert(struct arena_freeblk *fb)
+{
+	unsigned k;
+
+	KASSERT(spinlock_do_i_hold(&arena_lock));
+	KASSERT(TAG_ISFREE(&fb->af_tag));
+
+	k = arena_class(TAG_SIZE(&fb->af_tag));
+	fb->af_prev = NULL;
+	fb->af_next = arena_freelists[k];
+	if (fb->af_next != NULL) {
+		fb->af_next->af_prev = fb;
+	}
+	arena_freelists[k] = fb;
+}
+
+/*
+ * Take free block FB off its free list.
+ */
+static
+void
+arena_remove(struct arena_freeblk *fb)
+{
+	unsigned k;
+
+	KASSERT(spinlock_do_i_hold(&arena_lock));
+	KASSERT(TAG_ISFREE(&fb->af_tag));
+
+	k = arena_class(TAG_SIZE(&fb->af_tag));
+	if (fb->af_prev != NULL) {
+		fb->af_prev->af_next = fb->af_next;
+	}
+	else {
+		KASSERT(arena_freelists[k] == fb);
+		arena_freelists[k] = fb->af_next;
+	}
+	if (fb->af_next != NULL) {
+		fb->af_next->af_prev = fb->af_prev;
+	}
+}
+
+/*
+ * Whether free block FB is a whole span.
+ */
+static
+bool
+arena_wholespan(struct arena_freeblk *fb)
+{
+	return fb->af_tag.at_prevsize == 0 &&
+		arena_next(&fb->af_tag)->at_size == 0;
+}
+
+/*
+ * Find a free block of at least NEED bytes and take it off its list,
+ * or return NULL. Blocks in NEED's own class may be too small, so that
+ * list is searched; any block of a bigger class will do.
+ */
+static
+struct arena_freeblk *
+arena_find(uint32_t need)
+{
+	struct arena_freeblk *fb;
+	unsigned k;
+
+	KASSERT(spinlock_do_i_hold(&arena_lock));
+
+	k = arena_class(need);
+	for (fb = arena_freelists[k]; fb != NULL; fb = fb->af_next) {
+		if (TAG_SIZE(&fb->af_tag) >= need) {
+			break;
+		}
+	}
+	for (k++; fb == NULL && k < ARENA_NCLASSES; k++) {
+		fb = arena_freelists[k];
+	}
+	if (fb != NULL) {
+		arena_remove(fb);
+	}
+	return fb;
+}
+
+/*
+ * Get a new span with room for a block of NEED bytes, and put its one
+ * free block on the lists. Call without arena_lock. Returns false if
+ * out of memory.
+ */
+static
+bool
+arena_grow(uint32_t need)
+{
+	struct arena_span *span;
+	struct arena_freeblk *fb;
+	struct arena_tag *sentinel;
+	unsigned npages;
+	vaddr_t base;
+
+	COMPILE_ASSERT(sizeof(struct arena_span) == ARENA_QUANTUM);
+	COMPILE_ASSERT(sizeof(struct arena_freeblk) <= ARENA_QUANTUM);
+
+	npages = DIVROUNDUP(need + ARENA_OVERHEAD, PAGE_SIZE);
+	base = 0;
+	if (npages < ARENA_SPANPAGES) {
+		base = alloc_kpages(ARENA_SPANPAGES);
+		if (base != 0) {
+			npages = ARENA_SPANPAGES;
+		}
+	}
+	if (base == 0) {
+		/* No run that long free; make do with what's needed. */
+		base = alloc_kpages(npages);
+		if (base == 0) {
+			return false;
+		}
+	}
+
+	span = (struct arena_span *)base;
+	span->as_npages = npages;
+
+	fb = (struct arena_freeblk *)(base + sizeof(*span));
+	fb->af_tag.at_size =
+		(npages * PAGE_SIZE - ARENA_OVERHEAD) | ARENA_FREE;
+	fb->af_tag.at_prevsize = 0;
+
+	sentinel = arena_next(&fb->af_tag);
+	KASSERT((vaddr_t)sentinel ==
+		base + npages * PAGE_SIZE - ARENA_SENTINEL);
+	sentinel->at_size = 0;
+	sentinel->at_prevsize = TAG_SIZE(&fb->af_tag);
+
+	spinlock_acquire(&arena_lock);
+	span->as_next = arena_spans;
+	arena_spans = span;
+	arena_nspans++;
+	arena_npages += npages;
+	arena_nidle++;
+	arena_insert(fb);
+	spinlock_release(&arena_lock);
+
+	return true;
+}
+
+/*
+ * Take span SPAN, entirely free and off the free lists, off the list
+ * of spans. Its pages are then the caller's to give back.
+ */
+static
+void
+arena_unspan(struct arena_span *span)
+{
+	struct arena_span **sp;
+
+	KASSERT(spinlock_do_i_hold(&arena_lock));
+
+	for (sp = &arena_spans; *sp != span; sp = &(*sp)->as_next) {
+		KASSERT(*sp != NULL);
+	}
+	*sp = span->as_next;
+	arena_nspans--;
+	arena_npages -= span->as_npages;
+}
+
+void *
+arena_alloc(size_t size)
+{
+	struct arena_freeblk *fb, *rest;
+	struct arena_tag *t;
+	uint32_t need, have;
+
+	KASSERT(size <= ARENA_MAXSIZE);
+	need = ROUNDUP(size + sizeof(struct arena_tag), ARENA_QUANTUM);
+
+	spinlock_acquire(&arena_lock);
+	while ((fb = arena_find(need)) == NULL) {
+		spinlock_release(&arena_lock);
+		if (!arena_grow(need)) {
+			return NULL;
+		}
+		spinlock_acquire(&arena_lock);
+	}
+
+	if (arena_wholespan(fb)) {
+		KASSERT(arena_nidle > 0);
+		arena_nidle--;
+	}
+
+	t = &fb->af_tag;
+	have = TAG_SIZE(t);
+	KASSERT(have >= need);
+	if (have - need >= ARENA_MINSPLIT) {
+		/* Split off the rest as a free block of its own. */
+		rest = (struct arena_freeblk *)((vaddr_t)t + need);
+		rest->af_tag.at_size = (have - need) | ARENA_FREE;
+		rest->af_tag.at_prevsize = need;
+		arena_next(&rest->af_tag)->at_prevsize = have - need;
+		arena_insert(rest);
+		have = need;
+	}
+	t->at_size = have;
+
+	arena_inuse += have;
+	arena_nallocs++;
+	spinlock_release(&arena_lock);
+
+	return (void *)((vaddr_t)t + sizeof(*t));
+}
+
+void
+arena_free(void *ptr)
+{
+	struct arena_tag *t, *next, *prev;
+	struct arena_freeblk *fb;
+	struct arena_span *span;
+	uint32_t size, *p;
+	unsigned i;
+
+	t = (struct arena_tag *)((vaddr_t)ptr - sizeof(*t));
+	if ((vaddr_t)ptr % ARENA_QUANTUM != sizeof(*t) || TAG_ISFREE(t) ||
+	    TAG_SIZE(t) < ARENA_QUANTUM) {
+		panic("kfree: arena free of invalid addr %p\n", ptr);
+	}
+	size = TAG_SIZE(t);
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	p = ptr;
+	for (i=0; i<(size - sizeof(*t))/sizeof(uint32_t); i++) {
+		p[i] = 0xdeadbeef;
+	}
+
+	span = NULL;
+
+	spinlock_acquire(&arena_lock);
+	arena_inuse -= size;
+	arena_nallocs--;
+
+	/* Merge with the blocks on either side, if they're free. */
+	next = arena_next(t);
+	if (TAG_ISFREE(next)) {
+		arena_remove((struct arena_freeblk *)next);
+		size += TAG_SIZE(next);
+	}
+	if (t->at_prevsize != 0) {
+		prev = (struct arena_tag *)((vaddr_t)t - t->at_prevsize);
+		KASSERT(TAG_SIZE(prev) == t->at_prevsize);
+		if (TAG_ISFREE(prev)) {
+			arena_remove((struct arena_freeblk *)prev);
+			size += TAG_SIZE(prev);
+			t = prev;
+		}
+	}
+	t->at_size = size | ARENA_FREE;
+	arena_next(t)->at_prevsize = size;
+
+	fb = (struct arena_freeblk *)t;
+	if (arena_wholespan(fb) && arena_nidle >= ARENA_KEEP) {
+		/* Give the span back. */
+		span = (struct arena_span *)((vaddr_t)t - sizeof(*span));
+		arena_unspan(span);
+	}
+	else {
+		if (arena_wholespan(fb)) {
+			arena_nidle++;
+		}
+		arena_insert(fb);
+	}
+	spinlock_release(&arena_lock);
+
+	if (span != NULL) {
+		/* (memory stolen before the coremap existed stays lost) */
+		free_kpages((vaddr_t)span);
+	}
+}
+
+size_t
+arena_blocksize(void *ptr)
+{
+	struct arena_tag *t;
+
+	t = (struct arena_tag *)((vaddr_t)ptr - sizeof(*t));
+	KASSERT(!TAG_ISFREE(t));
+	return TAG_SIZE(t) - sizeof(*t);
+}
+
+void
+arena_printstats(void)
+{
+	unsigned nfree[ARENA_NCLASSES], bytes[ARENA_NCLASSES];
+	unsigned nspans, npages, nidle, inuse, nallocs, k;
+	struct arena_freeblk *fb;
+
+	/* Copy it all out first, so as not to print with the lock held. */
+	spinlock_acquire(&arena_lock);
+	for (k=0; k<ARENA_NCLASSES; k++) {
+		nfree[k] = bytes[k] = 0;
+		for (fb = arena_freelists[k]; fb != NULL; fb = fb->af_next) {
+			nfree[k]++;
+			bytes[k] += TAG_SIZE(&fb->af_tag);
+		}
+	}
+	nspans = arena_nspans;
+	npages = arena_npages;
+	nidle = arena_nidle;
+	inuse = arena_inuse;
+	nallocs = arena_nallocs;
+	spinlock_release(&arena_lock);
+
+	kprintf("Arena: %u spans (%u free), %u pages; "
+		"%u blocks, %u bytes in use\n",
+		nspans, nidle, npages, nallocs, inuse);
+	for (k=0; k<ARENA_NCLASSES; k++) {
+		if (nfree[k] > 0) {
+			kprintf("  free %6u+ bytes: %4u blocks, %7u bytes\n",
+				1U << (k + ARENA_MINSHIFT), nfree[k],
+				bytes[k]);
+		}
+	}
+}
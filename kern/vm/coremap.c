@@ -0,0 +1,1709 @@
+/*
+ * Physical memory management: the coremap.
+ *
+ * Until coremap_bootstrap runs, pages are stolen with ram_stealmem and
+ * can never be given back. After that every remaining frame of RAM is
+ * described by a coremap entry and allocated from here.
+ *
+ * Free frames are kept by a buddy allocator: a free block of 2^k
+ * frames starts at a frame number that is a multiple of 2^k, and sits
+ * on free list k. Allocating takes the first block from the smallest
+ * list that is big enough, splitting it, and gives back whatever part
+ * of it isn't needed; freeing merges a block with its buddy for as
+ * long as the buddy is free too. So both take time proportional to
+ * the number of lists, not the number of frames.
+ *
+ * In front of the free lists, each CPU keeps a small cache (magazine)
+ * of free single frames. Most one-page allocations and frees are
+ * served from it without taking the coremap lock. Frames in a
+ * magazine look like one-page kernel blocks to the rest of the
+ * coremap, so nothing else touches them. When a magazine runs empty
+ * or full, half of it is refilled from or drained to the free lists
+ * in one go.
+ *
+ * Frames sitting zeroed in the zero pool (zeropool.h) are free memory
+ * as well, so they are used up before anything is evicted.
+ *
+ * When no frame is free, a user page is evicted to make room. Which
+ * one is up to the replacement policy in use (vmpolicy.h); the clock
+ * (second chance) algorithm unless another was chosen at boot. MIPS
+ * has no hardware reference bits, so cme_ref is set whenever vm_fault
+ * loads the page into the TLB instead. When a policy clears cme_ref
+ * (with coremap_clearref) it also sets PTE_UNREF, so that the next
+ * miss on the page goes to vm_fault rather than being refilled by the
+ * UTLB handler unseen. Other CPUs may still have the page in their
+ * TLBs, and would go on using it without a miss; as the coremap lock
+ * is held while the policy looks for a victim, those pages are noted,
+ * and shot down from every TLB once the lock is dropped.
+ *
+ * Evicting on the fault path is the last resort, though: the pageout
+ * daemon (pageout.h) is woken as free memory runs low, and evicts
+ * pages ahead of time with coremap_reclaim, writing runs of dirty
+ * pages to swap together.
+ *
+ * Load control (loadctl.h) keeps a second reference bit, cme_used,
+ * that only it clears, once a second, to see how many pages each
+ * address space uses; and swaps out the pages of the processes it
+ * deactivates with coremap_swapout.
+ *
+ * Page cache frames that no page table maps any more are on the clock
+ * too. They are clean (shared mappings write back before they let go),
+ * so evicting one just takes it out of its cache.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <wchan.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <zeropool.h>
+#include <pagecache.h>
+#include <pageout.h>
+#include <vmpolicy.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <coremap.h>
+#include <uw-vmstats.h>
+#include <platform/maxcpus.h>
+
+/*
+ * The coremap itself, and the physical address of the frame described
+ * by entry 0. Frame i is at coremap_base + i*PAGE_SIZE, so finding the
+ * entry for a frame is just arithmetic.
+ */
+static struct coremap_entry *coremap;
+static paddr_t coremap_base;
+static unsigned coremap_nframes;
+static unsigned coremap_nused;
+static bool coremap_ready = false;
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Heads of the free lists. List k holds free blocks of 2^k frames,
+ * linked through cme_free of their first frame.
+ */
+#define COREMAP_NORDERS 16
+#define NOFRAME ((unsigned)-1)
+static unsigned coremap_freelist[COREMAP_NORDERS];
+
+/*
+ * Per-CPU magazines. Only used by their own CPU, with interrupts off.
+ * Small, because frames sitting in another CPU's magazine can't be
+ * used when memory runs out.
+ */
+#define COREMAP_MAGSIZE 8
+struct coremap_mag {
+	unsigned cm_frames[COREMAP_MAGSIZE];
+	unsigned cm_count;		/* frames in cm_frames */
+	unsigned cm_hits;		/* allocations served from the magazine */
+	unsigned cm_misses;		/* allocations that had to refill it */
+};
+static struct coremap_mag coremap_mags[MAXCPUS];
+
+/*
+ * Replacement policy. It is told about every frame that holds a user
+ * page, from coremap_make_upage until the frame is freed or evicted.
+ */
+static const struct vmpolicy *coremap_policy = &vmpolicy_clock;
+
+/* Where threads wait for evictions (PTE_BUSY pages) to finish. */
+static struct wchan *coremap_wchan;
+
+/*
+ * Pages given PTE_UNREF that other CPUs' TLBs may still hold, waiting
+ * for coremap_unref_flush. One entry per address space, covering the
+ * range of pages noted.
+ *
+ * The address space may be destroyed before the flush. That is all
+ * right, as shootdowns only compare it with the address space each
+ * TLB holds, and a destroyed one is no TLB's (vm_tlb_forget); at
+ * worst a new one at the same address loses a few TLB entries.
+ */
+#define COREMAP_UNREF_MAX 16
+struct coremap_unref {
+	struct addrspace *cu_as;
+	vaddr_t cu_lo, cu_hi;		/* first and last page noted */
+};
+static struct coremap_unref coremap_unref[COREMAP_UNREF_MAX];
+static unsigned coremap_nunref;
+
+#define PADDR_TO_FRAME(pa)  (((pa) - coremap_base) / PAGE_SIZE)
+#define FRAME_TO_PADDR(i)   (coremap_base + (paddr_t)(i) * PAGE_SIZE)
+
+static void coremap_free_range(unsigned frame, unsigned npages);
+static void coremap_unref_flush(void);
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	unsigned i, nframes;
+	size_t cmsize;
+
+	ram_getsize(&lo, &hi);
+
+	/*
+	 * Put the coremap at the bottom of free memory. Size it for
+	 * every frame between lo and hi; that's a few entries more
+	 * than we need, since the coremap uses up some of them.
+	 */
+	nframes = (hi - lo) / PAGE_SIZE;
+	cmsize = ROUNDUP(nframes * sizeof(struct coremap_entry), PAGE_SIZE);
+
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(lo);
+	coremap_base = lo + cmsize;
+	coremap_nframes = (hi - coremap_base) / PAGE_SIZE;
+	coremap_nused = 0;
+
+	for (i=0; i<COREMAP_NORDERS; i++) {
+		coremap_freelist[i] = NOFRAME;
+	}
+	for (i=0; i<coremap_nframes; i++) {
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_order = 0;
+		coremap[i].cme_inuse = false;
+		coremap[i].cme_freehead = false;
+		coremap[i].cme_kernel = false;
+		coremap[i].cme_pinned = false;
+		coremap[i].cme_busy = false;
+		coremap[i].cme_ref = false;
+		coremap[i].cme_cached = false;
+	}
+	coremap_free_range(0, coremap_nframes);
+
+	coremap_ready = true;
+
+	coremap_wchan = wchan_create("coremap");
+	if (coremap_wchan == NULL) {
+		panic("coremap: Could not create wchan\n");
+	}
+
+	DEBUG(DB_VM, "coremap: %u frames at 0x%x\n", coremap_nframes,
+	      coremap_base);
+}
+
+/*
+ * Put the free block of 2^ORDER frames at FRAME on its free list.
+ */
+static
+void
+coremap_freelist_add(unsigned frame, unsigned order)
+{
+	unsigned next;
+
+	KASSERT(order < COREMAP_NORDERS);
+
+	next = coremap_freelist[order];
+	coremap[frame].cme_freehead = true;
+	coremap[frame].cme_order = order;
+	coremap[frame].cme_free.next = next;
+	coremap[frame].cme_free.prev = NOFRAME;
+	if (next != NOFRAME) {
+		coremap[next].cme_free.prev = frame;
+	}
+	coremap_freelist[order] = frame;
+}
+
+/*
+ * Take the free block at FRAME off its free list.
+ */
+static
+void
+coremap_freelist_remove(unsigned frame)
+{
+	unsigned next, prev;
+
+	KASSERT(coremap[frame].cme_freehead);
+
+	next = coremap[frame].cme_free.next;
+	prev = coremap[frame].cme_free.prev;
+	if (prev != NOFRAME) {
+		coremap[prev].cme_free.next = next;
+	}
+	else {
+		coremap_freelist[coremap[frame].cme_order] = next;
+	}
+	if (next != NOFRAME) {
+		coremap[next].cme_free.prev = prev;
+	}
+	coremap[frame].cme_freehead = false;
+}
+
+/*
+ * Free the block of 2^ORDER frames at FRAME, merging it with its
+ * buddy as many times as possible.
+ */
+static
+void
+coremap_free_block(unsigned frame, unsigned order)
+{
+	unsigned buddy;
+
+	while (order + 1 < COREMAP_NORDERS) {
+		buddy = frame ^ (1U << order);
+		if (buddy >= coremap_nframes ||
+		    !coremap[buddy].cme_freehead ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		coremap_freelist_remove(buddy);
+		if (buddy < frame) {
+			frame = buddy;
+		}
+		order++;
+	}
+	coremap_freelist_add(frame, order);
+}
+
+/*
+ * Free NPAGES frames starting at FRAME, as the largest aligned
+ * blocks that fit.
+ */
+static
+void
+coremap_free_range(unsigned frame, unsigned npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order + 1 < COREMAP_NORDERS &&
+		       (frame & ((2U << order) - 1)) == 0 &&
+		       (2U << order) <= npages) {
+			order++;
+		}
+		coremap_free_block(frame, order);
+		frame += 1U << order;
+		npages -= 1U << order;
+	}
+}
+
+/*
+ * Allocate NPAGES contiguous frames and mark them in use. Returns the
+ * index of the first one, or -1 if there is no free run that long.
+ */
+static
+int
+coremap_alloc_run(unsigned npages)
+{
+	unsigned i, order, want, frame;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(npages > 0);
+
+	for (want=0; (1U << want) < npages; want++) {
+		/* nothing */
+	}
+	for (order=want; order<COREMAP_NORDERS; order++) {
+		if (coremap_freelist[order] != NOFRAME) {
+			break;
+		}
+	}
+	if (order >= COREMAP_NORDERS) {
+		return -1;
+	}
+
+	frame = coremap_freelist[order];
+	coremap_freelist_remove(frame);
+
+	/* Split off the top halves until the block is the right size... */
+	while (order > want) {
+		order--;
+		coremap_freelist_add(frame + (1U << order), order);
+	}
+	/* ...and give back the end of it if NPAGES isn't a power of 2. */
+	coremap_free_range(frame + npages, (1U << order) - npages);
+
+	for (i=0; i<npages; i++) {
+		coremap[frame+i].cme_inuse = true;
+	}
+	coremap_nused += npages;
+	return frame;
+}
+
+void
+coremap_lock_acquire(void)
+{
+	spinlock_acquire(&coremap_lock);
+}
+
+void
+coremap_lock_release(void)
+{
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_wait_evict(void)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	wchan_lock(coremap_wchan);
+	spinlock_release(&coremap_lock);
+	wchan_sleep(coremap_wchan);
+	spinlock_acquire(&coremap_lock);
+}
+
+/*
+ * Return the page table entry of user frame CUR, which has a single
+ * owner.
+ */
+static
+pte_t *
+coremap_owner_pte(unsigned cur)
+{
+	struct coremap_entry *cme;
+	pte_t *pte;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = &coremap[cur];
+	KASSERT(cme->cme_as != NULL);
+	KASSERT(cme->cme_refcount == 1);
+
+	pte = pt_lookup(cme->cme_as->as_pt, cme->cme_vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT(*pte & PTE_VALID);
+	KASSERT((*pte & PTE_FRAME) == FRAME_TO_PADDR(cur));
+	return pte;
+}
+
+/*
+ * Find the dirty pages of AS that follow VA, for coremap_evict_cluster
+ * to write out along with VA's page, and put up to MAX-1 of them in
+ * FRAMES[] and PTES[] after VA's own (which are already at index 0).
+ * Only pages that could be evicted on their own are used: unpinned,
+ * owned by AS alone, and not referenced since their bit was last
+ * cleared. The run
+ * stays within VA's second-level page table: pt_destroy may already
+ * have freed the others. Returns the length of the run, counting VA's
+ * page.
+ */
+static
+unsigned
+coremap_gather(struct addrspace *as, vaddr_t va, unsigned *frames,
+	       pte_t **ptes, unsigned max)
+{
+	struct coremap_entry *cme;
+	pte_t *pte;
+	vaddr_t next;
+	unsigned n, cur;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (n=1; n<max; n++) {
+		next = va + n * PAGE_SIZE;
+		if (PT_DIR_INDEX(next) != PT_DIR_INDEX(va)) {
+			break;
+		}
+		pte = pt_lookup(as->as_pt, next, false);
+		if (pte == NULL || (*pte & (PTE_VALID | PTE_DIRTY)) !=
+		    (PTE_VALID | PTE_DIRTY)) {
+			break;
+		}
+		cur = PADDR_TO_FRAME(*pte & PTE_FRAME);
+		cme = &coremap[cur];
+		if (cme->cme_pinned || cme->cme_busy || cme->cme_cached ||
+		    cme->cme_ref || cme->cme_as != as) {
+			break;
+		}
+		KASSERT(cme->cme_refcount == 1);
+		frames[n] = cur;
+		ptes[n] = pte;
+	}
+	return n;
+}
+
+/*
+ * Have the replacement policy choose a page to evict, and if it is
+ * dirty, find it a swap slot (*DIRTY and *SLOT). If swap is full, ask
+ * for a clean page instead. Returns the frame, or -1 if there is none.
+ */
+static
+int
+coremap_victim(bool *dirty, unsigned *slot)
+{
+	int frame;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	frame = coremap_policy->vp_victim(false);
+	if (frame >= 0 && (coremap_pstate(frame) & COREMAP_DIRTY)) {
+		*dirty = true;
+		if (swap_alloc(slot)) {
+			/* Swap is full (or missing); look for a clean page. */
+			*dirty = false;
+			frame = coremap_policy->vp_victim(true);
+		}
+	}
+	return frame;
+}
+
+/*
+ * Like coremap_victim, but take the first page of AS that can be
+ * evicted at or after frame *CURSOR, and advance *CURSOR past it.
+ * Dirty pages are passed over if swap is full.
+ */
+static
+int
+coremap_victim_of(struct addrspace *as, unsigned *cursor, bool *dirty,
+		  unsigned *slot)
+{
+	struct coremap_entry *cme;
+	unsigned state;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (; *cursor < coremap_nframes; (*cursor)++) {
+		state = coremap_pstate(*cursor);
+		cme = &coremap[*cursor];
+		if ((state & COREMAP_EVICTABLE) == 0 || cme->cme_cached ||
+		    cme->cme_as != as) {
+			continue;
+		}
+		*dirty = (state & COREMAP_DIRTY) != 0;
+		if (*dirty && swap_alloc(slot)) {
+			*dirty = false;
+			continue;
+		}
+		return (*cursor)++;
+	}
+	return -1;
+}
+
+/*
+ * Have the replacement policy choose a user page, and evict it. Pinned
+ * frames and frames shared by several address spaces are never
+ * chosen, and dirty pages aren't if there is no swap space for them.
+ *
+ * Dirty pages are written to swap. Clean pages are just dropped; their
+ * page table entry goes back to zero and the page will be refilled
+ * from its region (the executable, or zeros) if it is used again.
+ * Unmapped page cache frames are dropped from their cache.
+ *
+ * If MAX is more than 1 and the victim is dirty, the dirty pages that
+ * follow it in its address space are evicted with it (see
+ * coremap_gather), and the whole run goes to consecutive swap slots in
+ * one write. The pageout daemon does this; a fault that has to evict
+ * just takes one page, to get back to work sooner.
+ *
+ * While the pages are being written out their page table entries have
+ * PTE_BUSY set. If the owning address space is destroyed in the
+ * meantime, pt_destroy drops the frames' reference counts to zero and
+ * leaves the rest to us.
+ *
+ * If OWNER is not NULL, the page is one of OWNER's instead, the first
+ * that can be evicted at or after frame *CURSOR (see coremap_swapout),
+ * and the policy isn't asked.
+ *
+ * Puts the indexes of the evicted frames, still in use and now pinned,
+ * in FRAMES[] (the chosen one first), and returns how many there are:
+ * 0 if there was nothing to evict.
+ */
+static
+unsigned
+coremap_evict_cluster(unsigned *frames, unsigned max,
+		      struct addrspace *owner, unsigned *cursor)
+{
+	struct coremap_entry *cme;
+	struct addrspace *as;
+	struct pcpage *pp;
+	pte_t *ptes[SWAP_MAXCLUSTER];
+	paddr_t pas[SWAP_MAXCLUSTER];
+	vaddr_t va;
+	unsigned i, n, slot, cslot;
+	int frame, result;
+	bool dirty;
+	time_t s0, s1, ds;
+	uint32_t ns0, ns1, dns;
+
+	KASSERT(max > 0 && max <= SWAP_MAXCLUSTER);
+
+	gettime(&s0, &ns0);
+
+	spinlock_acquire(&coremap_lock);
+
+	slot = 0;
+	dirty = false;
+	if (owner == NULL) {
+		frame = coremap_victim(&dirty, &slot);
+	}
+	else {
+		frame = coremap_victim_of(owner, cursor, &dirty, &slot);
+	}
+
+	if (frame < 0) {
+		spinlock_release(&coremap_lock);
+		coremap_unref_flush();
+		return 0;
+	}
+	KASSERT(coremap_pstate(frame) & COREMAP_EVICTABLE);
+
+	frames[0] = frame;
+	cme = &coremap[frame];
+	if (cme->cme_cached) {
+		/* Nothing maps it, so no TLB can hold it either. */
+		coremap_policy->vp_evict(frame, NULL, 0);
+		pp = cme->cme_cpage;
+		pagecache_unlink(pp);
+		cme->cme_cached = false;
+		cme->cme_pinned = true;
+		cme->cme_as = NULL;
+		cme->cme_vaddr = 0;
+		cme->cme_refcount = 0;
+		spinlock_release(&coremap_lock);
+		coremap_unref_flush();
+		kfree(pp);
+
+		gettime(&s1, &ns1);
+		getinterval(s0, ns0, s1, ns1, &ds, &dns);
+		vmstats_inc(VMSTAT_PAGE_EVICT);
+		vmstats_add(VMSTAT_PAGE_EVICT_USEC, ds * 1000000 + dns / 1000);
+		return 1;
+	}
+
+	as = cme->cme_as;
+	va = cme->cme_vaddr;
+	ptes[0] = coremap_owner_pte(frame);
+
+	n = 1;
+	if (dirty && max > 1) {
+		n = coremap_gather(as, va, frames, ptes, max);
+		if (n > 1 && swap_alloc_cluster(n, &cslot) == 0) {
+			swap_free(slot);
+			slot = cslot;
+		}
+		else {
+			n = 1;
+		}
+	}
+
+	for (i=0; i<n; i++) {
+		coremap_policy->vp_evict(frames[i], as, va + i * PAGE_SIZE);
+		coremap[frames[i]].cme_busy = true;
+		*ptes[i] = (*ptes[i] & ~(PTE_VALID | PTE_WRITE)) | PTE_BUSY;
+		pas[i] = FRAME_TO_PADDR(frames[i]);
+	}
+
+	spinlock_release(&coremap_lock);
+
+	/*
+	 * The pages may be in use on another CPU right now. PTE_BUSY
+	 * keeps them from being loaded again, and once the shootdowns
+	 * are done nobody can change them behind our back.
+	 */
+	for (i=0; i<n; i++) {
+		vm_tlb_shootdown_page(as, va + i * PAGE_SIZE);
+	}
+	coremap_unref_flush();
+
+	if (dirty) {
+		result = swap_write_cluster(pas, n, slot);
+		if (result) {
+			panic("swap: Writing slots %u-%u: %s\n", slot,
+			      slot + n - 1, strerror(result));
+		}
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	for (i=0; i<n; i++) {
+		cme = &coremap[frames[i]];
+		if (cme->cme_refcount == 0) {
+			/* The address space was destroyed meanwhile. */
+			if (dirty) {
+				swap_free(slot + i);
+			}
+		}
+		else {
+			*ptes[i] = dirty ? SLOT_TO_PTE(slot + i) : 0;
+		}
+		cme->cme_busy = false;
+		cme->cme_pinned = true;
+		cme->cme_as = NULL;
+		cme->cme_vaddr = 0;
+		cme->cme_refcount = 0;
+	}
+	wchan_wakeall(coremap_wchan);
+
+	spinlock_release(&coremap_lock);
+
+	gettime(&s1, &ns1);
+	getinterval(s0, ns0, s1, ns1, &ds, &dns);
+	vmstats_add(VMSTAT_PAGE_EVICT, n);
+	vmstats_add(VMSTAT_PAGE_EVICT_USEC, ds * 1000000 + dns / 1000);
+
+	return n;
+}
+
+/*
+ * Give FRAME, a user frame that nothing refers to any more, back to
+ * the free lists.
+ */
+static
+void
+coremap_free_frame(unsigned frame)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = &coremap[frame];
+	KASSERT(cme->cme_inuse && !cme->cme_kernel);
+	KASSERT(!cme->cme_cached);
+	KASSERT(cme->cme_refcount == 0);
+
+	cme->cme_inuse = false;
+	cme->cme_pinned = false;
+	cme->cme_ref = false;
+	cme->cme_used = false;
+	cme->cme_merged = false;
+	coremap_policy->vp_remove(frame);
+	coremap_free_block(frame, 0);
+	coremap_nused--;
+}
+
+/*
+ * Evict one page. Returns the index of its frame, still in use and
+ * now pinned, or -1 if there was nothing to evict.
+ */
+static
+int
+coremap_evict(void)
+{
+	unsigned frame;
+
+	if (coremap_evict_cluster(&frame, 1, NULL, NULL) == 0) {
+		return -1;
+	}
+	return frame;
+}
+
+/*
+ * Mark the NPAGES frames at START, which are in use, as a kernel block.
+ */
+static
+void
+coremap_mark_kernel(unsigned start, unsigned npages)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (i=0; i<npages; i++) {
+		KASSERT(coremap[start+i].cme_inuse);
+		coremap[start+i].cme_kernel = true;
+		coremap[start+i].cme_pinned = false;
+		coremap[start+i].cme_npages = 0;
+		coremap[start+i].cme_pageref = NULL;
+	}
+	coremap[start].cme_npages = npages;
+}
+
+/*
+ * Give the kernel block of NPAGES frames at START to the free lists.
+ */
+static
+void
+coremap_free_kernel(unsigned start, unsigned npages)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (i=0; i<npages; i++) {
+		KASSERT(coremap[start+i].cme_inuse);
+		KASSERT(coremap[start+i].cme_kernel);
+		coremap[start+i].cme_inuse = false;
+		coremap[start+i].cme_kernel = false;
+	}
+	coremap_free_range(start, npages);
+	coremap_nused -= npages;
+}
+
+/*
+ * Take a frame from this CPU's magazine, refilling it from the free
+ * lists if it's empty. The frame is a one-page kernel block. Returns
+ * -1 if the free lists are empty too.
+ */
+static
+int
+coremap_mag_get(void)
+{
+	struct coremap_mag *mag;
+	unsigned frame;
+	int spl, result;
+
+	spl = splhigh();
+	mag = &coremap_mags[curcpu->c_number];
+
+	if (mag->cm_count > 0) {
+		mag->cm_hits++;
+		vmstats_inc(VMSTAT_FRAME_CACHE_HIT);
+	}
+	else {
+		mag->cm_misses++;
+		vmstats_inc(VMSTAT_FRAME_CACHE_MISS);
+		spinlock_acquire(&coremap_lock);
+		while (mag->cm_count < COREMAP_MAGSIZE / 2) {
+			result = coremap_alloc_run(1);
+			if (result < 0) {
+				break;
+			}
+			coremap_mark_kernel(result, 1);
+			mag->cm_frames[mag->cm_count++] = result;
+		}
+		spinlock_release(&coremap_lock);
+
+		/* Memory only gets used up here; time to reclaim some? */
+		pageout_check();
+
+		if (mag->cm_count == 0) {
+			splx(spl);
+			return -1;
+		}
+	}
+
+	frame = mag->cm_frames[--mag->cm_count];
+	splx(spl);
+	return frame;
+}
+
+/*
+ * Put FRAME, a one-page kernel block, in this CPU's magazine, draining
+ * half of the magazine to the free lists first if it's full.
+ */
+static
+void
+coremap_mag_put(unsigned frame)
+{
+	struct coremap_mag *mag;
+	int spl;
+
+	spl = splhigh();
+	mag = &coremap_mags[curcpu->c_number];
+
+	if (mag->cm_count == COREMAP_MAGSIZE) {
+		spinlock_acquire(&coremap_lock);
+		while (mag->cm_count > COREMAP_MAGSIZE / 2) {
+			coremap_free_kernel(mag->cm_frames[--mag->cm_count], 1);
+		}
+		spinlock_release(&coremap_lock);
+	}
+	mag->cm_frames[mag->cm_count++] = frame;
+
+	splx(spl);
+}
+
+static
+paddr_t
+getppages(unsigned long npages)
+{
+	paddr_t addr;
+	int start;
+
+	if (!coremap_ready) {
+		spinlock_acquire(&coremap_lock);
+		addr = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return addr;
+	}
+
+	if (npages == 1) {
+		start = coremap_mag_get();
+		if (start >= 0) {
+			return FRAME_TO_PADDR(start);
+		}
+	}
+	else {
+		spinlock_acquire(&coremap_lock);
+		start = coremap_alloc_run(npages);
+		if (start >= 0) {
+			coremap_mark_kernel(start, npages);
+		}
+		spinlock_release(&coremap_lock);
+		if (start >= 0) {
+			return FRAME_TO_PADDR(start);
+		}
+	}
+
+	/*
+	 * Evicting may sleep, so only try it if we're allowed to: not
+	 * in an interrupt, and with interrupts on (so no spinlocks
+	 * held). Contiguous runs of pages are not worth the trouble.
+	 */
+	if (npages > 1 || curthread->t_in_interrupt ||
+	    curthread->t_iplhigh_count > 0) {
+		return 0;
+	}
+	start = coremap_evict();
+	if (start < 0) {
+		return 0;
+	}
+	spinlock_acquire(&coremap_lock);
+	coremap_mark_kernel(start, 1);
+	spinlock_release(&coremap_lock);
+	return FRAME_TO_PADDR(start);
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+
+	pa = getppages(npages);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	paddr_t pa;
+	unsigned frame, npages;
+
+	KASSERT(addr >= MIPS_KSEG0);
+	pa = addr - MIPS_KSEG0;
+
+	/* Memory stolen before the coremap existed is never freed. */
+	if (!coremap_ready || pa < coremap_base) {
+		return;
+	}
+
+	frame = PADDR_TO_FRAME(pa);
+	KASSERT(frame < coremap_nframes);
+
+	/* The block is ours, so nobody else changes its entries. */
+	KASSERT(coremap[frame].cme_inuse);
+	KASSERT(coremap[frame].cme_kernel);
+	npages = coremap[frame].cme_npages;
+	KASSERT(npages > 0);
+
+	if (npages == 1) {
+		coremap_mag_put(frame);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	coremap_free_kernel(frame, npages);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the coremap entry for the kernel page KVADDR is on, or NULL
+ * if the coremap doesn't cover it.
+ */
+static
+struct coremap_entry *
+coremap_kpage(vaddr_t kvaddr)
+{
+	paddr_t pa;
+	unsigned frame;
+
+	KASSERT(kvaddr >= MIPS_KSEG0 && kvaddr < MIPS_KSEG1);
+	pa = kvaddr - MIPS_KSEG0;
+
+	if (!coremap_ready || pa < coremap_base) {
+		return NULL;
+	}
+	frame = PADDR_TO_FRAME(pa);
+	KASSERT(frame < coremap_nframes);
+	KASSERT(coremap[frame].cme_inuse);
+	KASSERT(coremap[frame].cme_kernel);
+	return &coremap[frame];
+}
+
+/*
+ * The block is the caller's, so nobody else changes these entries,
+ * and no lock is needed.
+ */
+bool
+coremap_set_pageref(vaddr_t kvaddr, struct pageref *pr)
+{
+	struct coremap_entry *cme;
+
+	cme = coremap_kpage(kvaddr);
+	if (cme == NULL) {
+		return false;
+	}
+	KASSERT(cme->cme_npages == 1);
+	cme->cme_pageref = pr;
+	return true;
+}
+
+bool
+coremap_get_pageref(vaddr_t kvaddr, struct pageref **ret)
+{
+	struct coremap_entry *cme;
+
+	cme = coremap_kpage(kvaddr);
+	if (cme == NULL) {
+		return false;
+	}
+	*ret = cme->cme_pageref;
+	return true;
+}
+
+/*
+ * Turn FRAME, which is in use (as a one-page kernel block, or just
+ * evicted), into a pinned user frame for page VA of AS.
+ */
+static
+void
+coremap_make_upage(unsigned frame, struct addrspace *as, vaddr_t va)
+{
+	spinlock_acquire(&coremap_lock);
+
+	KASSERT(coremap[frame].cme_inuse);
+	coremap[frame].cme_kernel = false;
+	coremap[frame].cme_pinned = true;
+	coremap[frame].cme_ref = true;
+	coremap[frame].cme_used = true;
+	coremap[frame].cme_cached = false;
+	coremap[frame].cme_merged = false;
+	coremap[frame].cme_as = as;
+	coremap[frame].cme_vaddr = va;
+	coremap[frame].cme_refcount = 1;
+	coremap_policy->vp_insert(frame, as, va);
+
+	spinlock_release(&coremap_lock);
+}
+
+paddr_t
+coremap_alloc_upage(struct addrspace *as, vaddr_t va)
+{
+	paddr_t pa;
+	int frame;
+
+	KASSERT(coremap_ready);
+	KASSERT((va & PAGE_FRAME) == va);
+
+	frame = coremap_mag_get();
+	if (frame < 0) {
+		/* Zeroed frames are free memory too; use them first. */
+		pa = zeropool_get();
+		if (pa != 0) {
+			frame = PADDR_TO_FRAME(pa);
+		}
+	}
+	if (frame < 0) {
+		frame = coremap_evict();
+		if (frame < 0) {
+			return 0;
+		}
+	}
+
+	coremap_make_upage(frame, as, va);
+	return FRAME_TO_PADDR(frame);
+}
+
+paddr_t
+coremap_try_kpage(void)
+{
+	int frame;
+
+	KASSERT(coremap_ready);
+
+	frame = coremap_mag_get();
+	if (frame < 0) {
+		return 0;
+	}
+	return FRAME_TO_PADDR(frame);
+}
+
+void
+coremap_adopt_kpage(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+	unsigned frame;
+
+	KASSERT((va & PAGE_FRAME) == va);
+	KASSERT(pa >= coremap_base);
+
+	frame = PADDR_TO_FRAME(pa);
+	KASSERT(frame < coremap_nframes);
+	KASSERT(coremap[frame].cme_kernel);
+	KASSERT(coremap[frame].cme_npages == 1);
+
+	coremap_make_upage(frame, as, va);
+}
+
+/*
+ * Look up the coremap entry for user frame PA.
+ */
+static
+struct coremap_entry *
+coremap_upage(paddr_t pa)
+{
+	unsigned frame;
+
+	KASSERT((pa & PAGE_FRAME) == pa);
+	KASSERT(pa >= coremap_base);
+
+	frame = PADDR_TO_FRAME(pa);
+	KASSERT(frame < coremap_nframes);
+	KASSERT(coremap[frame].cme_inuse);
+	KASSERT(!coremap[frame].cme_kernel);
+
+	return &coremap[frame];
+}
+
+void
+coremap_unpin(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = coremap_upage(pa);
+	KASSERT(cme->cme_pinned);
+	cme->cme_pinned = false;
+}
+
+void
+coremap_touch(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = coremap_upage(pa);
+	cme->cme_ref = true;
+	cme->cme_used = true;
+	coremap_policy->vp_touch(cme - coremap);
+}
+
+void
+coremap_drop_upage(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = coremap_upage(pa);
+	KASSERT(cme->cme_refcount > 0);
+
+	cme->cme_refcount--;
+	if (cme->cme_refcount == 0 && !cme->cme_busy) {
+		/* (if busy, coremap_evict cleans up) */
+		coremap_free_frame(cme - coremap);
+	}
+}
+
+void
+coremap_free_upage(paddr_t pa)
+{
+	spinlock_acquire(&coremap_lock);
+	coremap_drop_upage(pa);
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_share_upage(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = coremap_upage(pa);
+	KASSERT(cme->cme_refcount > 0);
+	KASSERT(!cme->cme_busy);
+
+	cme->cme_refcount++;
+	/* No single owner any more. */
+	cme->cme_as = NULL;
+}
+
+bool
+coremap_cow_claim(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = coremap_upage(pa);
+	KASSERT(cme->cme_refcount > 0);
+
+	if (cme->cme_refcount > 1) {
+		return false;
+	}
+	KASSERT(!cme->cme_cached);
+	cme->cme_as = as;
+	cme->cme_vaddr = va;
+	cme->cme_merged = false;
+	return true;
+}
+
+bool
+coremap_merged(paddr_t pa)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	return coremap_upage(pa)->cme_merged;
+}
+
+void
+coremap_cache_upage(paddr_t pa, struct pcpage *pp, bool pinned)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = coremap_upage(pa);
+	KASSERT(cme->cme_refcount == 1);
+	KASSERT(cme->cme_pinned);
+	KASSERT(!cme->cme_cached);
+
+	cme->cme_cached = true;
+	cme->cme_as = NULL;
+	cme->cme_cpage = pp;
+	cme->cme_pinned = pinned;
+}
+
+void
+coremap_uncache_upage(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = coremap_upage(pa);
+	KASSERT(cme->cme_cached);
+
+	cme->cme_cached = false;
+	cme->cme_pinned = false;
+	cme->cme_vaddr = 0;
+	coremap_drop_upage(pa);
+}
+
+/*
+ * Same-page merging (see pagemerge.h).
+ *
+ * A page is compared with others while frozen the way coremap_evict
+ * freezes a page it is writing out: PTE_BUSY is set, so faults on it
+ * wait, and it is shot down from the TLBs, so nobody can change it.
+ * If its address space goes away meanwhile, its reference count drops
+ * to zero and the frame is left to us, as it is to the evictor.
+ */
+
+/*
+ * Can frame CUR be merged? Only user frames with a single owner that
+ * nobody is evicting or holding pinned.
+ */
+static
+bool
+coremap_mergeable(unsigned cur)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = &coremap[cur];
+	return cme->cme_inuse && !cme->cme_kernel && !cme->cme_pinned &&
+		!cme->cme_busy && !cme->cme_cached && cme->cme_as != NULL;
+}
+
+/*
+ * Freeze frame CUR, which is mergeable. Called with the coremap lock
+ * held; returns without it.
+ */
+static
+void
+coremap_freeze(unsigned cur)
+{
+	struct coremap_entry *cme;
+	struct addrspace *as;
+	vaddr_t va;
+	pte_t *pte;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = &coremap[cur];
+	KASSERT(cme->cme_refcount == 1);
+	as = cme->cme_as;
+	va = cme->cme_vaddr;
+
+	pte = pt_lookup(as->as_pt, va, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & (PTE_VALID | PTE_FRAME)) ==
+		(PTE_VALID | FRAME_TO_PADDR(cur)));
+
+	cme->cme_busy = true;
+	*pte = (*pte & ~(PTE_VALID | PTE_WRITE)) | PTE_BUSY;
+	spinlock_release(&coremap_lock);
+
+	vm_tlb_shootdown_page(as, va);
+}
+
+/*
+ * Finish with frozen frame CUR: if its owner is gone, free it and
+ * return NULL; otherwise return its page table entry, with PTE_BUSY
+ * cleared and PTE_VALID set again. Wakes up anyone waiting for it.
+ */
+static
+pte_t *
+coremap_thaw(unsigned cur)
+{
+	struct coremap_entry *cme;
+	pte_t *pte;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	cme = &coremap[cur];
+	KASSERT(cme->cme_busy);
+	cme->cme_busy = false;
+	wchan_wakeall(coremap_wchan);
+
+	if (cme->cme_refcount == 0) {
+		coremap_free_frame(cur);
+		return NULL;
+	}
+	pte = pt_lookup(cme->cme_as->as_pt, cme->cme_vaddr, false);
+	KASSERT(pte != NULL && (*pte & PTE_BUSY));
+	*pte = (*pte & ~PTE_BUSY) | PTE_VALID;
+	return pte;
+}
+
+paddr_t
+coremap_merge_next(unsigned *cursor, unsigned *count,
+		   struct addrspace **as, vaddr_t *va)
+{
+	unsigned i, cur;
+
+	spinlock_acquire(&coremap_lock);
+	for (i=0; i<*count; i++) {
+		cur = *cursor % coremap_nframes;
+		*cursor = (cur + 1) % coremap_nframes;
+		if (coremap_mergeable(cur)) {
+			*count = i + 1;
+			*as = coremap[cur].cme_as;
+			*va = coremap[cur].cme_vaddr;
+			spinlock_release(&coremap_lock);
+			return FRAME_TO_PADDR(cur);
+		}
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+bool
+coremap_merge_freeze(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+	unsigned cur;
+
+	cur = PADDR_TO_FRAME(pa);
+	KASSERT(cur < coremap_nframes);
+
+	spinlock_acquire(&coremap_lock);
+	if (!coremap_mergeable(cur) || coremap[cur].cme_as != as ||
+	    coremap[cur].cme_vaddr != va) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	coremap_freeze(cur);
+	return true;
+}
+
+bool
+coremap_merge_getref(paddr_t pa)
+{
+	struct coremap_entry *cme;
+	unsigned cur;
+	bool ok;
+
+	cur = PADDR_TO_FRAME(pa);
+	KASSERT(cur < coremap_nframes);
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[cur];
+	ok = cme->cme_inuse && !cme->cme_kernel && !cme->cme_pinned &&
+		!cme->cme_busy && !cme->cme_cached && cme->cme_as == NULL &&
+		cme->cme_refcount > 0;
+	if (ok) {
+		coremap_share_upage(pa);
+	}
+	spinlock_release(&coremap_lock);
+	return ok;
+}
+
+void
+coremap_merge_thaw(paddr_t pa)
+{
+	spinlock_acquire(&coremap_lock);
+	coremap_thaw(PADDR_TO_FRAME(pa));
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_merge_share(paddr_t pa)
+{
+	struct coremap_entry *cme;
+	pte_t *pte;
+
+	spinlock_acquire(&coremap_lock);
+	pte = coremap_thaw(PADDR_TO_FRAME(pa));
+	if (pte == NULL) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	*pte |= PTE_COW;
+	cme = coremap_upage(pa);
+	cme->cme_merged = true;
+	coremap_share_upage(pa);
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+void
+coremap_merge_commit(paddr_t pa, paddr_t target)
+{
+	struct coremap_entry *cme;
+	unsigned cur;
+	pte_t *pte;
+
+	cur = PADDR_TO_FRAME(pa);
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[cur];
+	KASSERT(cme->cme_busy);
+	if (cme->cme_refcount == 0) {
+		/* The owner went away; nothing to merge after all. */
+		coremap_drop_upage(target);
+		coremap_thaw(cur);
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	/* Still frozen, so no TLB has the old frame. */
+	pte = coremap_thaw(cur);
+	*pte = target | PTE_VALID | PTE_COW | (*pte & (PTE_DIRTY | PTE_UNREF));
+	coremap_upage(target)->cme_merged = true;
+	cme->cme_refcount = 0;
+	coremap_free_frame(cur);
+	spinlock_release(&coremap_lock);
+
+	vmstats_inc(VMSTAT_MERGE_SHARE);
+}
+
+/*
+ * Evict a run of pages as coremap_evict_cluster does, and free their
+ * frames. Returns how many there were.
+ */
+static
+unsigned
+coremap_evict_free(struct addrspace *owner, unsigned *cursor)
+{
+	unsigned frames[SWAP_MAXCLUSTER];
+	unsigned i, n;
+
+	KASSERT(coremap_ready);
+
+	n = coremap_evict_cluster(frames, SWAP_MAXCLUSTER, owner, cursor);
+
+	spinlock_acquire(&coremap_lock);
+	for (i=0; i<n; i++) {
+		coremap_free_frame(frames[i]);
+	}
+	spinlock_release(&coremap_lock);
+
+	return n;
+}
+
+unsigned
+coremap_reclaim(void)
+{
+	unsigned n;
+
+	n = coremap_evict_free(NULL, NULL);
+	vmstats_add(VMSTAT_PAGEOUT_EVICT, n);
+	return n;
+}
+
+unsigned
+coremap_swapout(struct addrspace *as, unsigned *cursor)
+{
+	unsigned n;
+
+	KASSERT(as != NULL);
+
+	n = coremap_evict_free(as, cursor);
+	vmstats_add(VMSTAT_LOADCTL_SWAPOUT, n);
+	return n;
+}
+
+/*
+ * Frames are only put under a new policy with nothing being evicted,
+ * so that none is left out.
+ */
+void
+coremap_setpolicy(const struct vmpolicy *vp)
+{
+	struct coremap_entry *cme;
+	unsigned i;
+
+	spinlock_acquire(&coremap_lock);
+	i = 0;
+	while (i < coremap_nframes) {
+		if (coremap[i].cme_busy) {
+			coremap_wait_evict();
+			/* Start over; anything may have happened. */
+			i = 0;
+			continue;
+		}
+		i++;
+	}
+
+	coremap_policy = vp;
+	vp->vp_reset();
+	for (i=0; i<coremap_nframes; i++) {
+		cme = &coremap[i];
+		if (!cme->cme_inuse || cme->cme_kernel ||
+		    cme->cme_refcount == 0) {
+			/* (including frames just evicted) */
+			continue;
+		}
+		if (cme->cme_cached) {
+			vp->vp_insert(i, NULL, 0);
+		}
+		else {
+			vp->vp_insert(i, cme->cme_as, cme->cme_vaddr);
+		}
+	}
+	spinlock_release(&coremap_lock);
+}
+
+const struct vmpolicy *
+coremap_getpolicy(void)
+{
+	return coremap_policy;
+}
+
+unsigned
+coremap_pstate(unsigned frame)
+{
+	struct coremap_entry *cme;
+	unsigned state;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(frame < coremap_nframes);
+
+	cme = &coremap[frame];
+	if (!cme->cme_inuse || cme->cme_kernel || cme->cme_pinned ||
+	    cme->cme_busy) {
+		return 0;
+	}
+	if (cme->cme_cached) {
+		/* Only the cache's own reference left? Then it's clean. */
+		if (cme->cme_refcount > 1) {
+			return 0;
+		}
+		state = COREMAP_EVICTABLE;
+	}
+	else if (cme->cme_as == NULL) {
+		return 0;
+	}
+	else {
+		state = COREMAP_EVICTABLE;
+		if (*coremap_owner_pte(frame) & PTE_DIRTY) {
+			state |= COREMAP_DIRTY;
+		}
+	}
+	if (cme->cme_ref) {
+		state |= COREMAP_REF;
+	}
+	return state;
+}
+
+/*
+ * Note that page VA of AS has been given PTE_UNREF, and must be shot
+ * down from other CPUs' TLBs. Returns false if there is no room to
+ * note it; then the caller must leave the page as it was.
+ */
+static
+bool
+coremap_unref_note(struct addrspace *as, vaddr_t va)
+{
+	struct coremap_unref *cu;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (i=0; i<coremap_nunref; i++) {
+		cu = &coremap_unref[i];
+		if (cu->cu_as == as) {
+			if (va < cu->cu_lo) {
+				cu->cu_lo = va;
+			}
+			if (va > cu->cu_hi) {
+				cu->cu_hi = va;
+			}
+			return true;
+		}
+	}
+	if (coremap_nunref == COREMAP_UNREF_MAX) {
+		return false;
+	}
+	cu = &coremap_unref[coremap_nunref++];
+	cu->cu_as = as;
+	cu->cu_lo = cu->cu_hi = va;
+	return true;
+}
+
+/*
+ * Shoot down the pages noted by coremap_unref_note. Called without
+ * the coremap lock, after a scan that may have noted some.
+ */
+static
+void
+coremap_unref_flush(void)
+{
+	struct coremap_unref batch[COREMAP_UNREF_MAX];
+	unsigned i, n;
+
+	spinlock_acquire(&coremap_lock);
+	n = coremap_nunref;
+	for (i=0; i<n; i++) {
+		batch[i] = coremap_unref[i];
+	}
+	coremap_nunref = 0;
+	spinlock_release(&coremap_lock);
+
+	/* Ranges too long for single pages become whole-TLB flushes. */
+	for (i=0; i<n; i++) {
+		vm_tlb_shootdown(batch[i].cu_as, batch[i].cu_lo,
+			(batch[i].cu_hi - batch[i].cu_lo) / PAGE_SIZE + 1);
+	}
+}
+
+void
+coremap_clearref(unsigned frame)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(coremap_pstate(frame) & COREMAP_EVICTABLE);
+
+	cme = &coremap[frame];
+	if (!cme->cme_cached) {
+		if (!coremap_unref_note(cme->cme_as, cme->cme_vaddr)) {
+			/* Keep its second chance until the next scan. */
+			return;
+		}
+		*coremap_owner_pte(frame) |= PTE_UNREF;
+		vm_tlb_invalidate(cme->cme_as, cme->cme_vaddr);
+	}
+	cme->cme_ref = false;
+}
+
+unsigned
+coremap_wssample(void)
+{
+	struct coremap_entry *cme;
+	struct addrspace *as;
+	unsigned i, user;
+
+	spinlock_acquire(&coremap_lock);
+	user = 0;
+	for (i=0; i<coremap_nframes; i++) {
+		cme = &coremap[i];
+		if (!cme->cme_inuse || cme->cme_kernel) {
+			continue;
+		}
+		user++;
+		if (cme->cme_cached || cme->cme_as == NULL) {
+			/* (shared; nobody in particular is using it) */
+			continue;
+		}
+		if (cme->cme_busy || cme->cme_refcount == 0) {
+			/*
+			 * On its way out, and its owner may already
+			 * have let it go (coremap_drop_upage) and been
+			 * destroyed, so don't touch it.
+			 */
+			continue;
+		}
+		as = cme->cme_as;
+		as->as_lc.lc_rss++;
+		if (!cme->cme_used) {
+			continue;
+		}
+		as->as_lc.lc_used++;
+		if (cme->cme_pinned) {
+			/* Not in the page table yet. */
+			continue;
+		}
+		if (!coremap_unref_note(as, cme->cme_vaddr)) {
+			/*
+			 * Shoot down what we have so far, then look at
+			 * this frame again: without the lock, anything
+			 * may have happened to it, or to AS.
+			 */
+			user--;
+			as->as_lc.lc_rss--;
+			as->as_lc.lc_used--;
+			spinlock_release(&coremap_lock);
+			coremap_unref_flush();
+			spinlock_acquire(&coremap_lock);
+			i--;
+			continue;
+		}
+		cme->cme_used = false;
+		*coremap_owner_pte(i) |= PTE_UNREF;
+		vm_tlb_invalidate(as, cme->cme_vaddr);
+	}
+	spinlock_release(&coremap_lock);
+	coremap_unref_flush();
+
+	return user + coremap_freepages();
+}
+
+unsigned
+coremap_freepages(void)
+{
+	return coremap_nframes - coremap_usedpages() + zeropool_available();
+}
+
+unsigned
+coremap_usedpages(void)
+{
+	unsigned i, cached;
+
+	/* Frames in magazines are free, but not on the free lists. */
+	cached = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		cached += coremap_mags[i].cm_count;
+	}
+	return coremap_nused - cached;
+}
+
+unsigned
+coremap_totalpages(void)
+{
+	return coremap_nframes;
+}
+
+void
+coremap_printstats(void)
+{
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (coremap_mags[i].cm_hits + coremap_mags[i].cm_misses == 0) {
+			continue;
+		}
+		kprintf("cpu%u: frame cache: %u hits, %u misses, %u frames\n",
+			i, coremap_mags[i].cm_hits, coremap_mags[i].cm_misses,
+			coremap_mags[i].cm_count);
+	}
+}
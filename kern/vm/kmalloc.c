@@ -30,7 +30,19 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <current.h>
+#include <cpu.h>
 #include <vm.h>
+#include <objcache.h>
+#include <arena.h>
+#include "opt-dumbvm.h"
+#include "opt-kmprof.h"
+#if !OPT_DUMBVM
+#include <coremap.h>
+#endif
+#if OPT_KMPROF
+#include <kmprof.h>
+#endif
 
 /*
  * Kernel malloc.
@@ -51,29 +63,52 @@ fill_deadbeef(void *vptr, size_t len)
 
 ////////////////////////////////////////////////////////////
 //
-// Pool-based subpage allocator.
+// Object caches (see objcache.h), and the subpage allocator made
+// of them.
 //
 // It works like this:
 //
-//    We allocate one page at a time and fill it with objects of size k,
-//    for various k. Each page has its own freelist, maintained by a
-//    linked list in the first word of each object. Each page also has a
-//    freecount, so we know when the page is completely free and can 
+//    Each cache allocates one page at a time and fills it with its
+//    objects. Each page has its own freelist, maintained by a linked
+//    list kept in each free object: in its first word, or, if the
+//    cache has a constructor, in a word after the object so as not to
+//    disturb what the constructor set up. Each page also has a
+//    freecount, so we know when the page is completely free and can
 //    release it.
 //
-//    No assumptions are made about the sizes k; they need not be
-//    powers of two. Note, however, that malloc must always return
-//    pointers aligned to the maximum alignment requirements of the
-//    platform; thus block sizes must at least be multiples of 4,
-//    preferably 8. They must also be at least sizeof(struct
-//    freelist). It is only worth defining an additional block size if
-//    more blocks would fit on a page than with the existing block
-//    sizes, and large numbers of items of the new size are allocated.
+//    Objects are rounded up to a multiple of OBJCACHE_ALIGN, since
+//    malloc must always return pointers aligned to the maximum
+//    alignment requirements of the platform, but no further; a page
+//    holds as many as fit.
+//
+//    In front of the pages sits a magazine of free objects per CPU
+//    and cache. Allocations and frees go to the magazine, which only
+//    goes to the pages (under the cache's lock) to be refilled or
+//    emptied, half a magazine at a time. The magazines themselves come
+//    from a cache of their own, which has none.
+//
+//    kmalloc has one cache for each of its block sizes. It is only
+//    worth defining an additional block size if more blocks would fit
+//    on a page than with the existing block sizes, and large numbers
+//    of items of the new size are allocated; for those, though, an
+//    object cache of their own is usually better.
+//
+//    The free counts and addresses of the pages are kept in pagerefs,
+//    which are objects of a cache of their own. A page of pagerefs
+//    keeps its own pageref in its first slot, so growing that cache
+//    doesn't need another pageref. Each cache keeps its pages on two
+//    lists, those with free objects and those without, so allocating
+//    never looks at full pages.
+//
+//    To find the pageref of the page an object is on, kfree asks the
+//    coremap, which keeps a pointer to it in the page's entry. Pages
+//    the coremap can't tell us about (all of them under dumbvm, and
+//    those stolen at boot before there was a coremap) are on another
+//    list, which is searched.
 //
-//    The free counts and addresses of the pages are maintained in
-//    another list.  Maintaining this table is a nuisance, because it
-//    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    Objects too big for the caches, up to ARENA_MAXSIZE, come from
+//    the arena (arena.h); bigger ones are whole pages from
+//    alloc_kpages.
 //
 
 #undef  SLOW	/* consistency checks */
@@ -84,9 +119,7 @@ fill_deadbeef(void *vptr, size_t len)
 #if PAGE_SIZE == 4096
 
 #define NSIZES 8
-static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 
-#define SMALLEST_SUBPAGE_SIZE 16
 #define LARGEST_SUBPAGE_SIZE 2048
 
 #elif PAGE_SIZE == 8192
@@ -95,104 +128,71 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #error "Odd page size"
 #endif
 
+static struct objcache kmalloc_caches[NSIZES] = {
+	OBJCACHE_INITIALIZER("kmalloc-16", 16, NULL),
+	OBJCACHE_INITIALIZER("kmalloc-32", 32, NULL),
+	OBJCACHE_INITIALIZER("kmalloc-64", 64, NULL),
+	OBJCACHE_INITIALIZER("kmalloc-128", 128, NULL),
+	OBJCACHE_INITIALIZER("kmalloc-256", 256, NULL),
+	OBJCACHE_INITIALIZER("kmalloc-512", 512, NULL),
+	OBJCACHE_INITIALIZER("kmalloc-1024", 1024, NULL),
+	OBJCACHE_INITIALIZER("kmalloc-2048", 2048, NULL),
+};
+
 ////////////////////////////////////////
 
+/*
+ * Kept in each free object, at the cache's oc_linkoff: the address of
+ * the next free object on the page, or 0.
+ */
 struct freelist {
-	struct freelist *next;
+	vaddr_t next;
 };
 
 struct pageref {
-	struct pageref *next_samesize;
-	struct pageref *next_all;
-	vaddr_t pageaddr_and_blocktype;
+	struct pageref *next_samecache;
+	struct pageref *prev_samecache;
+	struct pageref *next_other;	/* on otherpages */
+	vaddr_t pageaddr;
+	struct objcache *cache;
 	uint16_t freelist_offset;
 	uint16_t nfree;
 };
 
 #define INVALID_OFFSET   (0xffff)
 
-#define PR_PAGEADDR(pr)  ((pr)->pageaddr_and_blocktype & PAGE_FRAME)
-#define PR_BLOCKTYPE(pr) ((pr)->pageaddr_and_blocktype & ~PAGE_FRAME)
-#define MKPAB(pa, blk)   (((pa)&PAGE_FRAME) | ((blk) & ~PAGE_FRAME))
-
-////////////////////////////////////////
-
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * A per-CPU magazine of free objects. om_objs[0] is the one that has
+ * been there longest.
  */
+struct objcache_mag {
+	struct spinlock om_lock;
+	unsigned om_count;
+	void *om_objs[OBJCACHE_MAGSIZE];
+};
 
-#define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
-
-#define INUSE_WORDS (NPAGEREFS/32)
-static uint32_t pagerefs_inuse[INUSE_WORDS];
-
-static
-struct pageref *
-allocpageref(void)
-{
-	unsigned i,j;
-	uint32_t k;
-
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
-		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
-		}
-		KASSERT(0);
-	}
+static struct objcache objcache_magcache =
+	OBJCACHE_INITIALIZER("objcache-mag", sizeof(struct objcache_mag), NULL);
 
-	/* ran out */
-	return NULL;
-}
+static struct objcache pageref_cache =
+	OBJCACHE_INITIALIZER("pageref", sizeof(struct pageref), NULL);
 
-static
-void
-freepageref(struct pageref *p)
-{
-	size_t i, j;
-	uint32_t k;
-
-	j = p-pagerefs;
-	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((uint32_t)1) << (j%32);
-	KASSERT((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
-}
+/* Objects on a page of OC, not counting a page of pagerefs' own. */
+#define PAGE_NOBJS(oc) ((oc)->oc_perpage - ((oc) == &pageref_cache))
 
 ////////////////////////////////////////
 
-static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+static struct pageref *otherpages;
+static struct objcache *allcaches;
 
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * kmalloc_spinlock protects otherpages and the list of all caches.
+ * Each cache's oc_lock protects its own lists of pages and their free
+ * lists and counts, and may be taken while holding kmalloc_spinlock
+ * but not the other way around. Magazine locks are never held while
+ * taking either.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -211,33 +211,29 @@ static
 void
 checksubpage(struct pageref *pr)
 {
+	struct objcache *oc = pr->cache;
 	vaddr_t prpage, fla;
 	struct freelist *fl;
-	int blktype;
-	int nfree=0;
+	unsigned nfree=0;
 
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(spinlock_do_i_hold(&oc->oc_lock));
 
 	if (pr->freelist_offset == INVALID_OFFSET) {
 		KASSERT(pr->nfree==0);
 		return;
 	}
 
-	prpage = PR_PAGEADDR(pr);
-	blktype = PR_BLOCKTYPE(pr);
+	prpage = pr->pageaddr;
 
 	KASSERT(pr->freelist_offset < PAGE_SIZE);
-	KASSERT(pr->freelist_offset % sizes[blktype] == 0);
+	KASSERT(pr->freelist_offset % oc->oc_objsize == 0);
 
-	fla = prpage + pr->freelist_offset;
-	fl = (struct freelist *)fla;
-
-	for (; fl != NULL; fl = fl->next) {
-		fla = (vaddr_t)fl;
+	for (fla = prpage + pr->freelist_offset; fla != 0; fla = fl->next) {
 		KASSERT(fla >= prpage && fla < prpage + PAGE_SIZE);
-		KASSERT((fla-prpage) % sizes[blktype] == 0);
+		KASSERT((fla-prpage) % oc->oc_objsize == 0);
 		KASSERT(fla >= MIPS_KSEG0);
 		KASSERT(fla < MIPS_KSEG1);
+		fl = (struct freelist *)(fla + oc->oc_linkoff);
 		nfree++;
 	}
 	KASSERT(nfree==pr->nfree);
@@ -249,32 +245,38 @@ checksubpage(struct pageref *pr)
 #ifdef SLOWER
 static
 void
-checksubpages(void)
+checkcache(struct objcache *oc)
 {
-	struct pageref *pr;
-	int i;
-	unsigned sc=0, ac=0;
+	struct pageref *pr, *prev;
+	unsigned np=0, nf=0;
 
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(spinlock_do_i_hold(&oc->oc_lock));
 
-	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
-			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
-			sc++;
-		}
+	prev = NULL;
+	for (pr = oc->oc_partial; pr != NULL; pr = pr->next_samecache) {
+		KASSERT(pr->cache == oc);
+		KASSERT(pr->prev_samecache == prev);
+		KASSERT(pr->nfree > 0);
+		checksubpage(pr);
+		np++;
+		nf += pr->nfree;
+		prev = pr;
 	}
-
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+	prev = NULL;
+	for (pr = oc->oc_full; pr != NULL; pr = pr->next_samecache) {
+		KASSERT(pr->cache == oc);
+		KASSERT(pr->prev_samecache == prev);
+		KASSERT(pr->nfree == 0);
 		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
-		ac++;
+		np++;
+		prev = pr;
 	}
 
-	KASSERT(sc==ac);
+	KASSERT(np==oc->oc_npages);
+	KASSERT(nf==oc->oc_nfree);
 }
 #else
-#define checksubpages() 
+#define checkcache(oc) ((void)(oc))
 #endif
 
 ////////////////////////////////////////
@@ -283,41 +285,38 @@ static
 void
 dumpsubpage(struct pageref *pr)
 {
+	struct objcache *oc = pr->cache;
 	vaddr_t prpage, fla;
 	struct freelist *fl;
-	int blktype;
 	unsigned i, n, index;
-	uint32_t freemap[PAGE_SIZE / (SMALLEST_SUBPAGE_SIZE*32)];
+	uint32_t freemap[PAGE_SIZE / (OBJCACHE_ALIGN*32)];
 
 	checksubpage(pr);
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(spinlock_do_i_hold(&oc->oc_lock));
 
 	/* clear freemap[] */
 	for (i=0; i<sizeof(freemap)/sizeof(freemap[0]); i++) {
 		freemap[i] = 0;
 	}
 
-	prpage = PR_PAGEADDR(pr);
-	blktype = PR_BLOCKTYPE(pr);
+	prpage = pr->pageaddr;
 
 	/* compute how many bits we need in freemap and assert we fit */
-	n = PAGE_SIZE / sizes[blktype];
+	n = oc->oc_perpage;
 	KASSERT(n <= 32*sizeof(freemap)/sizeof(freemap[0]));
 
 	if (pr->freelist_offset != INVALID_OFFSET) {
 		fla = prpage + pr->freelist_offset;
-		fl = (struct freelist *)fla;
-
-		for (; fl != NULL; fl = fl->next) {
-			fla = (vaddr_t)fl;
-			index = (fla-prpage) / sizes[blktype];
+		for (; fla != 0; fla = fl->next) {
+			index = (fla-prpage) / oc->oc_objsize;
 			KASSERT(index<n);
 			freemap[index/32] |= (1<<(index%32));
+			fl = (struct freelist *)(fla + oc->oc_linkoff);
 		}
 	}
 
-	kprintf("at 0x%08lx: size %-4lu  %u/%u free\n", 
-		(unsigned long)prpage, (unsigned long) sizes[blktype],
+	kprintf("at 0x%08lx: size %-4lu  %u/%u free\n",
+		(unsigned long)prpage, (unsigned long) oc->oc_objsize,
 		(unsigned) pr->nfree, n);
 	kprintf("   ");
 	for (i=0; i<n; i++) {
@@ -333,281 +332,725 @@ dumpsubpage(struct pageref *pr)
 void
 kheap_printstats(void)
 {
+	struct objcache *oc;
 	struct pageref *pr;
+	unsigned i, inmags;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		dumpsubpage(pr);
+	for (oc = allcaches; oc != NULL; oc = oc->oc_next) {
+		/* (magazine counts are only a snapshot) */
+		inmags = 0;
+		for (i=0; i<MAXCPUS; i++) {
+			if (oc->oc_mags[i] != NULL) {
+				inmags += oc->oc_mags[i]->om_count;
+			}
+		}
+
+		spinlock_acquire(&oc->oc_lock);
+		checkcache(oc);
+		kprintf("%s: size %lu, %u pages, %u/%u free, "
+			"%u in magazines\n", oc->oc_name,
+			(unsigned long) oc->oc_size, oc->oc_npages,
+			oc->oc_nfree, oc->oc_npages * oc->oc_perpage, inmags);
+		for (pr = oc->oc_partial; pr != NULL; pr = pr->next_samecache) {
+			dumpsubpage(pr);
+		}
+		for (pr = oc->oc_full; pr != NULL; pr = pr->next_samecache) {
+			dumpsubpage(pr);
+		}
+		spinlock_release(&oc->oc_lock);
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	arena_printstats();
 }
 
 ////////////////////////////////////////
 
+/*
+ * Work out how OC's objects go on a page, and put it on the list of
+ * caches, unless that has been done already.
+ */
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+objcache_setup(struct objcache *oc)
 {
-	struct pageref **guy;
+	size_t size;
 
-	KASSERT(blktype>=0 && blktype<NSIZES);
-
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
+	spinlock_acquire(&kmalloc_spinlock);
+	if (!oc->oc_ready) {
+		size = oc->oc_size;
+		if (size < sizeof(struct freelist)) {
+			size = sizeof(struct freelist);
 		}
-	}
-
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
+		if (oc->oc_ctor != NULL) {
+			oc->oc_linkoff = ROUNDUP(size, sizeof(struct freelist));
+			size = oc->oc_linkoff + sizeof(struct freelist);
+		}
+		else {
+			oc->oc_linkoff = 0;
 		}
+		oc->oc_objsize = ROUNDUP(size, OBJCACHE_ALIGN);
+		KASSERT(oc->oc_objsize <= PAGE_SIZE);
+		oc->oc_perpage = PAGE_SIZE / oc->oc_objsize;
+
+		oc->oc_next = allcaches;
+		allcaches = oc;
+		oc->oc_ready = true;
 	}
+	spinlock_release(&kmalloc_spinlock);
 }
 
+/*
+ * Take the first free object off page PR.
+ */
 static
-inline
-int blocktype(size_t sz)
+void *
+page_getobj(struct pageref *pr)
 {
-	unsigned i;
-	for (i=0; i<NSIZES; i++) {
-		if (sz <= sizes[i]) {
-			return i;
-		}
-	}
+	struct objcache *oc = pr->cache;
+	vaddr_t prpage, fla;
+	struct freelist *fl;
 
-	panic("Subpage allocator cannot handle allocation of size %lu\n", 
-	      (unsigned long)sz);
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	prpage = pr->pageaddr;
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)(fla + oc->oc_linkoff);
 
-	// keep compiler happy
-	return 0;
+	pr->nfree--;
+	if (fl->next != 0) {
+		KASSERT(pr->nfree > 0);
+		KASSERT(fl->next - prpage < PAGE_SIZE);
+		pr->freelist_offset = fl->next - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+	return (void *)fla;
 }
 
+/*
+ * Put object PTR back on page PR.
+ */
 static
-void *
-subpage_kmalloc(size_t sz)
+void
+page_putobj(struct pageref *pr, void *ptr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
-	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
-	void *retptr;		// our result
-
-	volatile int i;
-
+	struct objcache *oc = pr->cache;
+	vaddr_t prpage, offset;
+	struct freelist *fl;
 
-	blktype = blocktype(sz);
-	sz = sizes[blktype];
+	prpage = pr->pageaddr;
+	offset = (vaddr_t)ptr - prpage;
 
-	spinlock_acquire(&kmalloc_spinlock);
+	/* Check for proper positioning and alignment */
+	if (offset >= PAGE_SIZE || offset % oc->oc_objsize != 0 ||
+	    offset / oc->oc_objsize >= oc->oc_perpage) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
 
-	checksubpages();
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	fl = (struct freelist *)((vaddr_t)ptr + oc->oc_linkoff);
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = 0;
+	} else {
+		fl->next = prpage + pr->freelist_offset;
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+	KASSERT(pr->nfree <= oc->oc_perpage);
+}
 
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
+static unsigned objcache_getobjs(struct objcache *oc, void **objs,
+				 unsigned n);
+static void objcache_putobjs(struct objcache *oc, void **objs, unsigned n);
 
-		if (pr->nfree > 0) {
+/*
+ * Remember PR as the pageref of its page.
+ */
+static
+void
+pageref_record(struct pageref *pr)
+{
+#if !OPT_DUMBVM
+	if (coremap_set_pageref(pr->pageaddr, pr)) {
+		return;
+	}
+#endif
+	spinlock_acquire(&kmalloc_spinlock);
+	pr->next_other = otherpages;
+	otherpages = pr;
+	spinlock_release(&kmalloc_spinlock);
+}
 
-		doalloc: /* comes here after getting a whole fresh page */
+/*
+ * Forget PR, whose page is about to be given back.
+ */
+static
+void
+pageref_forget(struct pageref *pr)
+{
+	struct pageref **guy;
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+#if !OPT_DUMBVM
+	if (coremap_set_pageref(pr->pageaddr, NULL)) {
+		return;
+	}
+#endif
+	spinlock_acquire(&kmalloc_spinlock);
+	for (guy = &otherpages; *guy != pr; guy = &(*guy)->next_other) {
+		KASSERT(*guy != NULL);
+	}
+	*guy = pr->next_other;
+	spinlock_release(&kmalloc_spinlock);
+}
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+/*
+ * Return the pageref of the page ADDR is on, or NULL if it isn't a
+ * page of objects.
+ */
+static
+struct pageref *
+pageref_find(vaddr_t addr)
+{
+	struct pageref *pr;
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+#if !OPT_DUMBVM
+	if (coremap_get_pageref(addr, &pr)) {
+		return pr;
+	}
+#endif
+	spinlock_acquire(&kmalloc_spinlock);
+	for (pr = otherpages; pr != NULL; pr = pr->next_other) {
+		if (addr >= pr->pageaddr && addr < pr->pageaddr + PAGE_SIZE) {
+			break;
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+	return pr;
+}
 
-			checksubpages();
+/*
+ * Move PR to the front of page list *TO of its cache, from *FROM (or
+ * from nowhere if FROM is NULL).
+ */
+static
+void
+page_move(struct pageref *pr, struct pageref **from, struct pageref **to)
+{
+	KASSERT(spinlock_do_i_hold(&pr->cache->oc_lock));
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
+	if (from != NULL) {
+		if (pr->prev_samecache != NULL) {
+			pr->prev_samecache->next_samecache = pr->next_samecache;
+		}
+		else {
+			KASSERT(*from == pr);
+			*from = pr->next_samecache;
+		}
+		if (pr->next_samecache != NULL) {
+			pr->next_samecache->prev_samecache = pr->prev_samecache;
 		}
 	}
+	if (to != NULL) {
+		pr->prev_samecache = NULL;
+		pr->next_samecache = *to;
+		if (*to != NULL) {
+			(*to)->prev_samecache = pr;
+		}
+		*to = pr;
+	}
+}
 
-	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 *
-	 * We release the spinlock while calling alloc_kpages. This
-	 * avoids deadlock if alloc_kpages needs to come back here.
-	 * Note that this means things can change behind our back...
-	 */
+/*
+ * Get a fresh page for OC and fill it with free (and constructed)
+ * objects. The page is not yet on OC's lists. Call with no locks
+ * held.
+ */
+static
+struct pageref *
+objcache_grow(struct objcache *oc)
+{
+	struct pageref *pr;
+	vaddr_t prpage, fla;
+	struct freelist *volatile fl;
+	unsigned i, first;
+	void *ptr;
 
-	spinlock_release(&kmalloc_spinlock);
 	prpage = alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
-		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
+		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
 		return NULL;
 	}
-	spinlock_acquire(&kmalloc_spinlock);
 
-	pr = allocpageref();
-	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
-		return NULL;
+	if (oc == &pageref_cache) {
+		/* A page of pagerefs is its own first pageref. */
+		pr = (struct pageref *)prpage;
+		first = 1;
+	}
+	else {
+		if (objcache_getobjs(&pageref_cache, &ptr, 1) == 0) {
+			/* Couldn't allocate accounting space for the page. */
+			free_kpages(prpage);
+			kprintf("kmalloc: Subpage allocator couldn't get "
+				"pageref\n");
+			return NULL;
+		}
+		pr = ptr;
+		first = 0;
 	}
 
-	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
-	pr->nfree = PAGE_SIZE / sizes[blktype];
+	pr->pageaddr = prpage;
+	pr->cache = oc;
 
 	/*
+	 * No one else can see the page yet, so build its free list, with
+	 * the first object first, and run the constructor, without locks.
+	 *
 	 * Note: fl is volatile because the MIPS toolchain we were
 	 * using in spring 2001 attempted to optimize this loop and
 	 * blew it. Making fl volatile inhibits the optimization.
 	 */
+	for (i=first; i<oc->oc_perpage; i++) {
+		fla = prpage + i*oc->oc_objsize;
+		if (oc->oc_ctor != NULL) {
+			oc->oc_ctor((void *)fla);
+		}
+		fl = (struct freelist *)(fla + oc->oc_linkoff);
+		fl->next = i+1 < oc->oc_perpage ? fla + oc->oc_objsize : 0;
+	}
+	pr->freelist_offset = first * oc->oc_objsize;
+	pr->nfree = oc->oc_perpage - first;
+	KASSERT(pr->nfree == PAGE_NOBJS(oc));
+
+	pageref_record(pr);
+	return pr;
+}
+
+/*
+ * Give back page PR, once it is off its cache's lists.
+ */
+static
+void
+objcache_shrink(struct pageref *pr)
+{
+	vaddr_t prpage;
+	void *ptr;
+
+	pageref_forget(pr);
+
+	prpage = pr->pageaddr;
+	if (pr->cache != &pageref_cache) {
+		ptr = pr;
+		objcache_putobjs(&pageref_cache, &ptr, 1);
+	}
+
+	/* Call free_kpages without any spinlocks. */
+	free_kpages(prpage);
+}
+
+/*
+ * Take up to N free objects off OC's pages, into OBJS. Adds a page if
+ * there are none. Returns how many it got, which is 0 only if out of
+ * memory.
+ */
+static
+unsigned
+objcache_getobjs(struct objcache *oc, void **objs, unsigned n)
+{
+	struct pageref *pr, *newpr;
+	unsigned got;
+
+	if (!oc->oc_ready) {
+		objcache_setup(oc);
+	}
+
+	got = 0;
+	newpr = NULL;
+	while (1) {
+		spinlock_acquire(&oc->oc_lock);
+		checkcache(oc);
+		if (newpr != NULL) {
+			page_move(newpr, NULL, &oc->oc_partial);
+			oc->oc_npages++;
+			oc->oc_nfree += newpr->nfree;
+		}
+		while (got < n && oc->oc_partial != NULL) {
+			pr = oc->oc_partial;
+
+			/* check for corruption */
+			KASSERT(pr->cache == oc);
+			checksubpage(pr);
+
+			while (pr->nfree > 0 && got < n) {
+				objs[got++] = page_getobj(pr);
+				oc->oc_nfree--;
+			}
+			if (pr->nfree == 0) {
+				page_move(pr, &oc->oc_partial, &oc->oc_full);
+			}
+		}
+		spinlock_release(&oc->oc_lock);
+
+		if (got > 0) {
+			return got;
+		}
 
-	fla = prpage;
-	fl = (struct freelist *)fla;
-	fl->next = NULL;
-	for (i=1; i<pr->nfree; i++) {
-		fl = (struct freelist *)(fla + i*sizes[blktype]);
-		fl->next = (struct freelist *)(fla + (i-1)*sizes[blktype]);
-		KASSERT(fl != fl->next);
+		/*
+		 * No free objects. Make a new page. (Someone else may
+		 * take all of it before we do, in which case go round.)
+		 */
+		newpr = objcache_grow(oc);
+		if (newpr == NULL) {
+			return 0;
+		}
+	}
+}
+
+/*
+ * Put the N objects in OBJS back on OC's pages, and give back any
+ * page that ends up with none allocated.
+ */
+static
+void
+objcache_putobjs(struct objcache *oc, void **objs, unsigned n)
+{
+	struct pageref *prs[OBJCACHE_MAGSIZE];
+	struct pageref *pr, *freepages;
+	unsigned i;
+
+	/* (This may need kmalloc_spinlock, so do it first.) */
+	KASSERT(n <= OBJCACHE_MAGSIZE);
+	for (i=0; i<n; i++) {
+		prs[i] = pageref_find((vaddr_t)objs[i]);
+		if (prs[i] == NULL || prs[i]->cache != oc) {
+			panic("objcache_free: %p is not from cache %s\n",
+			      objs[i], oc->oc_name);
+		}
 	}
-	fla = (vaddr_t) fl;
-	pr->freelist_offset = fla - prpage;
-	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
+	freepages = NULL;
+
+	spinlock_acquire(&oc->oc_lock);
+	checkcache(oc);
+	for (i=0; i<n; i++) {
+		pr = prs[i];
+		page_putobj(pr, objs[i]);
+		oc->oc_nfree++;
 
-	pr->next_all = allbase;
-	allbase = pr;
+		if (pr->nfree == 1) {
+			/* It was full. */
+			page_move(pr, &oc->oc_full, &oc->oc_partial);
+		}
+		if (pr->nfree == PAGE_NOBJS(oc)) {
+			/* Whole page is free. */
+			page_move(pr, &oc->oc_partial, NULL);
+			oc->oc_npages--;
+			oc->oc_nfree -= pr->nfree;
+			pr->next_samecache = freepages;
+			freepages = pr;
+		}
+	}
+	checkcache(oc);
+	spinlock_release(&oc->oc_lock);
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	while (freepages != NULL) {
+		pr = freepages;
+		freepages = pr->next_samecache;
+		objcache_shrink(pr);
+	}
 }
 
+/*
+ * Return this CPU's magazine for OC, making it if need be, or NULL if
+ * there isn't one to be had. The thread may go on to run on another
+ * CPU, which only means that it uses the magazine of the CPU it was
+ * on; the magazine's lock makes that safe.
+ */
 static
-int
-subpage_kfree(void *ptr)
+struct objcache_mag *
+objcache_getmag(struct objcache *oc)
 {
-	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
-	struct pageref *pr;	// pageref for page we're freeing in
-	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
+	struct objcache_mag *mag;
+	unsigned cpunum;
+	void *ptr;
+
+	if (oc == &objcache_magcache || oc == &pageref_cache) {
+		/* (making one could need one of these) */
+		return NULL;
+	}
+	if (!CURCPU_EXISTS() || curcpu == NULL) {
+		/* (too early in boot for per-CPU anything) */
+		return NULL;
+	}
+	cpunum = curcpu->c_number;
+	KASSERT(cpunum < MAXCPUS);
 
-	ptraddr = (vaddr_t)ptr;
+	mag = oc->oc_mags[cpunum];
+	if (mag != NULL) {
+		return mag;
+	}
 
-	spinlock_acquire(&kmalloc_spinlock);
+	if (objcache_getobjs(&objcache_magcache, &ptr, 1) == 0) {
+		return NULL;
+	}
+	mag = ptr;
+	spinlock_init(&mag->om_lock);
+	mag->om_count = 0;
+
+	spinlock_acquire(&oc->oc_lock);
+	if (oc->oc_mags[cpunum] == NULL) {
+		oc->oc_mags[cpunum] = mag;
+		ptr = NULL;
+	}
+	spinlock_release(&oc->oc_lock);
 
-	checksubpages();
+	if (ptr != NULL) {
+		/* Someone beat us to it. */
+		spinlock_cleanup(&mag->om_lock);
+		objcache_putobjs(&objcache_magcache, &ptr, 1);
+	}
+	return oc->oc_mags[cpunum];
+}
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
+struct objcache *
+objcache_create(const char *name, size_t size, void (*ctor)(void *))
+{
+	struct objcache *oc;
+	unsigned i;
 
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
+	KASSERT(size > 0 && size <= LARGEST_SUBPAGE_SIZE);
 
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+	oc = kmalloc(sizeof(*oc));
+	if (oc == NULL) {
+		return NULL;
+	}
+	oc->oc_name = name;
+	oc->oc_size = size;
+	oc->oc_ctor = ctor;
+	oc->oc_static = false;
+	oc->oc_ready = false;
+	spinlock_init(&oc->oc_lock);
+	oc->oc_partial = NULL;
+	oc->oc_full = NULL;
+	oc->oc_npages = 0;
+	oc->oc_nfree = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		oc->oc_mags[i] = NULL;
+	}
+
+	objcache_setup(oc);
+	return oc;
+}
+
+void
+objcache_destroy(struct objcache *oc)
+{
+	struct objcache_mag *mag;
+	struct objcache **guy;
+	unsigned i;
+	void *ptr;
+
+	KASSERT(!oc->oc_static);
+
+	/* Empty the magazines and give them back. */
+	for (i=0; i<MAXCPUS; i++) {
+		mag = oc->oc_mags[i];
+		if (mag == NULL) {
+			continue;
 		}
+		oc->oc_mags[i] = NULL;
+		objcache_putobjs(oc, mag->om_objs, mag->om_count);
+		spinlock_cleanup(&mag->om_lock);
+		ptr = mag;
+		objcache_putobjs(&objcache_magcache, &ptr, 1);
+	}
+
+	/* Every page went back with its last object. */
+	if (oc->oc_npages > 0) {
+		panic("objcache_destroy: %s still has objects allocated\n",
+		      oc->oc_name);
 	}
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
+	spinlock_acquire(&kmalloc_spinlock);
+	for (guy = &allcaches; *guy != oc; guy = &(*guy)->oc_next) {
+		KASSERT(*guy != NULL);
 	}
+	*guy = oc->oc_next;
+	spinlock_release(&kmalloc_spinlock);
 
-	offset = ptraddr - prpage;
+	spinlock_cleanup(&oc->oc_lock);
+	kfree(oc);
+}
 
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
-		panic("kfree: subpage free of invalid addr %p\n", ptr);
+void *
+objcache_alloc(struct objcache *oc)
+{
+	struct objcache_mag *mag;
+	void *objs[OBJCACHE_MAGSIZE/2];
+	void *ptr;
+	unsigned n, i;
+
+	mag = objcache_getmag(oc);
+	if (mag == NULL) {
+		if (objcache_getobjs(oc, objs, 1) == 0) {
+			return NULL;
+		}
+		return objs[0];
 	}
 
+	spinlock_acquire(&mag->om_lock);
+	if (mag->om_count > 0) {
+		ptr = mag->om_objs[--mag->om_count];
+		spinlock_release(&mag->om_lock);
+		return ptr;
+	}
+	spinlock_release(&mag->om_lock);
+
+	/* The magazine is empty; refill half of it from the pages. */
+	n = objcache_getobjs(oc, objs, OBJCACHE_MAGSIZE/2);
+	if (n == 0) {
+		return NULL;
+	}
+	spinlock_acquire(&mag->om_lock);
+	for (i=1; i<n && mag->om_count < OBJCACHE_MAGSIZE; i++) {
+		mag->om_objs[mag->om_count++] = objs[i];
+	}
+	spinlock_release(&mag->om_lock);
+	if (i < n) {
+		/* (it filled up meanwhile) */
+		objcache_putobjs(oc, &objs[i], n - i);
+	}
+	return objs[0];
+}
+
+void
+objcache_free(struct objcache *oc, void *ptr)
+{
+	struct objcache_mag *mag;
+	void *objs[OBJCACHE_MAGSIZE/2];
+	unsigned n, i;
+
+	KASSERT(ptr != NULL);
+	KASSERT(oc->oc_ready);
+
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
+	 * uses of dangling pointers. Not if it has a constructor, as
+	 * then it is supposed to stay the way it is.
 	 */
-	fill_deadbeef(ptr, sizes[blktype]);
+	if (oc->oc_ctor == NULL) {
+		fill_deadbeef(ptr, oc->oc_objsize);
+	}
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
+	mag = objcache_getmag(oc);
+	if (mag == NULL) {
+		objcache_putobjs(oc, &ptr, 1);
+		return;
+	}
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	n = 0;
+	spinlock_acquire(&mag->om_lock);
+	if (mag->om_count == OBJCACHE_MAGSIZE) {
+		/* The magazine is full; send its older half back. */
+		n = OBJCACHE_MAGSIZE/2;
+		for (i=0; i<n; i++) {
+			objs[i] = mag->om_objs[i];
+		}
+		for (i=n; i<OBJCACHE_MAGSIZE; i++) {
+			mag->om_objs[i - n] = mag->om_objs[i];
+		}
+		mag->om_count -= n;
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
+	mag->om_objs[mag->om_count++] = ptr;
+	spinlock_release(&mag->om_lock);
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+	if (n > 0) {
+		objcache_putobjs(oc, objs, n);
 	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Return the cache object PTR came from, or NULL if it isn't from
+ * one.
+ */
+static
+struct objcache *
+objcache_owner(void *ptr)
+{
+	struct pageref *pr;
+
+	pr = pageref_find((vaddr_t)ptr);
+	return pr == NULL ? NULL : pr->cache;
+}
+
+static
+inline
+unsigned
+blocktype(size_t sz)
+{
+	unsigned i;
+	for (i=0; i<NSIZES; i++) {
+		if (sz <= kmalloc_caches[i].oc_size) {
+			return i;
+		}
 	}
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
-#endif
+	panic("Subpage allocator cannot handle allocation of size %lu\n",
+	      (unsigned long)sz);
 
+	// keep compiler happy
 	return 0;
 }
 
 //
 ////////////////////////////////////////////////////////////
 
+/*
+ * With the profiler built in, charge each allocation to whoever called
+ * kmalloc. Must be used in kmalloc itself.
+ */
+#if OPT_KMPROF
+#define KMPROF_ALLOC(ptr, sz, granted, class) \
+	kmprof_alloc(__builtin_return_address(0), ptr, sz, granted, class)
+#else
+#define KMPROF_ALLOC(ptr, sz, granted, class)
+#endif
+
 void *
 kmalloc(size_t sz)
 {
+	struct objcache *oc;
+	void *ptr;
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
 
+		if (sz <= ARENA_MAXSIZE) {
+			ptr = arena_alloc(sz);
+			KMPROF_ALLOC(ptr, sz,
+				     ptr == NULL ? 0 : arena_blocksize(ptr),
+				     "arena");
+			return ptr;
+		}
+
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
 		address = alloc_kpages(npages);
+		KMPROF_ALLOC((void *)address, sz, npages * PAGE_SIZE, "pages");
 		if (address==0) {
 			return NULL;
 		}
@@ -615,18 +1058,33 @@ kmalloc(size_t sz)
 		return (void *)address;
 	}
 
-	return subpage_kmalloc(sz);
+	oc = &kmalloc_caches[blocktype(sz)];
+	ptr = objcache_alloc(oc);
+	KMPROF_ALLOC(ptr, sz, oc->oc_size, oc->oc_name);
+	return ptr;
 }
 
 void
 kfree(void *ptr)
 {
+	struct objcache *oc;
+
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Try subpage first; if that fails, it's from the arena unless
+	 * it's page aligned, and otherwise a big allocation.
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if OPT_KMPROF
+	kmprof_free(ptr);
+#endif
+	oc = objcache_owner(ptr);
+	if (oc != NULL) {
+		objcache_free(oc, ptr);
+	} else if ((vaddr_t)ptr%PAGE_SIZE!=0) {
+		arena_free(ptr);
+	} else {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -0,0 +1,488 @@
+/*
+ * kmalloc profiler. See kmprof.h.
+ *
+ * All of the state is static and sized at compile time, so recording
+ * never allocates memory and works from the first kmalloc on.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <kmprof.h>
+
+#define KMPROF_LIVEHASH  1024	/* buckets in the live block table */
+#define KMPROF_NCLASSES  16	/* size classes */
+#define KMPROF_OTHER     0	/* site charged once the table is full */
+
+/*
+ * A call site. Allocations, frees and failures are counted since the
+ * last reset; live blocks and bytes (as asked for) since boot.
+ */
+struct kmprof_site {
+	const void *ks_caller;		/* NULL if slot unused */
+	unsigned ks_nallocs;
+	unsigned ks_nfrees;
+	unsigned ks_nfailed;
+	unsigned ks_nlive;
+	size_t ks_livebytes;
+	size_t ks_peakbytes;		/* most ks_livebytes since reset */
+};
+
+/*
+ * A size class. Bytes live are counted both as asked for and as
+ * handed out; the difference is lost to rounding up.
+ */
+struct kmprof_class {
+	const char *kc_name;		/* NULL if slot unused */
+	unsigned kc_nallocs;
+	unsigned kc_nfrees;
+	unsigned kc_nlive;
+	size_t kc_askedbytes;
+	size_t kc_givenbytes;
+};
+
+/*
+ * A live block. kb_next is the index of the next block in the same
+ * hash chain (or on the free list) plus one, or 0 at the end.
+ */
+struct kmprof_block {
+	vaddr_t kb_addr;
+	uint32_t kb_size;
+	uint32_t kb_granted;
+	uint16_t kb_next;
+	uint8_t kb_site;
+	uint8_t kb_class;
+};
+
+static struct spinlock kmprof_lock = SPINLOCK_INITIALIZER;
+
+/* Everything below is protected by kmprof_lock. */
+static bool kmprof_ready;
+static struct kmprof_site kmprof_sites[KMPROF_NSITES];
+static unsigned kmprof_nsites;
+static struct kmprof_class kmprof_classes[KMPROF_NCLASSES];
+static unsigned kmprof_nclasses;
+static struct kmprof_block kmprof_blocks[KMPROF_MAXLIVE];
+static uint16_t kmprof_hash[KMPROF_LIVEHASH];
+static uint16_t kmprof_freeblocks;
+
+/* Since the last reset (or kmprof_bootstrap). */
+static unsigned kmprof_untracked_allocs;
+static unsigned kmprof_untracked_frees;
+static time_t kmprof_start_s;
+static uint32_t kmprof_start_ns;
+
+/* At the last print, for the rate since then. */
+static unsigned kmprof_last_nallocs;
+static time_t kmprof_last_s;
+static uint32_t kmprof_last_ns;
+
+////////////////////////////////////////////////////////////
+// Tables
+
+/*
+ * Set up the free list of blocks. Done on first use, as kmalloc is
+ * called before anything could call an init function.
+ */
+static
+void
+kmprof_setup(void)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&kmprof_lock));
+
+	for (i=0; i<KMPROF_MAXLIVE; i++) {
+		kmprof_blocks[i].kb_next = i + 1 < KMPROF_MAXLIVE ? i + 2 : 0;
+	}
+	kmprof_freeblocks = 1;
+
+	/* Slot 0 is the catch-all. */
+	kmprof_sites[KMPROF_OTHER].ks_caller = NULL;
+	kmprof_nsites = 1;
+
+	kmprof_ready = true;
+}
+
+/*
+ * Find the slot for CALLER, claiming one if it hasn't been seen.
+ * Slots 1 and up are open-addressed; when they are all taken, new
+ * sites share slot 0.
+ */
+static
+unsigned
+kmprof_site(const void *caller)
+{
+	unsigned i, n, probes;
+
+	n = KMPROF_NSITES - 1;
+	i = ((vaddr_t)caller >> 2) % n;
+	for (probes = 0; probes < n; probes++) {
+		if (kmprof_sites[i + 1].ks_caller == caller) {
+			return i + 1;
+		}
+		if (kmprof_sites[i + 1].ks_caller == NULL) {
+			kmprof_sites[i + 1].ks_caller = caller;
+			kmprof_nsites++;
+			return i + 1;
+		}
+		i = (i + 1) % n;
+	}
+	return KMPROF_OTHER;
+}
+
+/*
+ * Find the slot for size class NAME. The classes are fixed by
+ * kmalloc, so there is always room.
+ */
+static
+unsigned
+kmprof_class(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<kmprof_nclasses; i++) {
+		if (kmprof_classes[i].kc_name == name) {
+			return i;
+		}
+	}
+	KASSERT(kmprof_nclasses < KMPROF_NCLASSES);
+	kmprof_classes[i].kc_name = name;
+	kmprof_nclasses++;
+	return i;
+}
+
+static
+unsigned
+kmprof_hashof(vaddr_t addr)
+{
+	/* Blocks are at least 8-byte aligned. */
+	return (addr >> 3) % KMPROF_LIVEHASH;
+}
+
+/*
+ * Take the block at ADDR out of the live table, returning its index
+ * plus one, or 0 if it isn't there.
+ */
+static
+unsigned
+kmprof_unlink(vaddr_t addr)
+{
+	uint16_t *ip;
+	unsigned ix;
+
+	for (ip = &kmprof_hash[kmprof_hashof(addr)]; *ip != 0;
+	     ip = &kmprof_blocks[*ip - 1].kb_next) {
+		if (kmprof_blocks[*ip - 1].kb_addr == addr) {
+			ix = *ip;
+			*ip = kmprof_blocks[ix - 1].kb_next;
+			return ix;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Recording
+
+void
+kmprof_bootstrap(void)
+{
+	time_t s;
+	uint32_t ns;
+
+	/* The clock can't be read until the devices are up. */
+	gettime(&s, &ns);
+
+	spinlock_acquire(&kmprof_lock);
+	if (!kmprof_ready) {
+		kmprof_setup();
+	}
+	kmprof_start_s = kmprof_last_s = s;
+	kmprof_start_ns = kmprof_last_ns = ns;
+	spinlock_release(&kmprof_lock);
+}
+
+void
+kmprof_alloc(const void *caller, void *ptr, size_t size, size_t granted,
+	     const char *class)
+{
+	struct kmprof_site *ks;
+	struct kmprof_class *kc;
+	struct kmprof_block *kb;
+	unsigned site, cls, ix, h;
+
+	spinlock_acquire(&kmprof_lock);
+	if (!kmprof_ready) {
+		kmprof_setup();
+	}
+
+	site = kmprof_site(caller);
+	ks = &kmprof_sites[site];
+	if (ptr == NULL) {
+		ks->ks_nfailed++;
+		spinlock_release(&kmprof_lock);
+		return;
+	}
+
+	if (kmprof_freeblocks == 0) {
+		kmprof_untracked_allocs++;
+		spinlock_release(&kmprof_lock);
+		return;
+	}
+	ix = kmprof_freeblocks;
+	kb = &kmprof_blocks[ix - 1];
+	kmprof_freeblocks = kb->kb_next;
+
+	cls = kmprof_class(class);
+	kb->kb_addr = (vaddr_t)ptr;
+	kb->kb_size = size;
+	kb->kb_granted = granted;
+	kb->kb_site = site;
+	kb->kb_class = cls;
+	h = kmprof_hashof(kb->kb_addr);
+	kb->kb_next = kmprof_hash[h];
+	kmprof_hash[h] = ix;
+
+	ks->ks_nallocs++;
+	ks->ks_nlive++;
+	ks->ks_livebytes += size;
+	if (ks->ks_livebytes > ks->ks_peakbytes) {
+		ks->ks_peakbytes = ks->ks_livebytes;
+	}
+
+	kc = &kmprof_classes[cls];
+	kc->kc_nallocs++;
+	kc->kc_nlive++;
+	kc->kc_askedbytes += size;
+	kc->kc_givenbytes += granted;
+
+	spinlock_release(&kmprof_lock);
+}
+
+void
+kmprof_free(void *ptr)
+{
+	struct kmprof_site *ks;
+	struct kmprof_class *kc;
+	struct kmprof_block *kb;
+	unsigned ix;
+
+	spinlock_acquire(&kmprof_lock);
+	if (!kmprof_ready) {
+		kmprof_setup();
+	}
+
+	ix = kmprof_unlink((vaddr_t)ptr);
+	if (ix == 0) {
+		kmprof_untracked_frees++;
+		spinlock_release(&kmprof_lock);
+		return;
+	}
+	kb = &kmprof_blocks[ix - 1];
+
+	ks = &kmprof_sites[kb->kb_site];
+	KASSERT(ks->ks_nlive > 0 && ks->ks_livebytes >= kb->kb_size);
+	ks->ks_nfrees++;
+	ks->ks_nlive--;
+	ks->ks_livebytes -= kb->kb_size;
+
+	kc = &kmprof_classes[kb->kb_class];
+	KASSERT(kc->kc_nlive > 0 && kc->kc_givenbytes >= kb->kb_granted);
+	kc->kc_nfrees++;
+	kc->kc_nlive--;
+	kc->kc_askedbytes -= kb->kb_size;
+	kc->kc_givenbytes -= kb->kb_granted;
+
+	kb->kb_next = kmprof_freeblocks;
+	kmprof_freeblocks = ix;
+
+	spinlock_release(&kmprof_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Reporting
+
+/*
+ * Milliseconds from S0/NS0 to S1/NS1.
+ */
+static
+unsigned
+kmprof_msecs(time_t s0, uint32_t ns0, time_t s1, uint32_t ns1)
+{
+	time_t ds;
+	uint32_t dns;
+
+	getinterval(s0, ns0, s1, ns1, &ds, &dns);
+	return ds * 1000 + dns / 1000000;
+}
+
+/*
+ * N events per second over MS milliseconds.
+ */
+static
+unsigned
+kmprof_rate(unsigned n, unsigned ms)
+{
+	return ms == 0 ? 0 : (unsigned)((uint64_t)n * 1000 / ms);
+}
+
+void
+kmprof_print(unsigned ntop)
+{
+	struct kmprof_site top[KMPROF_MAXTOP];
+	struct kmprof_class classes[KMPROF_NCLASSES];
+	unsigned ntaken, nclasses, nsites, i, j;
+	unsigned nallocs, nfrees, nfailed, nlive, uallocs, ufrees;
+	unsigned ms_total, ms_last, nallocs_last;
+	size_t livebytes;
+	time_t now_s;
+	uint32_t now_ns;
+
+	if (ntop > KMPROF_MAXTOP) {
+		ntop = KMPROF_MAXTOP;
+	}
+
+	/*
+	 * Copy out what we need under the lock, keeping the NTOP sites
+	 * with the most bytes live in order, and print afterwards.
+	 */
+	nallocs = nfrees = nfailed = nlive = 0;
+	livebytes = 0;
+	ntaken = 0;
+	gettime(&now_s, &now_ns);
+
+	spinlock_acquire(&kmprof_lock);
+	if (!kmprof_ready) {
+		kmprof_setup();
+	}
+	for (i=0; i<KMPROF_NSITES; i++) {
+		const struct kmprof_site *ks = &kmprof_sites[i];
+
+		if (i != KMPROF_OTHER && ks->ks_caller == NULL) {
+			continue;
+		}
+		nallocs += ks->ks_nallocs;
+		nfrees += ks->ks_nfrees;
+		nfailed += ks->ks_nfailed;
+		nlive += ks->ks_nlive;
+		livebytes += ks->ks_livebytes;
+
+		if (ks->ks_nallocs == 0 && ks->ks_nlive == 0 &&
+		    ks->ks_nfailed == 0) {
+			continue;
+		}
+		for (j = ntaken; j > 0; j--) {
+			if (top[j-1].ks_livebytes >= ks->ks_livebytes) {
+				break;
+			}
+			if (j < ntop) {
+				top[j] = top[j-1];
+			}
+		}
+		if (j < ntop) {
+			top[j] = *ks;
+			if (ntaken < ntop) {
+				ntaken++;
+			}
+		}
+	}
+	nsites = kmprof_nsites - 1;
+	nclasses = kmprof_nclasses;
+	for (i=0; i<nclasses; i++) {
+		classes[i] = kmprof_classes[i];
+	}
+	uallocs = kmprof_untracked_allocs;
+	ufrees = kmprof_untracked_frees;
+
+	ms_total = kmprof_msecs(kmprof_start_s, kmprof_start_ns,
+				now_s, now_ns);
+	ms_last = kmprof_msecs(kmprof_last_s, kmprof_last_ns, now_s, now_ns);
+	nallocs_last = nallocs - kmprof_last_nallocs;
+	kmprof_last_nallocs = nallocs;
+	kmprof_last_s = now_s;
+	kmprof_last_ns = now_ns;
+	spinlock_release(&kmprof_lock);
+
+	kprintf("kmalloc profile: %u sites, %u allocs, %u frees, "
+		"%u failed\n", nsites, nallocs, nfrees, nfailed);
+	kprintf("    %u blocks live, %lu bytes asked for\n",
+		nlive, (unsigned long)livebytes);
+	kprintf("    %u allocs/s over %u.%03u s; %u allocs/s over the "
+		"%u.%03u s since the last print\n",
+		kmprof_rate(nallocs, ms_total), ms_total / 1000,
+		ms_total % 1000, kmprof_rate(nallocs_last, ms_last),
+		ms_last / 1000, ms_last % 1000);
+	if (uallocs > 0 || ufrees > 0) {
+		kprintf("    not tracked: %u allocs (table full), "
+			"%u frees\n", uallocs, ufrees);
+	}
+
+	kprintf("Sites with the most bytes live:\n");
+	kprintf("    %-10s %8s %8s %6s %7s %9s %9s\n", "site", "allocs",
+		"frees", "failed", "live", "bytes", "peak");
+	for (i=0; i<ntaken; i++) {
+		if (top[i].ks_caller == NULL) {
+			kprintf("    %-10s", "(other)");
+		}
+		else {
+			kprintf("    0x%08lx",
+				(unsigned long)(vaddr_t)top[i].ks_caller);
+		}
+		kprintf(" %8u %8u %6u %7u %9lu %9lu\n",
+			top[i].ks_nallocs, top[i].ks_nfrees,
+			top[i].ks_nfailed, top[i].ks_nlive,
+			(unsigned long)top[i].ks_livebytes,
+			(unsigned long)top[i].ks_peakbytes);
+	}
+
+	kprintf("Size classes:\n");
+	kprintf("    %-14s %8s %8s %7s %9s %9s %5s\n", "class", "allocs",
+		"allocs/s", "live", "asked", "given", "frag");
+	for (i=0; i<nclasses; i++) {
+		const struct kmprof_class *kc = &classes[i];
+		unsigned frag;
+
+		/* Share of what was handed out that wasn't asked for. */
+		frag = kc->kc_givenbytes <= kc->kc_askedbytes ? 0 :
+			(kc->kc_givenbytes - kc->kc_askedbytes) * 100 /
+			kc->kc_givenbytes;
+		kprintf("    %-14s %8u %8u %7u %9lu %9lu %4u%%\n",
+			kc->kc_name, kc->kc_nallocs,
+			kmprof_rate(kc->kc_nallocs, ms_total), kc->kc_nlive,
+			(unsigned long)kc->kc_askedbytes,
+			(unsigned long)kc->kc_givenbytes, frag);
+	}
+}
+
+void
+kmprof_reset(void)
+{
+	time_t s;
+	uint32_t ns;
+	unsigned i;
+
+	gettime(&s, &ns);
+
+	spinlock_acquire(&kmprof_lock);
+	if (!kmprof_ready) {
+		kmprof_setup();
+	}
+	for (i=0; i<KMPROF_NSITES; i++) {
+		kmprof_sites[i].ks_nallocs = 0;
+		kmprof_sites[i].ks_nfrees = 0;
+		kmprof_sites[i].ks_nfailed = 0;
+		kmprof_sites[i].ks_peakbytes = kmprof_sites[i].ks_livebytes;
+	}
+	for (i=0; i<kmprof_nclasses; i++) {
+		kmprof_classes[i].kc_nallocs = 0;
+		kmprof_classes[i].kc_nfrees = 0;
+	}
+	kmprof_untracked_allocs = 0;
+	kmprof_untracked_frees = 0;
+	kmprof_start_s = kmprof_last_s = s;
+	kmprof_start_ns = kmprof_last_ns = ns;
+	kmprof_last_nallocs = 0;
+	spinlock_release(&kmprof_lock);
+}
@@ -0,0 +1,367 @@
+/*
+ * Load control. See loadctl.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <loadctl.h>
+#include <uw-vmstats.h>
+
+/*
+ * Every address space, most recently created first, and how many of
+ * them are deactivated. Protected by loadctl_lock, which is taken
+ * before the coremap lock.
+ */
+static struct addrspace *loadctl_list;
+static unsigned loadctl_ninactive;
+static unsigned loadctl_seq;
+static struct spinlock loadctl_lock = SPINLOCK_INITIALIZER;
+
+static volatile bool loadctl_on = true;
+
+/* Where the threads of deactivated processes wait. */
+static struct wchan *loadctl_wchan;
+
+/* Where loadctl_unregister waits for a swap-out to finish. */
+static struct wchan *loadctl_swapwchan;
+
+/*
+ * Whether the previous interval was sampled too. Only then do the
+ * pages counted as used cover just one interval. Only the load
+ * control thread uses this.
+ */
+static bool loadctl_fresh;
+
+void
+loadctl_register(struct addrspace *as)
+{
+	as->as_lc.lc_rss = 0;
+	as->as_lc.lc_used = 0;
+	as->as_lc.lc_swapins = 0;
+	as->as_lc.lc_ws = 0;
+	as->as_lc.lc_inactive = false;
+	as->as_lc.lc_swapping = false;
+
+	spinlock_acquire(&loadctl_lock);
+	as->as_lc.lc_seq = ++loadctl_seq;
+	as->as_lc.lc_next = loadctl_list;
+	loadctl_list = as;
+	spinlock_release(&loadctl_lock);
+}
+
+void
+loadctl_unregister(struct addrspace *as)
+{
+	struct addrspace **pp;
+
+	spinlock_acquire(&loadctl_lock);
+	for (pp = &loadctl_list; *pp != as; pp = &(*pp)->as_lc.lc_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = as->as_lc.lc_next;
+	if (as->as_lc.lc_inactive) {
+		/* (it exited on its way to being stopped) */
+		as->as_lc.lc_inactive = false;
+		loadctl_ninactive--;
+	}
+	/* Don't go away while being swapped out; that stops soon now. */
+	while (as->as_lc.lc_swapping) {
+		wchan_lock(loadctl_swapwchan);
+		spinlock_release(&loadctl_lock);
+		wchan_sleep(loadctl_swapwchan);
+		spinlock_acquire(&loadctl_lock);
+	}
+	spinlock_release(&loadctl_lock);
+}
+
+void
+loadctl_checkpoint(void)
+{
+	struct addrspace *as;
+
+	/*
+	 * This runs on every return to user mode, interrupts included,
+	 * so don't take p_lock: only the process's own threads change
+	 * its address space, and one of them is us.
+	 */
+	if (curproc == NULL) {
+		return;
+	}
+	as = curproc->p_addrspace;
+	if (as == NULL || !as->as_lc.lc_inactive) {
+		return;
+	}
+
+	spinlock_acquire(&loadctl_lock);
+	while (as->as_lc.lc_inactive) {
+		wchan_lock(loadctl_wchan);
+		spinlock_release(&loadctl_lock);
+		wchan_sleep(loadctl_wchan);
+		spinlock_acquire(&loadctl_lock);
+	}
+	spinlock_release(&loadctl_lock);
+}
+
+/*
+ * Whether AS, which is being swapped out, is still deactivated.
+ */
+static
+bool
+loadctl_isout(struct addrspace *as)
+{
+	bool ret;
+
+	spinlock_acquire(&loadctl_lock);
+	ret = as->as_lc.lc_inactive;
+	spinlock_release(&loadctl_lock);
+	return ret;
+}
+
+/*
+ * Take a sample, and deactivate or reactivate a process if need be.
+ * Returns the address space of the process deactivated, if any, to
+ * be swapped out; it is marked lc_swapping, so that it stays until
+ * loadctl_swapout is done with it.
+ */
+static
+struct addrspace *
+loadctl_sample(void)
+{
+	struct addrspace *as, *victim, *oldest;
+	unsigned swapins, wstotal, avail, ncompeting;
+	bool thrashing, wake;
+
+	/*
+	 * Start the counts over, and keep the swap-ins in lc_ws for
+	 * now. Deactivated processes keep the estimate they had.
+	 */
+	swapins = 0;
+	spinlock_acquire(&loadctl_lock);
+	coremap_lock_acquire();
+	for (as = loadctl_list; as != NULL; as = as->as_lc.lc_next) {
+		if (!as->as_lc.lc_inactive) {
+			as->as_lc.lc_ws = as->as_lc.lc_swapins;
+			swapins += as->as_lc.lc_swapins;
+		}
+		as->as_lc.lc_swapins = 0;
+		as->as_lc.lc_rss = 0;
+		as->as_lc.lc_used = 0;
+	}
+	coremap_lock_release();
+	spinlock_release(&loadctl_lock);
+
+	if (swapins == 0 && loadctl_ninactive == 0) {
+		/* Nothing is being paged back in; save the trouble. */
+		loadctl_fresh = false;
+		return NULL;
+	}
+
+	avail = coremap_wssample();
+
+	wstotal = ncompeting = 0;
+	victim = oldest = NULL;
+	wake = false;
+	spinlock_acquire(&loadctl_lock);
+	coremap_lock_acquire();
+	for (as = loadctl_list; as != NULL; as = as->as_lc.lc_next) {
+		if (as->as_lc.lc_inactive) {
+			if (oldest == NULL ||
+			    as->as_lc.lc_seq < oldest->as_lc.lc_seq) {
+				oldest = as;
+			}
+			continue;
+		}
+		as->as_lc.lc_ws += as->as_lc.lc_used;
+		if (as->as_lc.lc_ws == 0) {
+			/* (asleep, most likely; stopping it gains nothing) */
+			continue;
+		}
+		wstotal += as->as_lc.lc_ws;
+		ncompeting++;
+		if (victim == NULL || as->as_lc.lc_seq > victim->as_lc.lc_seq) {
+			victim = as;
+		}
+	}
+	coremap_lock_release();
+
+	/* (loadctl_on is checked again in case it was just turned off) */
+	thrashing = loadctl_on && loadctl_fresh && ncompeting > 1 &&
+		wstotal > avail &&
+		swapins >= LOADCTL_THRASH * LOADCTL_INTERVAL;
+	if (thrashing) {
+		victim->as_lc.lc_inactive = true;
+		victim->as_lc.lc_swapping = true;
+		victim->as_lc.lc_seq = ++loadctl_seq;
+		loadctl_ninactive++;
+		vmstats_inc(VMSTAT_LOADCTL_DEACTIVATE);
+	}
+	else {
+		victim = NULL;
+		if (oldest != NULL && (ncompeting == 0 ||
+		    (swapins < LOADCTL_CALM * LOADCTL_INTERVAL &&
+		     wstotal + oldest->as_lc.lc_ws <= avail))) {
+			oldest->as_lc.lc_inactive = false;
+			oldest->as_lc.lc_seq = ++loadctl_seq;
+			loadctl_ninactive--;
+			vmstats_inc(VMSTAT_LOADCTL_REACTIVATE);
+			wake = true;
+		}
+	}
+	spinlock_release(&loadctl_lock);
+
+	if (wake) {
+		wchan_wakeall(loadctl_wchan);
+	}
+	loadctl_fresh = true;
+	return victim;
+}
+
+/*
+ * Swap out the pages of deactivated AS, for as long as it stays
+ * deactivated, then let it be destroyed if it is waiting to be.
+ */
+static
+void
+loadctl_swapout(struct addrspace *as)
+{
+	unsigned cursor;
+
+	cursor = 0;
+	while (loadctl_isout(as)) {
+		if (coremap_swapout(as, &cursor) == 0) {
+			break;
+		}
+	}
+
+	spinlock_acquire(&loadctl_lock);
+	as->as_lc.lc_swapping = false;
+	spinlock_release(&loadctl_lock);
+	wchan_wakeall(loadctl_swapwchan);
+}
+
+static
+void
+loadctl_thread(void *unused1, unsigned long unused2)
+{
+	struct addrspace *victim;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(LOADCTL_INTERVAL);
+		if (!loadctl_on) {
+			loadctl_fresh = false;
+			continue;
+		}
+		victim = loadctl_sample();
+		if (victim != NULL) {
+			loadctl_swapout(victim);
+		}
+	}
+}
+
+void
+loadctl_bootstrap(void)
+{
+	int result;
+
+	loadctl_wchan = wchan_create("loadctl");
+	if (loadctl_wchan == NULL) {
+		panic("loadctl: Could not create wchan\n");
+	}
+	loadctl_swapwchan = wchan_create("loadctl swap");
+	if (loadctl_swapwchan == NULL) {
+		panic("loadctl: Could not create wchan\n");
+	}
+
+	result = thread_fork("loadctl", NULL, loadctl_thread, NULL, 0);
+	if (result) {
+		kprintf("loadctl: thread_fork: %s; no load control\n",
+			strerror(result));
+		loadctl_on = false;
+	}
+}
+
+void
+loadctl_enable(bool on)
+{
+	struct addrspace *as;
+	unsigned n;
+
+	loadctl_on = on;
+	if (on) {
+		return;
+	}
+
+	/* Let everyone back in. */
+	n = 0;
+	spinlock_acquire(&loadctl_lock);
+	for (as = loadctl_list; as != NULL; as = as->as_lc.lc_next) {
+		if (as->as_lc.lc_inactive) {
+			as->as_lc.lc_inactive = false;
+			n++;
+		}
+	}
+	loadctl_ninactive = 0;
+	spinlock_release(&loadctl_lock);
+
+	vmstats_add(VMSTAT_LOADCTL_REACTIVATE, n);
+	wchan_wakeall(loadctl_wchan);
+}
+
+bool
+loadctl_enabled(void)
+{
+	return loadctl_on;
+}
+
+/*
+ * Copied out under the lock and printed after, so as not to print
+ * with interrupts off.
+ */
+#define LOADCTL_NPRINT 16
+
+void
+loadctl_print(void)
+{
+	struct {
+		unsigned rss, ws;
+		bool inactive;
+	} info[LOADCTL_NPRINT];
+	struct addrspace *as;
+	unsigned i, n, total;
+
+	n = total = 0;
+	spinlock_acquire(&loadctl_lock);
+	for (as = loadctl_list; as != NULL; as = as->as_lc.lc_next) {
+		if (n < LOADCTL_NPRINT) {
+			info[n].rss = as->as_lc.lc_rss;
+			info[n].ws = as->as_lc.lc_ws;
+			info[n].inactive = as->as_lc.lc_inactive;
+			n++;
+		}
+		total++;
+	}
+	spinlock_release(&loadctl_lock);
+
+	kprintf("Load control is %s; %u address spaces\n",
+		loadctl_on ? "on" : "off", total);
+	for (i=0; i<n; i++) {
+		kprintf("  %2u: %5u resident, working set %5u%s\n", i,
+			info[i].rss, info[i].ws,
+			info[i].inactive ? " (deactivated)" : "");
+	}
+	if (total > n) {
+		kprintf("  ...\n");
+	}
+}
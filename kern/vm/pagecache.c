@@ -0,0 +1,421 @@
+/*
+ * Page cache for memory-mapped files and executables. See pagecache.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <zeropool.h>
+#include <pagecache.h>
+#include <uw-vmstats.h>
+
+/*
+ * The cached pages of a file are hashed on their offset into a small
+ * table of chains. Most mapped files are only a few pages long.
+ *
+ * The chains are protected by the coremap lock, so that coremap_evict
+ * can take a page out of its cache (with pagecache_unlink) while it
+ * holds the lock.
+ */
+#define PAGECACHE_NBUCKETS 32
+#define PAGECACHE_HASH(off) (((off) / PAGE_SIZE) % PAGECACHE_NBUCKETS)
+
+struct pcpage {
+	struct pagecache *pp_cache;	/* cache the page belongs to */
+	off_t pp_offset;		/* page-aligned offset in the file */
+	paddr_t pp_frame;		/* frame holding the page */
+	struct pcpage *pp_next;
+};
+
+struct pagecache {
+	struct vnode *pc_vnode;		/* NULL if anonymous */
+	unsigned pc_refcount;		/* regions mapping the file */
+	unsigned pc_npages;		/* pages in pc_pages */
+	struct pcpage *pc_pages[PAGECACHE_NBUCKETS];
+	struct pagecache *pc_next;
+};
+
+/*
+ * All the page caches of files, so that a file mapped twice gets the
+ * same one. pagecache_listlock protects the list and every
+ * pc_refcount. Anonymous page caches aren't on the list.
+ */
+static struct pagecache *pagecache_list;
+static struct lock *pagecache_listlock;
+
+void
+pagecache_bootstrap(void)
+{
+	pagecache_listlock = lock_create("pagecache");
+	if (pagecache_listlock == NULL) {
+		panic("pagecache: Could not create lock\n");
+	}
+}
+
+/*
+ * Free page caches that nobody maps and that have no pages left.
+ * Called with pagecache_listlock held.
+ */
+static
+void
+pagecache_reap(void)
+{
+	struct pagecache *pc, **pcp;
+	bool empty;
+
+	KASSERT(lock_do_i_hold(pagecache_listlock));
+
+	pcp = &pagecache_list;
+	while (*pcp != NULL) {
+		pc = *pcp;
+		if (pc->pc_refcount > 0) {
+			pcp = &pc->pc_next;
+			continue;
+		}
+		/* Nobody can add pages without a reference. */
+		coremap_lock_acquire();
+		empty = pc->pc_npages == 0;
+		coremap_lock_release();
+		if (!empty) {
+			pcp = &pc->pc_next;
+			continue;
+		}
+		*pcp = pc->pc_next;
+		VOP_DECREF(pc->pc_vnode);
+		kfree(pc);
+	}
+}
+
+/*
+ * Drop every page of PC, which nobody maps.
+ */
+static
+void
+pagecache_drop(struct pagecache *pc)
+{
+	struct pcpage *pp, *dead;
+	unsigned i;
+
+	for (i=0; i<PAGECACHE_NBUCKETS; i++) {
+		coremap_lock_acquire();
+		dead = pc->pc_pages[i];
+		pc->pc_pages[i] = NULL;
+		for (pp = dead; pp != NULL; pp = pp->pp_next) {
+			coremap_uncache_upage(pp->pp_frame);
+			pc->pc_npages--;
+		}
+		coremap_lock_release();
+
+		while (dead != NULL) {
+			pp = dead;
+			dead = pp->pp_next;
+			kfree(pp);
+		}
+	}
+}
+
+int
+pagecache_open(struct vnode *v, struct pagecache **ret)
+{
+	struct pagecache *pc;
+	unsigned i;
+
+	lock_acquire(pagecache_listlock);
+	pagecache_reap();
+	for (pc = pagecache_list; pc != NULL; pc = pc->pc_next) {
+		if (pc->pc_vnode == v) {
+			pc->pc_refcount++;
+			lock_release(pagecache_listlock);
+			*ret = pc;
+			return 0;
+		}
+	}
+
+	pc = kmalloc(sizeof(struct pagecache));
+	if (pc == NULL) {
+		lock_release(pagecache_listlock);
+		return ENOMEM;
+	}
+	VOP_INCREF(v);
+	pc->pc_vnode = v;
+	pc->pc_refcount = 1;
+	pc->pc_npages = 0;
+	for (i=0; i<PAGECACHE_NBUCKETS; i++) {
+		pc->pc_pages[i] = NULL;
+	}
+	pc->pc_next = pagecache_list;
+	pagecache_list = pc;
+	lock_release(pagecache_listlock);
+
+	*ret = pc;
+	return 0;
+}
+
+int
+pagecache_anon(struct pagecache **ret)
+{
+	struct pagecache *pc;
+	unsigned i;
+
+	pc = kmalloc(sizeof(struct pagecache));
+	if (pc == NULL) {
+		return ENOMEM;
+	}
+	pc->pc_vnode = NULL;
+	pc->pc_refcount = 1;
+	pc->pc_npages = 0;
+	for (i=0; i<PAGECACHE_NBUCKETS; i++) {
+		pc->pc_pages[i] = NULL;
+	}
+	pc->pc_next = NULL;
+
+	*ret = pc;
+	return 0;
+}
+
+bool
+pagecache_isanon(struct pagecache *pc)
+{
+	return pc->pc_vnode == NULL;
+}
+
+bool
+pagecache_lastref(struct pagecache *pc)
+{
+	bool ret;
+
+	lock_acquire(pagecache_listlock);
+	KASSERT(pc->pc_refcount > 0);
+	ret = pc->pc_refcount == 1;
+	lock_release(pagecache_listlock);
+	return ret;
+}
+
+void
+pagecache_incref(struct pagecache *pc)
+{
+	lock_acquire(pagecache_listlock);
+	KASSERT(pc->pc_refcount > 0);
+	pc->pc_refcount++;
+	lock_release(pagecache_listlock);
+}
+
+void
+pagecache_decref(struct pagecache *pc)
+{
+	bool dead;
+
+	lock_acquire(pagecache_listlock);
+	KASSERT(pc->pc_refcount > 0);
+	pc->pc_refcount--;
+	/* File pages stay until they are evicted or purged. */
+	dead = pc->pc_vnode == NULL && pc->pc_refcount == 0;
+	if (!dead) {
+		pagecache_reap();
+	}
+	lock_release(pagecache_listlock);
+
+	if (dead) {
+		/* Anonymous pages have nowhere to go. */
+		pagecache_drop(pc);
+		KASSERT(pc->pc_npages == 0);
+		kfree(pc);
+	}
+}
+
+void
+pagecache_purge(void)
+{
+	struct pagecache *pc;
+
+	lock_acquire(pagecache_listlock);
+	for (pc = pagecache_list; pc != NULL; pc = pc->pc_next) {
+		if (pc->pc_refcount > 0) {
+			continue;
+		}
+		pagecache_drop(pc);
+	}
+	pagecache_reap();
+	lock_release(pagecache_listlock);
+}
+
+void
+pagecache_unlink(struct pcpage *pp)
+{
+	struct pagecache *pc;
+	struct pcpage **ppp;
+
+	pc = pp->pp_cache;
+	for (ppp = &pc->pc_pages[PAGECACHE_HASH(pp->pp_offset)];
+	     *ppp != pp; ppp = &(*ppp)->pp_next) {
+		KASSERT(*ppp != NULL);
+	}
+	*ppp = pp->pp_next;
+	pc->pc_npages--;
+}
+
+/*
+ * Find the page of PC at OFFSET. Called with the coremap lock held.
+ */
+static
+struct pcpage *
+pagecache_find(struct pagecache *pc, off_t offset)
+{
+	struct pcpage *pp;
+
+	for (pp = pc->pc_pages[PAGECACHE_HASH(offset)]; pp != NULL;
+	     pp = pp->pp_next) {
+		if (pp->pp_offset == offset) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Read the page of PC's file at OFFSET into frame PA.
+ */
+static
+int
+pagecache_read(struct pagecache *pc, off_t offset, paddr_t pa)
+{
+	struct iovec iov;
+	struct uio u;
+	vaddr_t kva;
+	int result;
+
+	kva = PADDR_TO_KVADDR(pa);
+	uio_kinit(&iov, &u, (void *)kva, PAGE_SIZE, offset, UIO_READ);
+	result = VOP_READ(pc->pc_vnode, &u);
+	if (result) {
+		return result;
+	}
+	/* Past the end of the file. */
+	bzero((void *)(kva + PAGE_SIZE - u.uio_resid), u.uio_resid);
+	return 0;
+}
+
+int
+pagecache_getpage(struct pagecache *pc, off_t offset, paddr_t *ret)
+{
+	struct pcpage *pp, *newpp;
+	paddr_t pa;
+	unsigned bucket;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	coremap_lock_acquire();
+	pp = pagecache_find(pc, offset);
+	if (pp != NULL) {
+		coremap_share_upage(pp->pp_frame);
+		*ret = pp->pp_frame;
+		coremap_lock_release();
+		vmstats_inc(VMSTAT_PAGECACHE_HIT);
+		return 0;
+	}
+	coremap_lock_release();
+
+	/*
+	 * Read it in without holding anything, so that others can use
+	 * the cache (or evict from it) meanwhile.
+	 */
+	newpp = kmalloc(sizeof(struct pcpage));
+	if (newpp == NULL) {
+		return ENOMEM;
+	}
+	if (pc->pc_vnode == NULL) {
+		/* Anonymous memory starts out zeroed. */
+		pa = zeropool_alloc_upage(NULL, 0);
+		if (pa == 0) {
+			kfree(newpp);
+			return ENOMEM;
+		}
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+	}
+	else {
+		pa = coremap_alloc_upage(NULL, 0);
+		if (pa == 0) {
+			kfree(newpp);
+			return ENOMEM;
+		}
+		result = pagecache_read(pc, offset, pa);
+		if (result) {
+			coremap_free_upage(pa);
+			kfree(newpp);
+			return result;
+		}
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		vmstats_inc(VMSTAT_PAGECACHE_MISS);
+	}
+
+	coremap_lock_acquire();
+	pp = pagecache_find(pc, offset);
+	if (pp != NULL) {
+		/* Somebody else read it in first; use theirs. */
+		coremap_share_upage(pp->pp_frame);
+		*ret = pp->pp_frame;
+		coremap_drop_upage(pa);
+		coremap_lock_release();
+		kfree(newpp);
+		return 0;
+	}
+
+	bucket = PAGECACHE_HASH(offset);
+	newpp->pp_cache = pc;
+	newpp->pp_offset = offset;
+	newpp->pp_frame = pa;
+	newpp->pp_next = pc->pc_pages[bucket];
+	pc->pc_pages[bucket] = newpp;
+	pc->pc_npages++;
+	coremap_cache_upage(pa, newpp, pc->pc_vnode == NULL);
+	coremap_share_upage(pa);
+	*ret = pa;
+	coremap_lock_release();
+	return 0;
+}
+
+int
+pagecache_writeback(struct pagecache *pc, off_t offset, paddr_t pa)
+{
+	struct iovec iov;
+	struct uio u;
+	struct stat st;
+	size_t len;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	if (pc->pc_vnode == NULL) {
+		return 0;
+	}
+
+	result = VOP_STAT(pc->pc_vnode, &st);
+	if (result) {
+		return result;
+	}
+	if (offset >= st.st_size) {
+		return 0;
+	}
+	len = PAGE_SIZE;
+	if (st.st_size - offset < PAGE_SIZE) {
+		len = st.st_size - offset;
+	}
+
+	uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(pa), len, offset,
+		  UIO_WRITE);
+	result = VOP_WRITE(pc->pc_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
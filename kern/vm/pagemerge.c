@@ -0,0 +1,325 @@
+/*
+ * Same-page merging. See pagemerge.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagemerge.h>
+#include <uw-vmstats.h>
+
+/*
+ * A page the scanner has seen. In the stable table, a frame holding
+ * merged pages; in the unstable table, a page seen earlier in this
+ * pass, and the page of which address space it was.
+ */
+struct mergenode {
+	uint32_t mn_hash;		/* hash of the contents */
+	paddr_t mn_frame;
+	struct addrspace *mn_as;	/* unstable: owner (never followed) */
+	vaddr_t mn_va;			/* unstable: virtual page */
+	struct mergenode *mn_next;
+};
+
+/*
+ * Only the scanner thread uses these, so they need no lock. Nodes are
+ * only hints: the frames they name are checked in the coremap before
+ * anything is done with them.
+ */
+static struct mergenode *pagemerge_stable[PAGEMERGE_NBUCKETS];
+static struct mergenode *pagemerge_unstable[PAGEMERGE_NBUCKETS];
+static unsigned pagemerge_cursor;	/* next frame to look at */
+static unsigned pagemerge_seen;		/* frames looked at this pass */
+
+static volatile unsigned pagemerge_rate = PAGEMERGE_RATE;
+
+/* Where the scanner waits while it is turned off. */
+static struct wchan *pagemerge_wchan;
+
+/*
+ * FNV-1a, a word at a time.
+ */
+static
+uint32_t
+pagemerge_hash(paddr_t pa)
+{
+	const uint32_t *p;
+	uint32_t h;
+	unsigned i;
+
+	p = (const uint32_t *)PADDR_TO_KVADDR(pa);
+	h = 2166136261U;
+	for (i=0; i<PAGE_SIZE / sizeof(uint32_t); i++) {
+		h = (h ^ p[i]) * 16777619U;
+	}
+	return h;
+}
+
+static
+bool
+pagemerge_same(paddr_t a, paddr_t b)
+{
+	const uint32_t *pa, *pb;
+	unsigned i;
+
+	pa = (const uint32_t *)PADDR_TO_KVADDR(a);
+	pb = (const uint32_t *)PADDR_TO_KVADDR(b);
+	for (i=0; i<PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (pa[i] != pb[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Merge PA, page VA of AS, into a merged frame with the same contents
+ * if there is one. Returns true if PA is dealt with: merged, or no
+ * longer AS's to merge.
+ */
+static
+bool
+pagemerge_try_stable(paddr_t pa, struct addrspace *as, vaddr_t va,
+		     uint32_t hash)
+{
+	struct mergenode *mn, **mnp;
+	bool frozen;
+
+	frozen = false;
+	mnp = &pagemerge_stable[hash % PAGEMERGE_NBUCKETS];
+	while ((mn = *mnp) != NULL) {
+		if (mn->mn_hash != hash) {
+			mnp = &mn->mn_next;
+			continue;
+		}
+		if (!coremap_merge_getref(mn->mn_frame)) {
+			/* Everyone else has written to it, or let it go. */
+			*mnp = mn->mn_next;
+			kfree(mn);
+			continue;
+		}
+		if (!frozen) {
+			if (!coremap_merge_freeze(pa, as, va)) {
+				coremap_free_upage(mn->mn_frame);
+				return true;
+			}
+			frozen = true;
+		}
+		if (pagemerge_same(pa, mn->mn_frame)) {
+			coremap_merge_commit(pa, mn->mn_frame);
+			return true;
+		}
+		coremap_free_upage(mn->mn_frame);
+		mnp = &mn->mn_next;
+	}
+
+	if (frozen) {
+		coremap_merge_thaw(pa);
+	}
+	return false;
+}
+
+/*
+ * Merge PA, page VA of AS, with a page seen earlier in this pass that
+ * has the same hash, if it still has the same contents. The two then
+ * share a frame, which goes in the stable table. Returns true if PA
+ * is dealt with, as for pagemerge_try_stable.
+ */
+static
+bool
+pagemerge_try_unstable(paddr_t pa, struct addrspace *as, vaddr_t va,
+		       uint32_t hash)
+{
+	struct mergenode *mn, **mnp;
+	unsigned bucket;
+
+	bucket = hash % PAGEMERGE_NBUCKETS;
+	for (mnp = &pagemerge_unstable[bucket]; *mnp != NULL;
+	     mnp = &(*mnp)->mn_next) {
+		if ((*mnp)->mn_hash == hash && (*mnp)->mn_frame != pa) {
+			break;
+		}
+	}
+	mn = *mnp;
+	if (mn == NULL) {
+		return false;
+	}
+	/* Whatever happens, it's no use as a candidate any more. */
+	*mnp = mn->mn_next;
+
+	if (!coremap_merge_freeze(pa, as, va)) {
+		kfree(mn);
+		return true;
+	}
+	if (!coremap_merge_freeze(mn->mn_frame, mn->mn_as, mn->mn_va)) {
+		coremap_merge_thaw(pa);
+		kfree(mn);
+		return false;
+	}
+	if (!pagemerge_same(pa, mn->mn_frame)) {
+		coremap_merge_thaw(mn->mn_frame);
+		coremap_merge_thaw(pa);
+		kfree(mn);
+		return false;
+	}
+	if (!coremap_merge_share(mn->mn_frame)) {
+		coremap_merge_thaw(pa);
+		kfree(mn);
+		return false;
+	}
+	coremap_merge_commit(pa, mn->mn_frame);
+
+	mn->mn_as = NULL;
+	mn->mn_va = 0;
+	mn->mn_next = pagemerge_stable[bucket];
+	pagemerge_stable[bucket] = mn;
+	return true;
+}
+
+/*
+ * Look at PA, page VA of AS.
+ */
+static
+void
+pagemerge_page(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+	struct mergenode *mn;
+	uint32_t hash;
+	unsigned bucket;
+
+	vmstats_inc(VMSTAT_MERGE_SCAN);
+
+	hash = pagemerge_hash(pa);
+	if (pagemerge_try_stable(pa, as, va, hash) ||
+	    pagemerge_try_unstable(pa, as, va, hash)) {
+		return;
+	}
+
+	/* Remember it for the rest of the pass. */
+	mn = kmalloc(sizeof(struct mergenode));
+	if (mn == NULL) {
+		return;
+	}
+	bucket = hash % PAGEMERGE_NBUCKETS;
+	mn->mn_hash = hash;
+	mn->mn_frame = pa;
+	mn->mn_as = as;
+	mn->mn_va = va;
+	mn->mn_next = pagemerge_unstable[bucket];
+	pagemerge_unstable[bucket] = mn;
+}
+
+/*
+ * End of a pass over memory: forget the pages seen, which will have
+ * changed by the time we come round again, and merged frames that
+ * aren't shared any more.
+ */
+static
+void
+pagemerge_endpass(void)
+{
+	struct mergenode *mn, **mnp;
+	unsigned i;
+
+	for (i=0; i<PAGEMERGE_NBUCKETS; i++) {
+		while (pagemerge_unstable[i] != NULL) {
+			mn = pagemerge_unstable[i];
+			pagemerge_unstable[i] = mn->mn_next;
+			kfree(mn);
+		}
+
+		mnp = &pagemerge_stable[i];
+		while ((mn = *mnp) != NULL) {
+			if (coremap_merge_getref(mn->mn_frame)) {
+				coremap_free_upage(mn->mn_frame);
+				mnp = &mn->mn_next;
+			}
+			else {
+				*mnp = mn->mn_next;
+				kfree(mn);
+			}
+		}
+	}
+}
+
+/*
+ * The scanner. Each second it looks at pagemerge_rate frames, going
+ * round the coremap in order.
+ */
+static
+void
+pagemerge_thread(void *unused1, unsigned long unused2)
+{
+	struct addrspace *as;
+	unsigned total, budget, count;
+	paddr_t pa;
+	vaddr_t va;
+
+	(void)unused1;
+	(void)unused2;
+
+	total = coremap_totalpages();
+	while (1) {
+		wchan_lock(pagemerge_wchan);
+		if (pagemerge_rate == 0) {
+			wchan_sleep(pagemerge_wchan);
+			continue;
+		}
+		wchan_unlock(pagemerge_wchan);
+
+		for (budget = pagemerge_rate; budget > 0; budget -= count) {
+			/* Stop at the end of the pass. */
+			count = budget;
+			if (count > total - pagemerge_seen) {
+				count = total - pagemerge_seen;
+			}
+			pa = coremap_merge_next(&pagemerge_cursor, &count,
+						&as, &va);
+			if (pa != 0) {
+				pagemerge_page(pa, as, va);
+			}
+			pagemerge_seen += count;
+			if (pagemerge_seen == total) {
+				pagemerge_endpass();
+				pagemerge_seen = 0;
+			}
+		}
+		clocksleep(1);
+	}
+}
+
+void
+pagemerge_bootstrap(void)
+{
+	int result;
+
+	pagemerge_wchan = wchan_create("pagemerge");
+	if (pagemerge_wchan == NULL) {
+		panic("pagemerge: Could not create wchan\n");
+	}
+
+	result = thread_fork("pagemerge", NULL, pagemerge_thread, NULL, 0);
+	if (result) {
+		kprintf("pagemerge: thread_fork: %s; not merging pages\n",
+			strerror(result));
+	}
+}
+
+void
+pagemerge_setrate(unsigned pages)
+{
+	pagemerge_rate = pages;
+	if (pagemerge_wchan != NULL) {
+		wchan_wakeone(pagemerge_wchan);
+	}
+}
+
+unsigned
+pagemerge_getrate(void)
+{
+	return pagemerge_rate;
+}
@@ -0,0 +1,102 @@
+/*
+ * The pageout daemon. See pageout.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <wchan.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pageout.h>
+#include <uw-vmstats.h>
+
+/* Free frames below which the daemon runs, and up to which it reclaims. */
+static unsigned pageout_low;
+static unsigned pageout_high;
+
+/* Where the daemon waits for memory to run low. */
+static struct wchan *pageout_wchan;
+
+/*
+ * The daemon itself.
+ *
+ * Free memory is checked with the wchan locked, so a pageout_check
+ * that finds it low after that can't miss the daemon going to sleep.
+ * If the clock finds nothing to evict (everything is pinned, shared,
+ * or dirty with swap full), the daemon waits for the next wakeup
+ * rather than trying again straight away.
+ */
+static
+void
+pageout_thread(void *unused1, unsigned long unused2)
+{
+	bool stuck;
+
+	(void)unused1;
+	(void)unused2;
+
+	stuck = false;
+	while (1) {
+		wchan_lock(pageout_wchan);
+		if (stuck || coremap_freepages() >= pageout_low) {
+			wchan_sleep(pageout_wchan);
+			stuck = false;
+			continue;
+		}
+		wchan_unlock(pageout_wchan);
+
+		vmstats_inc(VMSTAT_PAGEOUT_RUN);
+		while (coremap_freepages() < pageout_high) {
+			if (coremap_reclaim() == 0) {
+				stuck = true;
+				break;
+			}
+		}
+	}
+}
+
+void
+pageout_bootstrap(void)
+{
+	unsigned total;
+	int result;
+
+	total = coremap_totalpages();
+	pageout_low = total / PAGEOUT_LOW_DIV;
+	if (pageout_low < PAGEOUT_LOW_MIN) {
+		pageout_low = PAGEOUT_LOW_MIN;
+	}
+	pageout_high = total / PAGEOUT_HIGH_DIV;
+	if (pageout_high < 2 * pageout_low) {
+		pageout_high = 2 * pageout_low;
+	}
+
+	pageout_wchan = wchan_create("pageout");
+	if (pageout_wchan == NULL) {
+		panic("pageout: Could not create wchan\n");
+	}
+
+	result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if (result) {
+		kprintf("pageout: thread_fork: %s; evicting on demand\n",
+			strerror(result));
+		wchan_destroy(pageout_wchan);
+		pageout_wchan = NULL;
+		return;
+	}
+
+	kprintf("pageout: %u/%u free frames low/high watermark\n",
+		pageout_low, pageout_high);
+}
+
+void
+pageout_check(void)
+{
+	if (pageout_wchan == NULL) {
+		return;
+	}
+	if (coremap_freepages() < pageout_low) {
+		wchan_wakeone(pageout_wchan);
+	}
+}
@@ -0,0 +1,182 @@
+/*
+ * Two-level page tables for user address spaces. See pagetable.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_NENTRIES; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+	pte_t *tbl;
+
+	for (i=0; i<PT_NENTRIES; i++) {
+		tbl = pt->pt_dir[i];
+		if (tbl == NULL) {
+			continue;
+		}
+		coremap_lock_acquire();
+		for (j=0; j<PT_NENTRIES; j++) {
+			if (tbl[j] & (PTE_VALID | PTE_BUSY)) {
+				coremap_drop_upage(tbl[j] & PTE_FRAME);
+			}
+			else if (tbl[j] & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(tbl[j]));
+			}
+		}
+		coremap_lock_release();
+		kfree(tbl);
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t va, bool create)
+{
+	pte_t *tbl;
+	unsigned i;
+
+	tbl = pt->pt_dir[PT_DIR_INDEX(va)];
+	if (tbl == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		tbl = kmalloc(PT_NENTRIES * sizeof(pte_t));
+		if (tbl == NULL) {
+			return NULL;
+		}
+		for (i=0; i<PT_NENTRIES; i++) {
+			tbl[i] = 0;
+		}
+		pt->pt_dir[PT_DIR_INDEX(va)] = tbl;
+	}
+	return &tbl[PT_TBL_INDEX(va)];
+}
+/*
+ * Throw away the pages in [START, END): frames are dropped, swap slots
+ * freed, and the entries zeroed, so the pages are refilled from their
+ * region if they are used again. A page that is being evicted is left
+ * to the evictor, as in pt_destroy. The caller shoots down any TLB
+ * entries.
+ */
+void
+pt_unmap(struct pagetable *pt, vaddr_t start, vaddr_t end)
+{
+	pte_t *pte;
+	vaddr_t va;
+
+	KASSERT((start & PAGE_FRAME) == start);
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(pt, va, false);
+		if (pte == NULL) {
+			/* No second-level table; skip to the next one. */
+			va |= PT_NENTRIES * PAGE_SIZE - PAGE_SIZE;
+			continue;
+		}
+		coremap_lock_acquire();
+		if (*pte & (PTE_VALID | PTE_BUSY)) {
+			coremap_drop_upage(*pte & PTE_FRAME);
+		}
+		else if (*pte & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(*pte));
+		}
+		*pte = 0;
+		coremap_lock_release();
+	}
+}
+
+/*
+ * Share every resident page with the new page table. All of them
+ * lose PTE_WRITE on both sides and are marked PTE_COW, so whichever
+ * side writes first takes a private copy (see vm_fault). Pages of
+ * shared file mappings are shared as they are; the new side starts
+ * out clean and read-only, so that its own writes are noticed. Pages that
+ * were never touched stay that way in the copy and will be filled on
+ * demand, from the same source, when the new address space touches
+ * them. Pages in swap get a copy of their slot.
+ *
+ * The caller must flush any TLB entries that still allow writes to
+ * OLD's pages.
+ *
+ * On error, whatever was shared so far is left in NEW for pt_destroy
+ * to clean up.
+ */
+int
+pt_copy(struct pagetable *old, struct pagetable *new)
+{
+	unsigned i, j, slot;
+	pte_t *oldtbl, *newpte;
+	vaddr_t va;
+	int result;
+
+	for (i=0; i<PT_NENTRIES; i++) {
+		oldtbl = old->pt_dir[i];
+		if (oldtbl == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_NENTRIES; j++) {
+			/* Nothing but us makes an entry nonzero. */
+			if (oldtbl[j] == 0) {
+				continue;
+			}
+			va = (i << 22) | (j << 12);
+			newpte = pt_lookup(new, va, true);
+			if (newpte == NULL) {
+				return ENOMEM;
+			}
+
+			coremap_lock_acquire();
+			while (oldtbl[j] & PTE_BUSY) {
+				coremap_wait_evict();
+			}
+			if (oldtbl[j] & PTE_SHARED) {
+				/* Both sides see each other's writes. */
+				KASSERT(oldtbl[j] & PTE_VALID);
+				coremap_share_upage(oldtbl[j] & PTE_FRAME);
+				*newpte = oldtbl[j] & ~(PTE_WRITE | PTE_DIRTY);
+			}
+			else if (oldtbl[j] & PTE_VALID) {
+				oldtbl[j] &= ~PTE_WRITE;
+				oldtbl[j] |= PTE_COW;
+				coremap_share_upage(oldtbl[j] & PTE_FRAME);
+				*newpte = oldtbl[j];
+				vmstats_inc(VMSTAT_COW_SHARED);
+			}
+			coremap_lock_release();
+
+			/* Only we can change an entry that is in swap. */
+			if (oldtbl[j] & PTE_SWAPPED) {
+				result = swap_copy(PTE_SLOT(oldtbl[j]), &slot);
+				if (result) {
+					return result;
+				}
+				*newpte = SLOT_TO_PTE(slot);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Shared memory segments. See shm.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <shm.h>
+
+/*
+ * The segments that haven't been removed, in a table where a free
+ * slot is NULL, and those that have but may still be attached. Each
+ * segment holds one reference to its page cache, and every region
+ * attaching it another. shm_lock protects both, and shm_npages, the
+ * pages of all of them: a removed segment's memory counts until it
+ * has actually been freed.
+ */
+struct shmseg {
+	int ss_key;
+	unsigned ss_npages;
+	struct pagecache *ss_cache;
+	struct shmseg *ss_next;		/* on shm_removed */
+};
+
+static struct shmseg *shm_segs[SHM_MAXSEGS];
+static struct shmseg *shm_removed;
+static unsigned shm_npages;
+static struct lock *shm_lock;
+
+void
+shm_bootstrap(void)
+{
+	shm_lock = lock_create("shm");
+	if (shm_lock == NULL) {
+		panic("shm: Could not create lock\n");
+	}
+}
+
+/*
+ * Return the segment with key KEY, or NULL. Called with shm_lock held.
+ */
+static
+struct shmseg *
+shm_find(int key)
+{
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(shm_lock));
+
+	for (i=0; i<SHM_MAXSEGS; i++) {
+		if (shm_segs[i] != NULL && shm_segs[i]->ss_key == key) {
+			return shm_segs[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Free the removed segments nobody has attached any more. Called with
+ * shm_lock held.
+ */
+static
+void
+shm_reap(void)
+{
+	struct shmseg **ssp, *ss;
+
+	KASSERT(lock_do_i_hold(shm_lock));
+
+	ssp = &shm_removed;
+	while (*ssp != NULL) {
+		ss = *ssp;
+		/*
+		 * Nobody can attach it again, and fork only copies
+		 * references regions already have, so once ours is
+		 * the last it stays the last.
+		 */
+		if (!pagecache_lastref(ss->ss_cache)) {
+			ssp = &ss->ss_next;
+			continue;
+		}
+		*ssp = ss->ss_next;
+		pagecache_decref(ss->ss_cache);
+		shm_npages -= ss->ss_npages;
+		kfree(ss);
+	}
+}
+
+int
+shm_create(int key, size_t len)
+{
+	struct shmseg *ss;
+	unsigned i, npages;
+	int result;
+
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (npages == 0 || npages < len / PAGE_SIZE) {
+		return EINVAL;
+	}
+
+	lock_acquire(shm_lock);
+	if (shm_find(key) != NULL) {
+		lock_release(shm_lock);
+		return EEXIST;
+	}
+	for (i=0; i<SHM_MAXSEGS; i++) {
+		if (shm_segs[i] == NULL) {
+			break;
+		}
+	}
+	if (i == SHM_MAXSEGS) {
+		lock_release(shm_lock);
+		return ENOSPC;
+	}
+	shm_reap();
+	if (npages > coremap_totalpages() / SHM_MAXDIV - shm_npages) {
+		lock_release(shm_lock);
+		return ENOMEM;
+	}
+
+	ss = kmalloc(sizeof(*ss));
+	if (ss == NULL) {
+		lock_release(shm_lock);
+		return ENOMEM;
+	}
+	result = pagecache_anon(&ss->ss_cache);
+	if (result) {
+		kfree(ss);
+		lock_release(shm_lock);
+		return result;
+	}
+	ss->ss_key = key;
+	ss->ss_npages = npages;
+	ss->ss_next = NULL;
+	shm_segs[i] = ss;
+	shm_npages += npages;
+	lock_release(shm_lock);
+	return 0;
+}
+
+int
+shm_attach(struct addrspace *as, int key, vaddr_t *ret)
+{
+	struct shmseg *ss;
+	struct pagecache *pc;
+	unsigned npages;
+	int result;
+
+	lock_acquire(shm_lock);
+	ss = shm_find(key);
+	if (ss == NULL) {
+		lock_release(shm_lock);
+		return ENOENT;
+	}
+	pc = ss->ss_cache;
+	npages = ss->ss_npages;
+	/* The region's reference. */
+	pagecache_incref(pc);
+	lock_release(shm_lock);
+
+	result = as_map(as, pc, 0, npages * PAGE_SIZE,
+			PROT_READ | PROT_WRITE, true, ret);
+	if (result) {
+		pagecache_decref(pc);
+	}
+	return result;
+}
+
+int
+shm_detach(struct addrspace *as, vaddr_t addr)
+{
+	struct region *rg;
+
+	rg = as_find_region(as, addr);
+	if (rg == NULL || rg->rg_vbase != addr || rg->rg_cache == NULL ||
+	    !pagecache_isanon(rg->rg_cache)) {
+		return EINVAL;
+	}
+	return as_unmap(as, addr, rg->rg_npages * PAGE_SIZE);
+}
+
+int
+shm_remove(int key)
+{
+	struct shmseg *ss;
+	unsigned i;
+
+	lock_acquire(shm_lock);
+	for (i=0; i<SHM_MAXSEGS; i++) {
+		if (shm_segs[i] != NULL && shm_segs[i]->ss_key == key) {
+			break;
+		}
+	}
+	if (i == SHM_MAXSEGS) {
+		lock_release(shm_lock);
+		return ENOENT;
+	}
+	ss = shm_segs[i];
+	shm_segs[i] = NULL;
+	ss->ss_next = shm_removed;
+	shm_removed = ss;
+
+	/* Frees the memory now, unless the segment is still attached. */
+	shm_reap();
+	lock_release(shm_lock);
+	return 0;
+}
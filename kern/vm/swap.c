@@ -0,0 +1,356 @@
+/*
+ * Swap space. See swap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <swap.h>
+#include <zswap.h>
+#include <uw-vmstats.h>
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;
+static unsigned swap_nslots;
+
+/*
+ * Protects swap_map. It's a spinlock so slots can be allocated and
+ * freed while holding the coremap lock.
+ */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Where pages spilled from the compressed tier are decompressed on
+ * their way to disk, and the lock that protects it.
+ */
+static char swap_spillbuf[PAGE_SIZE];
+static struct lock *swap_spilllock;
+
+/* Times to spill a page from the compressed tier to make room. */
+#define SWAP_SPILLTRIES 4
+
+void
+swap_bootstrap(void)
+{
+	char path[] = SWAP_DEVICE;
+	struct stat st;
+	int result;
+
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: %s: stat: %s\n", SWAP_DEVICE, strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: Could not create slot bitmap\n");
+	}
+
+	swap_spilllock = lock_create("swapspill");
+	if (swap_spilllock == NULL) {
+		panic("swap: Could not create lock\n");
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+
+	zswap_bootstrap(swap_nslots);
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	spinlock_acquire(&swap_lock);
+	if (swap_map == NULL) {
+		spinlock_release(&swap_lock);
+		return ENOSPC;
+	}
+	result = bitmap_alloc(swap_map, slot);
+	spinlock_release(&swap_lock);
+	return result;
+}
+
+int
+swap_alloc_cluster(unsigned npages, unsigned *slot)
+{
+	unsigned i, run;
+
+	KASSERT(npages > 0);
+
+	spinlock_acquire(&swap_lock);
+	if (swap_map == NULL) {
+		spinlock_release(&swap_lock);
+		return ENOSPC;
+	}
+	run = 0;
+	for (i=0; i<swap_nslots && run<npages; i++) {
+		run = bitmap_isset(swap_map, i) ? 0 : run + 1;
+	}
+	if (run < npages) {
+		spinlock_release(&swap_lock);
+		return ENOSPC;
+	}
+	*slot = i - npages;
+	for (i=0; i<npages; i++) {
+		bitmap_mark(swap_map, *slot + i);
+	}
+	spinlock_release(&swap_lock);
+	return 0;
+}
+
+void
+swap_free(unsigned slot)
+{
+	spinlock_acquire(&swap_lock);
+	KASSERT(slot < swap_nslots);
+	KASSERT(bitmap_isset(swap_map, slot));
+	/* If it's being spilled, swap_spill frees it afterwards. */
+	if (zswap_free(slot)) {
+		bitmap_unmark(swap_map, slot);
+	}
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Read slot SLOT from disk into kernel address KVA.
+ */
+static
+int
+swap_readdisk(vaddr_t kva, unsigned slot)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &u, (void *)kva, PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swap_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		/* The slot was past the end of the disk?? */
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Write the NPAGES pages at kernel addresses KVAS[] to the slots on
+ * disk starting at SLOT, in one request.
+ */
+static
+int
+swap_writedisk(const vaddr_t *kvas, unsigned npages, unsigned slot)
+{
+	struct iovec iov[SWAP_MAXCLUSTER];
+	struct uio u;
+	unsigned i;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(npages > 0 && npages <= SWAP_MAXCLUSTER);
+	KASSERT(slot + npages <= swap_nslots);
+
+	for (i=0; i<npages; i++) {
+		iov[i].iov_kbase = (void *)kvas[i];
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = npages;
+	u.uio_offset = (off_t)slot * PAGE_SIZE;
+	u.uio_resid = npages * PAGE_SIZE;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = UIO_WRITE;
+	u.uio_space = NULL;
+
+	result = VOP_WRITE(swap_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+	vmstats_add(VMSTAT_SWAP_FILE_WRITE, npages);
+	vmstats_inc(VMSTAT_SWAP_CLUSTER_WRITE);
+	return 0;
+}
+
+/*
+ * Move the coldest page in the compressed tier out to disk. Returns
+ * ENOENT if the tier is empty.
+ */
+static
+int
+swap_spill(void)
+{
+	vaddr_t kva;
+	unsigned slot;
+	int result;
+
+	kva = (vaddr_t)swap_spillbuf;
+
+	lock_acquire(swap_spilllock);
+	result = zswap_spill_begin(kva, &slot);
+	if (result) {
+		lock_release(swap_spilllock);
+		return result;
+	}
+	result = swap_writedisk(&kva, 1, slot);
+	if (result) {
+		panic("swap: Writing slot %u: %s\n", slot, strerror(result));
+	}
+	vmstats_inc(VMSTAT_ZSWAP_SPILL);
+	if (zswap_spill_end(slot)) {
+		spinlock_acquire(&swap_lock);
+		bitmap_unmark(swap_map, slot);
+		spinlock_release(&swap_lock);
+	}
+	lock_release(swap_spilllock);
+	return 0;
+}
+
+/*
+ * Try to keep the page at KVA, bound for slot SLOT, in the compressed
+ * tier, spilling cold pages to disk if there's no room. Returns
+ * nonzero if the page has to go to disk itself.
+ */
+static
+int
+swap_compress(vaddr_t kva, unsigned slot)
+{
+	unsigned tries;
+	int result;
+
+	for (tries = 0; ; tries++) {
+		result = zswap_store(kva, slot);
+		if (result != ENOSPC || tries == SWAP_SPILLTRIES) {
+			break;
+		}
+		if (swap_spill()) {
+			break;
+		}
+	}
+	if (result) {
+		vmstats_inc(VMSTAT_ZSWAP_REJECT);
+	}
+	return result;
+}
+
+/*
+ * Fetch slot SLOT's page into KVA, from wherever it is.
+ */
+static
+int
+swap_load(vaddr_t kva, unsigned slot, bool *compressed)
+{
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	/* Once a spilled page can't be loaded, it's on disk. */
+	if (zswap_load(kva, slot) == 0) {
+		*compressed = true;
+		return 0;
+	}
+	*compressed = false;
+	return swap_readdisk(kva, slot);
+}
+
+int
+swap_read(paddr_t pa, unsigned slot, bool *compressed)
+{
+	return swap_load(PADDR_TO_KVADDR(pa), slot, compressed);
+}
+
+int
+swap_write(paddr_t pa, unsigned slot)
+{
+	return swap_write_cluster(&pa, 1, slot);
+}
+
+int
+swap_write_cluster(const paddr_t *pas, unsigned npages, unsigned slot)
+{
+	vaddr_t kvas[SWAP_MAXCLUSTER];
+	unsigned i, start;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(npages > 0 && npages <= SWAP_MAXCLUSTER);
+
+	/*
+	 * Pages that compress stay in memory; write the runs of pages
+	 * between them to disk.
+	 */
+	start = 0;
+	for (i=0; i<npages; i++) {
+		kvas[i] = PADDR_TO_KVADDR(pas[i]);
+		if (swap_compress(kvas[i], slot + i) != 0) {
+			continue;
+		}
+		if (i > start) {
+			result = swap_writedisk(&kvas[start], i - start,
+						slot + start);
+			if (result) {
+				return result;
+			}
+		}
+		start = i + 1;
+	}
+	if (npages > start) {
+		return swap_writedisk(&kvas[start], npages - start,
+				      slot + start);
+	}
+	return 0;
+}
+
+int
+swap_copy(unsigned from, unsigned *to)
+{
+	vaddr_t buf;
+	bool compressed;
+	int result;
+
+	buf = (vaddr_t)kmalloc(PAGE_SIZE);
+	if (buf == 0) {
+		return ENOMEM;
+	}
+
+	result = swap_alloc(to);
+	if (result) {
+		kfree((void *)buf);
+		return result;
+	}
+
+	result = swap_load(buf, from, &compressed);
+	if (result == 0 && swap_compress(buf, *to) != 0) {
+		result = swap_writedisk(&buf, 1, *to);
+	}
+	if (result) {
+		swap_free(*to);
+	}
+	kfree((void *)buf);
+	return result;
+}
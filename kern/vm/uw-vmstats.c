@@ -5,7 +5,7 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines) by running with interrupts off.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally.
  */
@@ -14,11 +14,24 @@
 #include <lib.h>
 #include <synch.h>
 #include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
 #include <uw-vmstats.h>
+#include <platform/maxcpus.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
+/* Counters for tracking statistics: a set for each CPU, which only that
+ * CPU changes, so that counting doesn't serialize the CPUs. They are
+ * added up when read.
+ */
+static unsigned int stats_cpu_counts[MAXCPUS][VMSTAT_COUNT];
+
+/* The totals as of the last vmstats_snapshot reset, so that resetting
+ * doesn't have to write to other CPUs' counters.
+ */
+static unsigned int stats_base[VMSTAT_COUNT];
 
+/* Protects stats_base */
 struct spinlock stats_lock = SPINLOCK_INITIALIZER;
 
 /* Strings used in printing out the statistics */
@@ -33,17 +46,83 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "COW Faults",
+ /* 11 */ "COW Page Copies",
+ /* 12 */ "COW Pages Shared",
+ /* 13 */ "Page Evictions",
+ /* 14 */ "Eviction Time (usec)",
+ /* 15 */ "Zero Pool Hits",
+ /* 16 */ "Zero Pool Misses",
+ /* 17 */ "Fault-around Preloads",
+ /* 18 */ "Page Cache Hits",
+ /* 19 */ "Page Cache Misses",
+ /* 20 */ "Faults in Text",
+ /* 21 */ "Faults in Data",
+ /* 22 */ "Faults in Heap",
+ /* 23 */ "Faults in Stack",
+ /* 24 */ "Faults in Mapped Files",
+ /* 25 */ "TLB Shootdowns Sent",
+ /* 26 */ "Frame Cache Hits",
+ /* 27 */ "Frame Cache Misses",
+ /* 28 */ "Pageout Daemon Runs",
+ /* 29 */ "Pageout Daemon Evictions",
+ /* 30 */ "Swapfile Write Requests",
+ /* 31 */ "Compressed Swap Stores",
+ /* 32 */ "Compressed Swap Rejects",
+ /* 33 */ "Page Faults (Compressed)",
+ /* 34 */ "Compressed Swap Spills",
+ /* 35 */ "Compressed Bytes Stored",
+ /* 36 */ "Compression Time (usec)",
+ /* 37 */ "Merge Candidates Scanned",
+ /* 38 */ "Pages Merged",
+ /* 39 */ "Merged Pages Unshared",
+ /* 40 */ "Processes Deactivated",
+ /* 41 */ "Processes Reactivated",
+ /* 42 */ "Load Control Swapouts",
 };
 
+/* ---------------------------------------------------------------------- */
+/* Add up the counters of all the CPUs.
+ * Another CPU may be counting meanwhile, so this is only a snapshot.
+ */
+static
+void
+vmstats_sum(unsigned int *totals)
+{
+  int i, j;
+
+  for (i=0; i<VMSTAT_COUNT; i++) {
+    totals[i] = 0;
+    for (j=0; j<MAXCPUS; j++) {
+      totals[i] += stats_cpu_counts[j][i];
+    }
+  }
+}
+
 
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
+    int spl;
+
+    /* Stay on this CPU. */
+    spl = splhigh();
       _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+    splx(spl);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Assumes vmstat_init has already been called */
+void
+vmstats_add(unsigned int index, unsigned int amount)
+{
+    int spl;
+
+    spl = splhigh();
+      _vmstats_add(index, amount);
+    splx(spl);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,7 +144,15 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  stats_cpu_counts[curcpu->c_number][index]++;
+}
+
+/* ---------------------------------------------------------------------- */
+void
+_vmstats_add(unsigned int index, unsigned int amount)
+{
+  KASSERT(index < VMSTAT_COUNT);
+  stats_cpu_counts[curcpu->c_number][index] += amount;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -73,6 +160,7 @@ void
 _vmstats_init(void)
 {
   int i = 0;
+  int j = 0;
 
   if (sizeof(stats_names) / sizeof(char *) != VMSTAT_COUNT) {
     kprintf("vmstats_init: number of stats_names = %d != VMSTAT_COUNT = %d\n",
@@ -81,11 +169,32 @@ _vmstats_init(void)
   }
 
   for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+    for (j=0; j<MAXCPUS; j++) {
+      stats_cpu_counts[j][i] = 0;
+    }
+    stats_base[i] = 0;
   }
 
 }
 
+/* ---------------------------------------------------------------------- */
+void
+vmstats_snapshot(unsigned int *counts, bool reset)
+{
+  unsigned int totals[VMSTAT_COUNT];
+  int i = 0;
+
+  spinlock_acquire(&stats_lock);
+    vmstats_sum(totals);
+    for (i=0; i<VMSTAT_COUNT; i++) {
+      counts[i] = totals[i] - stats_base[i];
+      if (reset) {
+        stats_base[i] = totals[i];
+      }
+    }
+  spinlock_release(&stats_lock);
+}
+
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
 /* NOTE: We do not grab the spinlock here because kprintf may block
@@ -96,12 +205,20 @@ _vmstats_init(void)
 void
 vmstats_print(void)
 {
+  unsigned int stats_counts[VMSTAT_COUNT];
   int i = 0;
   int free_plus_replace = 0;
   int disk_plus_zeroed_plus_reload = 0;
   int tlb_faults = 0;
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
+  int cow_saved = 0;
+  int evictions = 0;
+  int zero_allocs = 0;
+  int region_faults = 0;
+  int zswap_avg = 0;
+
+  vmstats_sum(stats_counts);
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
@@ -110,9 +227,13 @@ vmstats_print(void)
 
   tlb_faults = stats_counts[VMSTAT_TLB_FAULT];
   free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
+  /* a page found in the page cache or the compressed swap tier is
+   * neither zeroed nor read from disk */
   disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
-    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
+    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD] +
+    stats_counts[VMSTAT_PAGECACHE_HIT] + stats_counts[VMSTAT_ZSWAP_LOAD];
+  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ] +
+    stats_counts[VMSTAT_PAGECACHE_MISS];
   disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
@@ -121,17 +242,100 @@ vmstats_print(void)
       tlb_faults, free_plus_replace); 
   }
 
-  kprintf("VMSTAT TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) = %d\n",
+  kprintf("VMSTAT TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) + Page Cache Hits + Page Faults (Compressed) = %d\n",
     disk_plus_zeroed_plus_reload);
   if (tlb_faults != disk_plus_zeroed_plus_reload) {
-    kprintf("WARNING: TLB Faults (%d) != TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) (%d)\n",
+    kprintf("WARNING: TLB Faults (%d) != TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) + Page Cache Hits + Page Faults (Compressed) (%d)\n",
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
-  kprintf("VMSTAT ELF File reads + Swapfile reads = %d\n", elf_plus_swap_reads);
+  kprintf("VMSTAT ELF File reads + Swapfile reads + Page Cache Misses = %d\n", elf_plus_swap_reads);
   if (disk_reads != elf_plus_swap_reads) {
-    kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
+    kprintf("WARNING: ELF File reads + Swapfile reads + Page Cache Misses != Page Faults (Disk) %d\n",
       elf_plus_swap_reads);
   }
+
+  /* pages shared by fork that never had to be copied */
+  cow_saved = stats_counts[VMSTAT_COW_SHARED] - stats_counts[VMSTAT_COW_COPY];
+  kprintf("VMSTAT COW Pages Shared - COW Page Copies = %d\n", cow_saved);
+
+  evictions = stats_counts[VMSTAT_PAGE_EVICT];
+  if (evictions > 0) {
+    kprintf("VMSTAT Average Eviction Time (usec) = %d\n",
+      stats_counts[VMSTAT_PAGE_EVICT_USEC] / evictions);
+  }
+  if (stats_counts[VMSTAT_PAGEOUT_EVICT] + stats_counts[VMSTAT_LOADCTL_SWAPOUT] >
+      (unsigned)evictions) {
+    kprintf("WARNING: Pageout Daemon Evictions (%d) + Load Control Swapouts (%d) > Page Evictions (%d)\n",
+      stats_counts[VMSTAT_PAGEOUT_EVICT], stats_counts[VMSTAT_LOADCTL_SWAPOUT], evictions);
+  }
+
+  /* a page goes to the swap disk if it doesn't compress (or there's no
+   * room for it), or later when it's spilled from the compressed tier */
+  if (stats_counts[VMSTAT_SWAP_FILE_WRITE] !=
+      stats_counts[VMSTAT_ZSWAP_REJECT] + stats_counts[VMSTAT_ZSWAP_SPILL]) {
+    kprintf("WARNING: Swapfile Writes (%d) != Compressed Swap Rejects + Spills (%d)\n",
+      stats_counts[VMSTAT_SWAP_FILE_WRITE],
+      stats_counts[VMSTAT_ZSWAP_REJECT] + stats_counts[VMSTAT_ZSWAP_SPILL]);
+  }
+  if (stats_counts[VMSTAT_ZSWAP_STORE] > 0) {
+    zswap_avg = stats_counts[VMSTAT_ZSWAP_BYTES] / stats_counts[VMSTAT_ZSWAP_STORE];
+    kprintf("VMSTAT Average Compressed Page (bytes) = %d\n", zswap_avg);
+    if (zswap_avg > 0) {
+      kprintf("VMSTAT Compression Ratio (x100) = %d\n", PAGE_SIZE * 100 / zswap_avg);
+    }
+  }
+  if (stats_counts[VMSTAT_ZSWAP_STORE] + stats_counts[VMSTAT_ZSWAP_REJECT] > 0) {
+    kprintf("VMSTAT Compressed Swap Store Rate (%%) = %d\n",
+      stats_counts[VMSTAT_ZSWAP_STORE] * 100 /
+      (stats_counts[VMSTAT_ZSWAP_STORE] + stats_counts[VMSTAT_ZSWAP_REJECT]));
+  }
+  if (stats_counts[VMSTAT_ZSWAP_LOAD] + stats_counts[VMSTAT_SWAP_FILE_READ] > 0) {
+    kprintf("VMSTAT Compressed Swap Hit Rate (%%) = %d\n",
+      stats_counts[VMSTAT_ZSWAP_LOAD] * 100 /
+      (stats_counts[VMSTAT_ZSWAP_LOAD] + stats_counts[VMSTAT_SWAP_FILE_READ]));
+  }
+
+  /* the pageout daemon writes runs of dirty pages in one request */
+  if (stats_counts[VMSTAT_SWAP_CLUSTER_WRITE] > 0) {
+    kprintf("VMSTAT Average Pages per Swapfile Write = %d\n",
+      stats_counts[VMSTAT_SWAP_FILE_WRITE] / stats_counts[VMSTAT_SWAP_CLUSTER_WRITE]);
+  }
+  if (stats_counts[VMSTAT_SWAP_CLUSTER_WRITE] > stats_counts[VMSTAT_SWAP_FILE_WRITE]) {
+    kprintf("WARNING: Swapfile Write Requests (%d) > Swapfile Writes (%d)\n",
+      stats_counts[VMSTAT_SWAP_CLUSTER_WRITE], stats_counts[VMSTAT_SWAP_FILE_WRITE]);
+  }
+
+  /* each page merged was a candidate the scanner looked at */
+  if (stats_counts[VMSTAT_MERGE_SHARE] > stats_counts[VMSTAT_MERGE_SCAN]) {
+    kprintf("WARNING: Pages Merged (%d) > Merge Candidates Scanned (%d)\n",
+      stats_counts[VMSTAT_MERGE_SHARE], stats_counts[VMSTAT_MERGE_SCAN]);
+  }
+
+  /* only a deactivated process can be reactivated */
+  if (stats_counts[VMSTAT_LOADCTL_REACTIVATE] > stats_counts[VMSTAT_LOADCTL_DEACTIVATE]) {
+    kprintf("WARNING: Processes Reactivated (%d) > Processes Deactivated (%d)\n",
+      stats_counts[VMSTAT_LOADCTL_REACTIVATE], stats_counts[VMSTAT_LOADCTL_DEACTIVATE]);
+  }
+
+  /* every zero-filled page fault takes a frame from the pool or misses */
+  zero_allocs = stats_counts[VMSTAT_ZERO_POOL_HIT] + stats_counts[VMSTAT_ZERO_POOL_MISS];
+  if (zero_allocs > 0) {
+    kprintf("VMSTAT Zero Pool Hit Rate (%%) = %d\n",
+      stats_counts[VMSTAT_ZERO_POOL_HIT] * 100 / zero_allocs);
+  }
+  if (zero_allocs != (int)stats_counts[VMSTAT_PAGE_FAULT_ZERO]) {
+    kprintf("WARNING: Zero Pool Hits + Misses (%d) != Page Faults (Zeroed) (%d)\n",
+      zero_allocs, stats_counts[VMSTAT_PAGE_FAULT_ZERO]);
+  }
+
+  /* every counted TLB fault is in exactly one kind of region */
+  region_faults = stats_counts[VMSTAT_FAULT_TEXT] + stats_counts[VMSTAT_FAULT_DATA] +
+    stats_counts[VMSTAT_FAULT_HEAP] + stats_counts[VMSTAT_FAULT_STACK] +
+    stats_counts[VMSTAT_FAULT_MMAP];
+  if (region_faults != tlb_faults) {
+    kprintf("WARNING: Faults by region (%d) != TLB Faults (%d)\n",
+      region_faults, tlb_faults);
+  }
 }
 /* ---------------------------------------------------------------------- */
@@ -0,0 +1,824 @@
+/*
+ * Demand-paged virtual memory: fault handling.
+ *
+ * Every page of a user address space starts out untouched. The first
+ * access to it traps into vm_fault, which allocates a frame, fills it
+ * (from the executable, or with zeros) and records it in the page
+ * table. Later TLB misses on the same page just reload the TLB from
+ * the page table.
+ *
+ * Pages are mapped read-only until they are first written, even in
+ * writable regions, so that the write faults here and the page can be
+ * marked dirty. Clean pages need not be written to swap when they are
+ * evicted.
+ *
+ * After fork, parent and child share their resident frames
+ * copy-on-write: the first write to one of them lands here as
+ * VM_FAULT_READONLY (or as a write miss) and gets a private copy of
+ * the frame.
+ *
+ * Most TLB misses never get here: the UTLB refill handler in
+ * exception-mips1.S loads resident pages straight from the page table
+ * of the address space this CPU is running, which vm_tlb_activate
+ * publishes in cpupagetables[]. So the TLB fault counts in vmstats
+ * only cover misses that needed the slow path.
+ * While page references are being traced (vmtrace.h), the handler is
+ * bypassed so that every miss comes here.
+ *
+ * When a fault does come here, resident neighbours of the page are
+ * loaded into free TLB slots along with it (see vm_fault_around).
+ *
+ * Pages of files mapped with mmap come from the file's page cache
+ * (pagecache.h), so every process mapping the file uses the same
+ * frames. Private mappings get them copy-on-write, like after fork.
+ * So do the whole pages of an executable's read-only segments, which
+ * means processes running the same program share its text.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/vmtrace.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <mips/tlb.h>
+#include <mips/trapframe.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <zeropool.h>
+#include <pageout.h>
+#include <pagemerge.h>
+#include <pagecache.h>
+#include <loadctl.h>
+#include <shm.h>
+#include <vmpolicy.h>
+#include <vmtrace.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <uw-vmstats.h>
+#include <platform/maxcpus.h>
+
+/*
+ * The address space whose translations each CPU's TLB holds, or NULL
+ * if it may hold translations nobody owns any more. As long as this
+ * matches, switching back to the address space needs no TLB flush.
+ * Kernel threads don't use the TLB, so they leave it alone.
+ */
+static struct addrspace *vm_tlb_owner[MAXCPUS];
+
+/*
+ * Shootdown bookkeeping for each CPU: where to send it IPIs (noted
+ * when it first activates an address space, which it must have done
+ * to be the owner of one), and how many shootdowns it has sent and
+ * carried out.
+ */
+struct vm_tlbcpu {
+	struct cpu *tc_cpu;
+	unsigned tc_sent;		/* shootdowns asked of other CPUs */
+	unsigned tc_received;		/* shootdowns done for other CPUs */
+};
+static struct vm_tlbcpu vm_tlbcpus[MAXCPUS];
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	swap_bootstrap();
+	vmstats_init();
+	vmpolicy_bootstrap();
+	zeropool_bootstrap();
+	pageout_bootstrap();
+	pagecache_bootstrap();
+	pagemerge_bootstrap();
+	vmtrace_bootstrap();
+	loadctl_bootstrap();
+	shm_bootstrap();
+}
+
+/*
+ * Shootdown requests from other CPUs. Called from
+ * interprocessor_interrupt with interrupts off.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	vm_tlbcpus[curcpu->c_number].tc_received++;
+	vm_tlb_flush();
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	vm_tlbcpus[curcpu->c_number].tc_received++;
+	if (ts->ts_allpages) {
+		if (vm_tlb_owner[curcpu->c_number] == ts->ts_addrspace) {
+			vm_tlb_flush();
+		}
+	}
+	else {
+		vm_tlb_invalidate(ts->ts_addrspace, ts->ts_vaddr);
+	}
+}
+
+void
+vm_tlb_printstats(void)
+{
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (vm_tlbcpus[i].tc_sent + vm_tlbcpus[i].tc_received == 0) {
+			continue;
+		}
+		kprintf("cpu%u: tlb shootdowns: %u sent, %u received\n",
+			i, vm_tlbcpus[i].tc_sent, vm_tlbcpus[i].tc_received);
+	}
+}
+
+/*
+ * Work out which part [*LO, *HI) of virtual page VA of region RG comes
+ * from the executable. Returns false if none of it does, and the page
+ * is all zeros.
+ */
+static
+bool
+vm_file_part(struct region *rg, vaddr_t va, vaddr_t *lo, vaddr_t *hi)
+{
+	if (rg->rg_vnode == NULL) {
+		return false;
+	}
+
+	/* Intersect the page with the file-backed part of the region. */
+	*lo = va > rg->rg_fvaddr ? va : rg->rg_fvaddr;
+	*hi = rg->rg_fvaddr + rg->rg_filesize;
+	if (*hi > va + PAGE_SIZE) {
+		*hi = va + PAGE_SIZE;
+	}
+	/* all bss? */
+	return *lo < *hi;
+}
+
+/*
+ * Work out whether page VA of region RG comes from the page cache, and
+ * if so at what *OFFSET in the file. Every page of a mapped file does.
+ * A page of an executable only does if it is file data from end to
+ * end, and lines up with a page of the file.
+ */
+static
+bool
+vm_cache_part(struct region *rg, vaddr_t va, off_t *offset)
+{
+	vaddr_t lo, hi;
+
+	if (rg->rg_cache == NULL) {
+		return false;
+	}
+	if (rg->rg_vnode == NULL) {
+		*offset = rg->rg_cacheoffset + (va - rg->rg_vbase);
+		return true;
+	}
+	if (!vm_file_part(rg, va, &lo, &hi) ||
+	    lo != va || hi != va + PAGE_SIZE) {
+		return false;
+	}
+	*offset = rg->rg_offset + (va - rg->rg_fvaddr);
+	return *offset % PAGE_SIZE == 0;
+}
+
+/*
+ * Fill the frame at PA with virtual page VA of region RG: the bytes
+ * [LO, HI) are read from the executable, and the rest is zeroed.
+ */
+static
+int
+vm_fill_page(struct region *rg, vaddr_t va, paddr_t pa, vaddr_t lo, vaddr_t hi)
+{
+	struct iovec iov;
+	struct uio u;
+	vaddr_t kva;
+	int result;
+
+	kva = PADDR_TO_KVADDR(pa);
+	bzero((void *)kva, lo - va);
+	bzero((void *)(kva + (hi - va)), va + PAGE_SIZE - hi);
+
+	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	vmstats_inc(VMSTAT_ELF_FILE_READ);
+
+	uio_kinit(&iov, &u, (void *)(kva + (lo - va)), hi - lo,
+		  rg->rg_offset + (lo - rg->rg_fvaddr), UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+void
+vm_tlb_flush(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+
+	splx(spl);
+}
+
+void
+vm_tlb_activate(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+	vm_tlbcpus[curcpu->c_number].tc_cpu = curcpu->c_self;
+	if (vm_tlb_owner[curcpu->c_number] != as) {
+		vm_tlb_flush();
+		vm_tlb_owner[curcpu->c_number] = as;
+	}
+	/*
+	 * Let the UTLB handler refill from AS's page table, unless every
+	 * miss is to be traced.
+	 */
+	cpupagetables[curcpu->c_number] =
+		vmtrace_active() ? 0 : (vaddr_t)as->as_pt;
+	splx(spl);
+}
+
+void
+vm_tlb_slowpath(void)
+{
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		cpupagetables[i] = 0;
+	}
+}
+
+void
+vm_tlb_forget(struct addrspace *as)
+{
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (vm_tlb_owner[i] == as) {
+			vm_tlb_owner[i] = NULL;
+		}
+		if (cpupagetables[i] == (vaddr_t)as->as_pt) {
+			cpupagetables[i] = 0;
+		}
+	}
+}
+
+void
+vm_tlb_invalidate(struct addrspace *as, vaddr_t va)
+{
+	int i, spl;
+
+	spl = splhigh();
+	if (vm_tlb_owner[curcpu->c_number] == as) {
+		i = tlb_probe(va, 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	splx(spl);
+}
+
+void
+vm_tlb_shootdown(struct addrspace *as, vaddr_t va, unsigned npages)
+{
+	struct tlbshootdown ts;
+	struct cpu *targets[MAXCPUS];
+	unsigned tickets[MAXCPUS];
+	unsigned i, j, me;
+	int spl;
+
+	/* See ipi_tlbshootdown_wait. */
+	KASSERT(curthread->t_iplhigh_count == 0);
+
+	if (npages == 0) {
+		return;
+	}
+
+	/*
+	 * Stay on this CPU while queueing, so we know which TLB is
+	 * our own.
+	 */
+	spl = splhigh();
+	me = curcpu->c_number;
+
+	if (npages > TLBSHOOTDOWN_MAX) {
+		if (vm_tlb_owner[me] == as) {
+			vm_tlb_flush();
+		}
+	}
+	else {
+		for (j=0; j<npages; j++) {
+			vm_tlb_invalidate(as, va + j * PAGE_SIZE);
+		}
+	}
+
+	/*
+	 * Only CPUs that have run AS since they last flushed can have
+	 * its translations. Any other CPU flushes before it runs AS,
+	 * and then refills from the entries our caller already
+	 * changed.
+	 */
+	ts.ts_addrspace = as;
+	for (i=0; i<MAXCPUS; i++) {
+		targets[i] = NULL;
+		tickets[i] = 0;
+		if (i == me || vm_tlb_owner[i] != as) {
+			continue;
+		}
+		targets[i] = vm_tlbcpus[i].tc_cpu;
+		KASSERT(targets[i] != NULL);
+		if (npages > TLBSHOOTDOWN_MAX) {
+			/* Cheaper to flush than to send each page. */
+			ts.ts_vaddr = 0;
+			ts.ts_allpages = true;
+			tickets[i] = ipi_tlbshootdown(targets[i], &ts);
+			vm_tlbcpus[me].tc_sent++;
+			vmstats_inc(VMSTAT_TLB_SHOOTDOWN);
+			continue;
+		}
+		ts.ts_allpages = false;
+		for (j=0; j<npages; j++) {
+			ts.ts_vaddr = va + j * PAGE_SIZE;
+			tickets[i] = ipi_tlbshootdown(targets[i], &ts);
+			vm_tlbcpus[me].tc_sent++;
+			vmstats_inc(VMSTAT_TLB_SHOOTDOWN);
+		}
+	}
+	splx(spl);
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (targets[i] != NULL) {
+			ipi_tlbshootdown_wait(targets[i], tickets[i]);
+		}
+	}
+}
+
+void
+vm_tlb_shootdown_page(struct addrspace *as, vaddr_t va)
+{
+	vm_tlb_shootdown(as, va, 1);
+}
+
+/*
+ * Replace the TLB entry for VA, if this CPU has one, with ELO.
+ */
+static
+void
+vm_tlb_update(vaddr_t va, uint32_t elo)
+{
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(va, 0);
+	if (i >= 0) {
+		tlb_write(va, elo, i);
+	}
+	splx(spl);
+}
+
+/*
+ * Give AS a private copy of the copy-on-write page at VA, whose page
+ * table entry is PTE. If nobody else is sharing the frame any more it
+ * is simply taken over. Called with the coremap lock held; it is
+ * released and reacquired if a copy has to be made.
+ */
+static
+int
+vm_cow_break(struct addrspace *as, vaddr_t va, pte_t *pte)
+{
+	paddr_t oldpa, newpa;
+
+	KASSERT(*pte & PTE_VALID);
+	KASSERT(*pte & PTE_COW);
+
+	vmstats_inc(VMSTAT_COW_FAULT);
+
+	oldpa = *pte & PTE_FRAME;
+	if (coremap_merged(oldpa)) {
+		vmstats_inc(VMSTAT_MERGE_UNSHARE);
+	}
+	if (coremap_cow_claim(oldpa, as, va)) {
+		*pte &= ~PTE_COW;
+		return 0;
+	}
+
+	/*
+	 * The frame is shared, so it can't be evicted, and our
+	 * reference keeps it around while we copy it.
+	 */
+	coremap_lock_release();
+	newpa = coremap_alloc_upage(as, va);
+	if (newpa == 0) {
+		coremap_lock_acquire();
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	coremap_lock_acquire();
+
+	KASSERT((*pte & PTE_FRAME) == oldpa);
+	*pte = newpa | (*pte & ~(PTE_FRAME | PTE_COW));
+	coremap_lock_release();
+
+	/* Nobody may reach the old frame once our reference is gone. */
+	vm_tlb_shootdown_page(as, va);
+
+	coremap_lock_acquire();
+	coremap_drop_upage(oldpa);
+	coremap_unpin(newpa);
+
+	vmstats_inc(VMSTAT_COW_COPY);
+	return 0;
+}
+
+/*
+ * Bring in the page at VA of region RG for the first time, or back
+ * from swap, and install it in PTE. The frame is left pinned; the
+ * caller unpins it once it is done with the page table entry. Frames
+ * from the page cache are the exception: they are never pinned (being
+ * mapped is enough to keep them), and are mapped with PTE_SHARED or
+ * PTE_COW set.
+ */
+static
+int
+vm_page_in(struct addrspace *as, struct region *rg, vaddr_t va, pte_t *pte)
+{
+	paddr_t pa;
+	pte_t old;
+	vaddr_t lo, hi;
+	off_t offset;
+	bool cached = false;
+	bool compressed;
+	int result;
+
+	/* Nobody else changes a page that isn't resident. */
+	old = *pte;
+	KASSERT((old & (PTE_VALID | PTE_BUSY)) == 0);
+
+	if (old & PTE_SWAPPED) {
+		pa = coremap_alloc_upage(as, va);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		result = swap_read(pa, PTE_SLOT(old), &compressed);
+		if (result) {
+			coremap_free_upage(pa);
+			return result;
+		}
+		if (compressed) {
+			vmstats_inc(VMSTAT_ZSWAP_LOAD);
+		}
+		else {
+			vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+			vmstats_inc(VMSTAT_SWAP_FILE_READ);
+		}
+	}
+	else if (vm_cache_part(rg, va, &offset)) {
+		result = pagecache_getpage(rg->rg_cache, offset, &pa);
+		if (result) {
+			return result;
+		}
+		cached = true;
+	}
+	else if (!vm_file_part(rg, va, &lo, &hi)) {
+		pa = zeropool_alloc_upage(as, va);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+	}
+	else {
+		pa = coremap_alloc_upage(as, va);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		result = vm_fill_page(rg, va, pa, lo, hi);
+		if (result) {
+			coremap_free_upage(pa);
+			return result;
+		}
+	}
+
+	coremap_lock_acquire();
+	if (old & PTE_SWAPPED) {
+		/* The slot is given up, so the page has to be written again. */
+		*pte = pa | PTE_VALID | PTE_DIRTY;
+	}
+	else if (cached) {
+		*pte = pa | PTE_VALID | (rg->rg_shared ? PTE_SHARED : PTE_COW);
+	}
+	else {
+		*pte = pa | PTE_VALID;
+	}
+	coremap_lock_release();
+
+	if (old & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(old));
+	}
+	return 0;
+}
+
+/*
+ * Return the first empty TLB slot at or after FROM, or -1 if there is
+ * none. Interrupts must be off.
+ */
+static
+int
+vm_tlb_freeslot(int from)
+{
+	uint32_t ehi, elo;
+	int i;
+
+	for (i=from; i<NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if ((elo & TLBLO_VALID) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Load a translation for VA into the TLB, in an empty slot if there
+ * is one.
+ */
+static
+void
+vm_tlb_load(vaddr_t va, uint32_t elo)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	i = vm_tlb_freeslot(0);
+	if (i >= 0) {
+		DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", va, elo & TLBLO_PPAGE);
+		tlb_write(va, elo, i);
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		splx(spl);
+		return;
+	}
+
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x (replace)\n", va, elo & TLBLO_PPAGE);
+	tlb_random(va, elo);
+	vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	splx(spl);
+}
+
+/*
+ * Fault-around: after a fault on page VA of region RG, also load the
+ * TLB with neighbouring pages of the region that are resident, so that
+ * a scan through memory doesn't miss on every page. Only free TLB
+ * slots are used, and pages the clock hand is watching (PTE_UNREF)
+ * are left for the next miss to find.
+ *
+ * The window adapts to the faults AS takes: while each one lands just
+ * past the pages preloaded last time it doubles, up to
+ * VM_FAULTAROUND_MAX pages, and otherwise it halves. Pages are
+ * preloaded in the direction the faults are moving.
+ *
+ * Called with the coremap lock held.
+ */
+static
+void
+vm_fault_around(struct addrspace *as, struct region *rg, vaddr_t va)
+{
+	vaddr_t last, nva, distance, lo, hi;
+	unsigned i, window;
+	pte_t *pte;
+	bool up;
+	int slot, spl;
+
+	last = as->as_falast;
+	as->as_falast = va;
+	up = va >= last;
+	distance = up ? va - last : last - va;
+
+	window = as->as_fawindow;
+	if (distance != 0 && distance <= (window + 1) * PAGE_SIZE) {
+		window = window == 0 ? 1 : window * 2;
+		if (window > VM_FAULTAROUND_MAX) {
+			window = VM_FAULTAROUND_MAX;
+		}
+	}
+	else {
+		window /= 2;
+	}
+	as->as_fawindow = window;
+
+	lo = rg->rg_vbase;
+	hi = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+
+	spl = splhigh();
+	slot = 0;
+	for (i=1; i<=window; i++) {
+		nva = up ? va + i * PAGE_SIZE : va - i * PAGE_SIZE;
+		if (nva < lo || nva >= hi) {
+			/* (also catches wrapping around) */
+			break;
+		}
+		pte = pt_lookup(as->as_pt, nva, false);
+		if (pte == NULL ||
+		    (*pte & (PTE_VALID | PTE_BUSY | PTE_UNREF)) != PTE_VALID) {
+			continue;
+		}
+		if (tlb_probe(nva, 0) >= 0) {
+			/* Already there. */
+			continue;
+		}
+		slot = vm_tlb_freeslot(slot);
+		if (slot < 0) {
+			break;
+		}
+		tlb_write(nva, *pte & PTE_TLBBITS, slot);
+		coremap_touch(*pte & PTE_FRAME);
+		vmstats_inc(VMSTAT_FAULT_AROUND);
+	}
+	splx(spl);
+}
+
+/*
+ * Count a TLB fault against the kind of region it was in.
+ */
+static
+void
+vm_count_fault(struct addrspace *as, struct region *rg)
+{
+	if (rg == as->as_stack) {
+		vmstats_inc(VMSTAT_FAULT_STACK);
+	}
+	else if (rg == as->as_heap) {
+		vmstats_inc(VMSTAT_FAULT_HEAP);
+	}
+	else if (rg->rg_vnode == NULL && rg->rg_cache != NULL) {
+		vmstats_inc(VMSTAT_FAULT_MMAP);
+	}
+	else if (!rg->rg_writeable) {
+		vmstats_inc(VMSTAT_FAULT_TEXT);
+	}
+	else {
+		vmstats_inc(VMSTAT_FAULT_DATA);
+	}
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	uint32_t elo;
+	bool pinned = false;
+	unsigned trace;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	rg = as_find_region(as, faultaddress);
+	if (rg == NULL) {
+		rg = as_grow_stack(as, faultaddress);
+		if (rg == NULL) {
+			return EFAULT;
+		}
+	}
+
+	if (faulttype != VM_FAULT_READ && !rg->rg_writeable) {
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	coremap_lock_acquire();
+	while (*pte & PTE_BUSY) {
+		coremap_wait_evict();
+	}
+
+	trace = faulttype == VM_FAULT_READ ? 0 : VMTRACE_WRITE;
+	if (*pte & PTE_VALID) {
+		if (faulttype != VM_FAULT_READONLY) {
+			vmstats_inc(VMSTAT_TLB_RELOAD);
+		}
+		trace |= VMTRACE_REF;
+	}
+	else {
+		trace |= VMTRACE_FAULT;
+		if (*pte & PTE_SWAPPED) {
+			/* (for load control's working set estimate) */
+			as->as_lc.lc_swapins++;
+		}
+		coremap_lock_release();
+		result = vm_page_in(as, rg, faultaddress, pte);
+		if (result) {
+			return result;
+		}
+		coremap_lock_acquire();
+		pinned = (*pte & (PTE_SHARED | PTE_COW)) == 0;
+	}
+
+	if (faulttype == VM_FAULT_READ && (*pte & PTE_COW)) {
+		/*
+		 * If the other side of a fork has let go of the frame,
+		 * take it over so that it can be evicted again.
+		 */
+		if (coremap_cow_claim(*pte & PTE_FRAME, as, faultaddress)) {
+			*pte &= ~PTE_COW;
+		}
+	}
+	else if (faulttype != VM_FAULT_READ && (*pte & PTE_WRITE) == 0) {
+		if (*pte & PTE_COW) {
+			KASSERT(!pinned);
+			result = vm_cow_break(as, faultaddress, pte);
+			if (result) {
+				coremap_lock_release();
+				return result;
+			}
+		}
+		*pte |= PTE_WRITE | PTE_DIRTY;
+	}
+
+	/* The refill handler won't load the page until this is clear. */
+	coremap_touch(*pte & PTE_FRAME);
+	*pte &= ~PTE_UNREF;
+	if (pinned) {
+		coremap_unpin(*pte & PTE_FRAME);
+	}
+
+	/* Keep holding the lock so the page can't be evicted under us. */
+	elo = *pte & PTE_TLBBITS;
+	if (faulttype == VM_FAULT_READONLY) {
+		vm_tlb_update(faultaddress, elo);
+	}
+	else {
+		/*
+		 * Counted only now that it is sure to be loaded, to match
+		 * the free and replace counts of vm_tlb_load. (A write
+		 * through a read-only TLB entry isn't a TLB miss.)
+		 */
+		vmstats_inc(VMSTAT_TLB_FAULT);
+		vm_count_fault(as, rg);
+		vm_tlb_load(faultaddress, elo);
+		if (!vmtrace_active()) {
+			/* (preloading would hide references from the trace) */
+			vm_fault_around(as, rg, faultaddress);
+		}
+	}
+
+	coremap_lock_release();
+	vmtrace_record(as, faultaddress, trace);
+	return 0;
+}
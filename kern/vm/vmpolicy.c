@@ -0,0 +1,561 @@
+/*
+ * Page replacement policies. See vmpolicy.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <vmpolicy.h>
+
+#define NOFRAME ((unsigned)-1)
+
+/*
+ * Queues of frames, for the policies that keep them. Only one policy
+ * is in use at a time, so they all share one set of links: a frame is
+ * on at most one queue, vmpolicy_queue[frame], and is linked to the
+ * frames that arrived just before and after it.
+ */
+#define VMQ_NONE  0
+#define VMQ_FIFO  1		/* fifo: every frame */
+#define VMQ_A1IN  2		/* 2q: frames seen once */
+#define VMQ_AM    3		/* 2q: frames seen again after eviction */
+#define VMQ_COUNT 4
+
+struct vmqueue {
+	unsigned vq_oldest;
+	unsigned vq_newest;
+	unsigned vq_count;
+};
+
+static struct vmqueue vmpolicy_queues[VMQ_COUNT];
+static unsigned *vmpolicy_older;
+static unsigned *vmpolicy_newer;
+static unsigned char *vmpolicy_queue;
+static unsigned vmpolicy_nframes;
+
+/*
+ * 2Q's memory of pages recently evicted from A1in: a ring of
+ * vmpolicy_ghostmax (address space, page) pairs, the oldest of which
+ * is forgotten to make room for a new one. Hashed for lookup, chained
+ * through ghost_next. A pair taken out early has its address space
+ * set to NULL, and stays in the ring until its turn comes.
+ */
+#define GHOST_NBUCKETS 64
+#define GHOST_HASH(as, va) \
+	((((uintptr_t)(as) >> 4) ^ ((va) / PAGE_SIZE)) % GHOST_NBUCKETS)
+
+struct ghost {
+	struct addrspace *g_as;
+	vaddr_t g_va;
+	unsigned g_next;		/* hash chain */
+};
+
+static struct ghost *vmpolicy_ghosts;
+static unsigned vmpolicy_ghostbuckets[GHOST_NBUCKETS];
+static unsigned vmpolicy_ghostmax;
+static unsigned vmpolicy_ghostnext;	/* ring slot to fill next */
+static unsigned vmpolicy_inmax;		/* A1in is kept this long */
+
+/* Clock hand, for clock and eclock. */
+static unsigned vmpolicy_hand;
+
+/*
+ * For policies that don't care.
+ */
+static
+void
+vmpolicy_ignore(unsigned frame)
+{
+	(void)frame;
+}
+
+static
+void
+vmpolicy_ignorepage(unsigned frame, struct addrspace *as, vaddr_t va)
+{
+	(void)frame;
+	(void)as;
+	(void)va;
+}
+
+////////////////////////////////////////////////////////////
+// Queues
+
+static
+void
+vmq_push(unsigned q, unsigned frame)
+{
+	struct vmqueue *vq;
+
+	KASSERT(vmpolicy_queue[frame] == VMQ_NONE);
+
+	vq = &vmpolicy_queues[q];
+	vmpolicy_older[frame] = vq->vq_newest;
+	vmpolicy_newer[frame] = NOFRAME;
+	if (vq->vq_newest != NOFRAME) {
+		vmpolicy_newer[vq->vq_newest] = frame;
+	}
+	else {
+		vq->vq_oldest = frame;
+	}
+	vq->vq_newest = frame;
+	vq->vq_count++;
+	vmpolicy_queue[frame] = q;
+}
+
+static
+void
+vmq_remove(unsigned frame)
+{
+	struct vmqueue *vq;
+	unsigned older, newer;
+
+	if (vmpolicy_queue[frame] == VMQ_NONE) {
+		return;
+	}
+	vq = &vmpolicy_queues[vmpolicy_queue[frame]];
+	older = vmpolicy_older[frame];
+	newer = vmpolicy_newer[frame];
+	if (older != NOFRAME) {
+		vmpolicy_newer[older] = newer;
+	}
+	else {
+		vq->vq_oldest = newer;
+	}
+	if (newer != NOFRAME) {
+		vmpolicy_older[newer] = older;
+	}
+	else {
+		vq->vq_newest = older;
+	}
+	vq->vq_count--;
+	vmpolicy_queue[frame] = VMQ_NONE;
+}
+
+/*
+ * Find a frame to evict in queue Q, oldest first. With SECONDCHANCE,
+ * a used frame has its bit cleared and goes to the back of the queue
+ * instead, as on a clock.
+ */
+static
+int
+vmq_victim(unsigned q, bool cleanonly, bool secondchance)
+{
+	struct vmqueue *vq;
+	unsigned frame, newer, state, i, limit;
+
+	vq = &vmpolicy_queues[q];
+	limit = secondchance ? 2 * vq->vq_count : vq->vq_count;
+
+	frame = vq->vq_oldest;
+	for (i=0; i<limit && frame != NOFRAME; i++) {
+		newer = vmpolicy_newer[frame];
+		state = coremap_pstate(frame);
+		if (!(state & COREMAP_EVICTABLE) ||
+		    (cleanonly && (state & COREMAP_DIRTY))) {
+			frame = newer;
+			continue;
+		}
+		if (!secondchance || !(state & COREMAP_REF)) {
+			return frame;
+		}
+		coremap_clearref(frame);
+		vmq_remove(frame);
+		vmq_push(q, frame);
+		frame = newer != NOFRAME ? newer : frame;
+	}
+	return -1;
+}
+
+static
+void
+vmq_reset(void)
+{
+	unsigned i;
+
+	for (i=0; i<VMQ_COUNT; i++) {
+		vmpolicy_queues[i].vq_oldest = NOFRAME;
+		vmpolicy_queues[i].vq_newest = NOFRAME;
+		vmpolicy_queues[i].vq_count = 0;
+	}
+	for (i=0; i<vmpolicy_nframes; i++) {
+		vmpolicy_queue[i] = VMQ_NONE;
+	}
+}
+
+static
+void
+vmq_evict(unsigned frame, struct addrspace *as, vaddr_t va)
+{
+	(void)as;
+	(void)va;
+	vmq_remove(frame);
+}
+
+////////////////////////////////////////////////////////////
+// FIFO
+
+static
+void
+fifo_insert(unsigned frame, struct addrspace *as, vaddr_t va)
+{
+	(void)as;
+	(void)va;
+	vmq_push(VMQ_FIFO, frame);
+}
+
+static
+int
+fifo_victim(bool cleanonly)
+{
+	return vmq_victim(VMQ_FIFO, cleanonly, false);
+}
+
+static const struct vmpolicy vmpolicy_fifo = {
+	.vp_name = "fifo",
+	.vp_reset = vmq_reset,
+	.vp_insert = fifo_insert,
+	.vp_touch = vmpolicy_ignore,
+	.vp_remove = vmq_remove,
+	.vp_evict = vmq_evict,
+	.vp_victim = fifo_victim,
+};
+
+////////////////////////////////////////////////////////////
+// Clock
+//
+// Both clocks go round every frame in memory; the coremap says which
+// are evictable, so they need no state beyond the hand.
+
+static
+void
+clock_reset(void)
+{
+	vmpolicy_hand = 0;
+}
+
+/*
+ * Move the hand on, returning the frame it was at.
+ */
+static
+unsigned
+clock_advance(void)
+{
+	unsigned cur;
+
+	cur = vmpolicy_hand;
+	vmpolicy_hand = (vmpolicy_hand + 1) % coremap_totalpages();
+	return cur;
+}
+
+/*
+ * Twice around, in case the first pass only clears bits.
+ */
+static
+int
+clock_victim(bool cleanonly)
+{
+	unsigned i, cur, state, nframes;
+
+	nframes = coremap_totalpages();
+	for (i=0; i<2*nframes; i++) {
+		cur = clock_advance();
+		state = coremap_pstate(cur);
+		if (!(state & COREMAP_EVICTABLE)) {
+			continue;
+		}
+		if (state & COREMAP_REF) {
+			coremap_clearref(cur);
+			continue;
+		}
+		if (cleanonly && (state & COREMAP_DIRTY)) {
+			continue;
+		}
+		return cur;
+	}
+	return -1;
+}
+
+const struct vmpolicy vmpolicy_clock = {
+	.vp_name = "clock",
+	.vp_reset = clock_reset,
+	.vp_insert = vmpolicy_ignorepage,
+	.vp_touch = vmpolicy_ignore,
+	.vp_remove = vmpolicy_ignore,
+	.vp_evict = vmpolicy_ignorepage,
+	.vp_victim = clock_victim,
+};
+
+/*
+ * Enhanced clock. Pages fall into four classes by their reference
+ * and dirty bits, and are taken from the lowest class there is:
+ * unused and clean, unused and dirty, then (once the bits have been
+ * cleared) used and clean, used and dirty. The first lap looks for
+ * an unused clean page and changes nothing; the second looks for an
+ * unused dirty one, clearing bits as it goes. If neither turns one
+ * up, the two are repeated, now that every bit is clear.
+ */
+static
+int
+eclock_victim(bool cleanonly)
+{
+	unsigned lap, i, cur, state, nframes;
+	bool wantdirty;
+
+	nframes = coremap_totalpages();
+	for (lap=0; lap<4; lap++) {
+		wantdirty = (lap % 2 == 1) && !cleanonly;
+		for (i=0; i<nframes; i++) {
+			cur = clock_advance();
+			state = coremap_pstate(cur);
+			if (!(state & COREMAP_EVICTABLE)) {
+				continue;
+			}
+			if (state & COREMAP_REF) {
+				if (lap % 2 == 1) {
+					coremap_clearref(cur);
+				}
+				continue;
+			}
+			if ((state & COREMAP_DIRTY) && !wantdirty) {
+				continue;
+			}
+			return cur;
+		}
+	}
+	return -1;
+}
+
+static const struct vmpolicy vmpolicy_eclock = {
+	.vp_name = "eclock",
+	.vp_reset = clock_reset,
+	.vp_insert = vmpolicy_ignorepage,
+	.vp_touch = vmpolicy_ignore,
+	.vp_remove = vmpolicy_ignore,
+	.vp_evict = vmpolicy_ignorepage,
+	.vp_victim = eclock_victim,
+};
+
+////////////////////////////////////////////////////////////
+// 2Q
+//
+// New pages go on A1in, a FIFO queue; pages seen again go on Am,
+// which is kept in order of use (as near as the faults we see allow)
+// with a second chance for pages used since the last lap. Pages
+// evicted from A1in are remembered in the ghost ring (A1out), and if
+// one comes back while it's remembered it goes straight to Am. Pages
+// are taken from A1in while it holds more than its share of memory,
+// so that one scan through a large array can't push the working set
+// out.
+
+/*
+ * Take slot G out of its hash chain.
+ */
+static
+void
+ghost_unlink(unsigned g)
+{
+	unsigned *gp;
+
+	gp = &vmpolicy_ghostbuckets[GHOST_HASH(vmpolicy_ghosts[g].g_as,
+					       vmpolicy_ghosts[g].g_va)];
+	while (*gp != g) {
+		KASSERT(*gp != NOFRAME);
+		gp = &vmpolicy_ghosts[*gp].g_next;
+	}
+	*gp = vmpolicy_ghosts[g].g_next;
+	vmpolicy_ghosts[g].g_as = NULL;
+}
+
+/*
+ * Take page VA of AS out of the ghost ring. Returns true if it was
+ * there.
+ */
+static
+bool
+ghost_take(struct addrspace *as, vaddr_t va)
+{
+	unsigned g;
+
+	for (g = vmpolicy_ghostbuckets[GHOST_HASH(as, va)]; g != NOFRAME;
+	     g = vmpolicy_ghosts[g].g_next) {
+		if (vmpolicy_ghosts[g].g_as == as &&
+		    vmpolicy_ghosts[g].g_va == va) {
+			ghost_unlink(g);
+			return true;
+		}
+	}
+	return false;
+}
+
+static
+void
+ghost_add(struct addrspace *as, vaddr_t va)
+{
+	struct ghost *g;
+	unsigned bucket, slot;
+
+	slot = vmpolicy_ghostnext;
+	vmpolicy_ghostnext = (slot + 1) % vmpolicy_ghostmax;
+
+	g = &vmpolicy_ghosts[slot];
+	if (g->g_as != NULL) {
+		/* Forget the oldest. */
+		ghost_unlink(slot);
+	}
+
+	bucket = GHOST_HASH(as, va);
+	g->g_as = as;
+	g->g_va = va;
+	g->g_next = vmpolicy_ghostbuckets[bucket];
+	vmpolicy_ghostbuckets[bucket] = slot;
+}
+
+static
+void
+twoq_reset(void)
+{
+	unsigned i;
+
+	vmq_reset();
+	for (i=0; i<GHOST_NBUCKETS; i++) {
+		vmpolicy_ghostbuckets[i] = NOFRAME;
+	}
+	for (i=0; i<vmpolicy_ghostmax; i++) {
+		vmpolicy_ghosts[i].g_as = NULL;
+	}
+	vmpolicy_ghostnext = 0;
+}
+
+static
+void
+twoq_insert(unsigned frame, struct addrspace *as, vaddr_t va)
+{
+	if (as != NULL && ghost_take(as, va)) {
+		vmq_push(VMQ_AM, frame);
+	}
+	else {
+		vmq_push(VMQ_A1IN, frame);
+	}
+}
+
+static
+void
+twoq_touch(unsigned frame)
+{
+	if (vmpolicy_queue[frame] == VMQ_AM) {
+		vmq_remove(frame);
+		vmq_push(VMQ_AM, frame);
+	}
+}
+
+static
+void
+twoq_evict(unsigned frame, struct addrspace *as, vaddr_t va)
+{
+	if (vmpolicy_queue[frame] == VMQ_A1IN && as != NULL) {
+		ghost_add(as, va);
+	}
+	vmq_remove(frame);
+}
+
+static
+int
+twoq_victim(bool cleanonly)
+{
+	int frame;
+
+	if (vmpolicy_queues[VMQ_A1IN].vq_count > vmpolicy_inmax ||
+	    vmpolicy_queues[VMQ_AM].vq_count == 0) {
+		frame = vmq_victim(VMQ_A1IN, cleanonly, false);
+		if (frame < 0) {
+			frame = vmq_victim(VMQ_AM, cleanonly, true);
+		}
+	}
+	else {
+		frame = vmq_victim(VMQ_AM, cleanonly, true);
+		if (frame < 0) {
+			frame = vmq_victim(VMQ_A1IN, cleanonly, false);
+		}
+	}
+	return frame;
+}
+
+static const struct vmpolicy vmpolicy_2q = {
+	.vp_name = "2q",
+	.vp_reset = twoq_reset,
+	.vp_insert = twoq_insert,
+	.vp_touch = twoq_touch,
+	.vp_remove = vmq_remove,
+	.vp_evict = twoq_evict,
+	.vp_victim = twoq_victim,
+};
+
+////////////////////////////////////////////////////////////
+
+static const struct vmpolicy *const vmpolicies[] = {
+	&vmpolicy_fifo,
+	&vmpolicy_clock,
+	&vmpolicy_eclock,
+	&vmpolicy_2q,
+};
+#define NPOLICIES (sizeof(vmpolicies) / sizeof(vmpolicies[0]))
+
+void
+vmpolicy_bootstrap(void)
+{
+	int result;
+
+	vmpolicy_nframes = coremap_totalpages();
+	vmpolicy_older = kmalloc(vmpolicy_nframes * sizeof(unsigned));
+	vmpolicy_newer = kmalloc(vmpolicy_nframes * sizeof(unsigned));
+	vmpolicy_queue = kmalloc(vmpolicy_nframes);
+
+	vmpolicy_inmax = vmpolicy_nframes / VMPOLICY_2Q_INDIV;
+	vmpolicy_ghostmax = vmpolicy_nframes / VMPOLICY_2Q_OUTDIV;
+	if (vmpolicy_ghostmax == 0) {
+		vmpolicy_ghostmax = 1;
+	}
+	vmpolicy_ghosts = kmalloc(vmpolicy_ghostmax * sizeof(struct ghost));
+
+	if (vmpolicy_older == NULL || vmpolicy_newer == NULL ||
+	    vmpolicy_queue == NULL || vmpolicy_ghosts == NULL) {
+		panic("vmpolicy: Out of memory\n");
+	}
+
+	result = vmpolicy_select(VMPOLICY_DEFAULT);
+	KASSERT(result == 0);
+}
+
+int
+vmpolicy_select(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<NPOLICIES; i++) {
+		if (!strcmp(vmpolicies[i]->vp_name, name)) {
+			coremap_setpolicy(vmpolicies[i]);
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
+const char *
+vmpolicy_current(void)
+{
+	return coremap_getpolicy()->vp_name;
+}
+
+void
+vmpolicy_list(void)
+{
+	unsigned i;
+
+	for (i=0; i<NPOLICIES; i++) {
+		kprintf("%s%s", i > 0 ? " " : "", vmpolicies[i]->vp_name);
+	}
+	kprintf("\n");
+}
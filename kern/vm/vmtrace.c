@@ -0,0 +1,278 @@
+/*
+ * Page reference tracing. See vmtrace.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/vmtrace.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <coremap.h>
+#include <vmtrace.h>
+
+/*
+ * The ring of references not yet written out: vmtrace_count of them,
+ * oldest at vmtrace_head. Protected by vmtrace_lock, a spinlock so
+ * that recording is cheap, as is vmtrace_on.
+ */
+static struct vmtrace_record vmtrace_buf[VMTRACE_NBUF];
+static unsigned vmtrace_head;
+static unsigned vmtrace_count;
+static unsigned vmtrace_dropped;
+static volatile bool vmtrace_on;
+static struct spinlock vmtrace_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Where the writer thread takes references out of the ring to write
+ * them, so it needn't hold the spinlock while it does. Only it uses
+ * this, and the file offset and counts below.
+ */
+#define VMTRACE_NOUT (VMTRACE_NBUF / 2)
+static struct vmtrace_record vmtrace_out[VMTRACE_NOUT];
+static off_t vmtrace_offset;
+static unsigned vmtrace_written;
+static int vmtrace_error;
+
+/* The trace file; NULL when not tracing. Protected by vmtrace_ctllock. */
+static struct vnode *vmtrace_vnode;
+static struct lock *vmtrace_ctllock;
+
+/* Where the writer waits for the ring to fill, and says it's done. */
+static struct wchan *vmtrace_wchan;
+static struct semaphore *vmtrace_done;
+
+void
+vmtrace_bootstrap(void)
+{
+	vmtrace_ctllock = lock_create("vmtrace");
+	vmtrace_wchan = wchan_create("vmtrace");
+	vmtrace_done = sem_create("vmtrace", 0);
+	if (vmtrace_ctllock == NULL || vmtrace_wchan == NULL ||
+	    vmtrace_done == NULL) {
+		panic("vmtrace: Could not create synchronization objects\n");
+	}
+}
+
+/*
+ * Write LEN bytes at BUF to the trace file.
+ */
+static
+int
+vmtrace_write(const void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	uio_kinit(&iov, &u, (void *)buf, len, vmtrace_offset, UIO_WRITE);
+	result = VOP_WRITE(vmtrace_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return ENOSPC;
+	}
+	vmtrace_offset += len;
+	return 0;
+}
+
+/*
+ * Take what's in the ring out of it and write it to the file. After
+ * an error, references are just thrown away. Returns the number taken.
+ */
+static
+unsigned
+vmtrace_drain(void)
+{
+	unsigned i, n;
+
+	spinlock_acquire(&vmtrace_lock);
+	n = vmtrace_count < VMTRACE_NOUT ? vmtrace_count : VMTRACE_NOUT;
+	for (i=0; i<n; i++) {
+		vmtrace_out[i] = vmtrace_buf[(vmtrace_head + i) % VMTRACE_NBUF];
+	}
+	vmtrace_head = (vmtrace_head + n) % VMTRACE_NBUF;
+	vmtrace_count -= n;
+	spinlock_release(&vmtrace_lock);
+
+	if (n > 0 && vmtrace_error == 0) {
+		vmtrace_error = vmtrace_write(vmtrace_out,
+					      n * sizeof(vmtrace_out[0]));
+		if (vmtrace_error == 0) {
+			vmtrace_written += n;
+		}
+	}
+	return n;
+}
+
+/*
+ * The writer. Runs from vmtrace_start until the ring is empty after
+ * vmtrace_stop.
+ */
+static
+void
+vmtrace_thread(void *unused1, unsigned long unused2)
+{
+	bool wait;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		wchan_lock(vmtrace_wchan);
+		spinlock_acquire(&vmtrace_lock);
+		wait = vmtrace_on && vmtrace_count < VMTRACE_NBUF / 2;
+		spinlock_release(&vmtrace_lock);
+		if (wait) {
+			wchan_sleep(vmtrace_wchan);
+			continue;
+		}
+		wchan_unlock(vmtrace_wchan);
+
+		if (vmtrace_drain() == 0 && !vmtrace_on) {
+			break;
+		}
+	}
+	V(vmtrace_done);
+}
+
+int
+vmtrace_start(const char *path)
+{
+	struct vmtrace_header vth;
+	char *name;
+	int result;
+
+	lock_acquire(vmtrace_ctllock);
+	if (vmtrace_vnode != NULL) {
+		lock_release(vmtrace_ctllock);
+		return EBUSY;
+	}
+
+	/* vfs_open may change the name. */
+	name = kstrdup(path);
+	if (name == NULL) {
+		lock_release(vmtrace_ctllock);
+		return ENOMEM;
+	}
+	result = vfs_open(name, O_WRONLY | O_CREAT | O_TRUNC, 0664,
+			  &vmtrace_vnode);
+	kfree(name);
+	if (result) {
+		vmtrace_vnode = NULL;
+		lock_release(vmtrace_ctllock);
+		return result;
+	}
+
+	vth.vth_magic = VMTRACE_MAGIC;
+	vth.vth_version = VMTRACE_VERSION;
+	vth.vth_pagesize = PAGE_SIZE;
+	vth.vth_nframes = coremap_totalpages();
+	vmtrace_offset = 0;
+	result = vmtrace_write(&vth, sizeof(vth));
+	if (result) {
+		goto fail;
+	}
+
+	vmtrace_head = vmtrace_count = vmtrace_dropped = 0;
+	vmtrace_written = 0;
+	vmtrace_error = 0;
+	vmtrace_on = true;
+
+	result = thread_fork("vmtrace", NULL, vmtrace_thread, NULL, 0);
+	if (result) {
+		vmtrace_on = false;
+		goto fail;
+	}
+
+	/* Send every TLB miss to vm_fault from now on. */
+	vm_tlb_slowpath();
+
+	lock_release(vmtrace_ctllock);
+	return 0;
+
+ fail:
+	vfs_close(vmtrace_vnode);
+	vmtrace_vnode = NULL;
+	lock_release(vmtrace_ctllock);
+	return result;
+}
+
+int
+vmtrace_stop(void)
+{
+	int result;
+
+	lock_acquire(vmtrace_ctllock);
+	if (vmtrace_vnode == NULL) {
+		lock_release(vmtrace_ctllock);
+		return EINVAL;
+	}
+
+	spinlock_acquire(&vmtrace_lock);
+	vmtrace_on = false;
+	spinlock_release(&vmtrace_lock);
+
+	wchan_wakeone(vmtrace_wchan);
+	P(vmtrace_done);
+
+	vfs_close(vmtrace_vnode);
+	vmtrace_vnode = NULL;
+
+	kprintf("vmtrace: %u references recorded, %u dropped\n",
+		vmtrace_written, vmtrace_dropped);
+	result = vmtrace_error;
+
+	lock_release(vmtrace_ctllock);
+	return result;
+}
+
+bool
+vmtrace_active(void)
+{
+	return vmtrace_on;
+}
+
+void
+vmtrace_record(struct addrspace *as, vaddr_t va, unsigned type)
+{
+	struct vmtrace_record *vtr;
+	bool wake;
+
+	KASSERT((va & PAGE_FRAME) == va);
+
+	if (!vmtrace_on) {
+		return;
+	}
+
+	wake = false;
+	spinlock_acquire(&vmtrace_lock);
+	if (!vmtrace_on) {
+		/* (stopped meanwhile) */
+	}
+	else if (vmtrace_count == VMTRACE_NBUF) {
+		vmtrace_dropped++;
+	}
+	else {
+		vtr = &vmtrace_buf[(vmtrace_head + vmtrace_count) %
+				   VMTRACE_NBUF];
+		vtr->vtr_space = (uint32_t)(uintptr_t)as;
+		vtr->vtr_page = va | type;
+		vmtrace_count++;
+		wake = vmtrace_count == VMTRACE_NBUF / 2;
+	}
+	spinlock_release(&vmtrace_lock);
+
+	if (wake) {
+		wchan_wakeone(vmtrace_wchan);
+	}
+}
@@ -0,0 +1,141 @@
+/*
+ * Pre-zeroed frames. See zeropool.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <zeropool.h>
+#include <uw-vmstats.h>
+
+static paddr_t zeropool_frames[ZEROPOOL_SIZE];
+static unsigned zeropool_count;
+static struct spinlock zeropool_lock = SPINLOCK_INITIALIZER;
+
+/* Where the zeroing thread waits for the pool to run low. */
+static struct wchan *zeropool_wchan;
+
+/*
+ * Sleep on zeropool_wchan. Called with zeropool_lock held; returns
+ * without it.
+ */
+static
+void
+zeropool_sleep(void)
+{
+	wchan_lock(zeropool_wchan);
+	spinlock_release(&zeropool_lock);
+	wchan_sleep(zeropool_wchan);
+}
+
+/*
+ * The zeroing thread. Fills the pool a frame at a time, giving way
+ * to any other thread that wants the CPU, and sleeps once the pool
+ * is full or no frame is free.
+ */
+static
+void
+zeropool_thread(void *unused1, unsigned long unused2)
+{
+	paddr_t pa;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		spinlock_acquire(&zeropool_lock);
+		if (zeropool_count == ZEROPOOL_SIZE) {
+			zeropool_sleep();
+			continue;
+		}
+		spinlock_release(&zeropool_lock);
+
+		if (thread_others_runnable()) {
+			thread_yield();
+			continue;
+		}
+
+		pa = coremap_try_kpage();
+		if (pa == 0) {
+			/* Try again after the next allocation. */
+			spinlock_acquire(&zeropool_lock);
+			zeropool_sleep();
+			continue;
+		}
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+
+		/* Nobody else adds to the pool, so there's still room. */
+		spinlock_acquire(&zeropool_lock);
+		KASSERT(zeropool_count < ZEROPOOL_SIZE);
+		zeropool_frames[zeropool_count++] = pa;
+		spinlock_release(&zeropool_lock);
+	}
+}
+
+void
+zeropool_bootstrap(void)
+{
+	int result;
+
+	zeropool_wchan = wchan_create("zeropool");
+	if (zeropool_wchan == NULL) {
+		panic("zeropool: Could not create wchan\n");
+	}
+
+	result = thread_fork("zeropool", NULL, zeropool_thread, NULL, 0);
+	if (result) {
+		kprintf("zeropool: thread_fork: %s; zeroing on demand\n",
+			strerror(result));
+	}
+}
+
+paddr_t
+zeropool_get(void)
+{
+	paddr_t pa;
+	bool wake;
+
+	spinlock_acquire(&zeropool_lock);
+	pa = 0;
+	if (zeropool_count > 0) {
+		pa = zeropool_frames[--zeropool_count];
+	}
+	wake = zeropool_count < ZEROPOOL_LOW;
+	spinlock_release(&zeropool_lock);
+
+	if (wake && zeropool_wchan != NULL) {
+		wchan_wakeone(zeropool_wchan);
+	}
+	return pa;
+}
+
+unsigned
+zeropool_available(void)
+{
+	/* Without the lock; it's only a hint. */
+	return zeropool_count;
+}
+
+paddr_t
+zeropool_alloc_upage(struct addrspace *as, vaddr_t va)
+{
+	paddr_t pa;
+
+	pa = zeropool_get();
+	if (pa != 0) {
+		vmstats_inc(VMSTAT_ZERO_POOL_HIT);
+		coremap_adopt_kpage(pa, as, va);
+		return pa;
+	}
+
+	vmstats_inc(VMSTAT_ZERO_POOL_MISS);
+	pa = coremap_alloc_upage(as, va);
+	if (pa != 0) {
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	return pa;
+}
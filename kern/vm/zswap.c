@@ -0,0 +1,447 @@
+/*
+ * Compressed swap tier. See zswap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <clock.h>
+#include <lzcomp.h>
+#include <vm.h>
+#include <coremap.h>
+#include <zswap.h>
+#include <uw-vmstats.h>
+
+#define ZSWAP_NCHUNKS  (PAGE_SIZE / ZSWAP_CHUNK)	/* chunks per pool page */
+#define ZSWAP_MAXLEN   (PAGE_SIZE / 2)		/* worst compression kept */
+#define ZSWAP_TRIMMAX  8			/* pool pages freed at once */
+#define NOSLOT ((unsigned)-1)
+
+/*
+ * A pool page, and a bitmap of which of its chunks are in use.
+ * zp_kva is 0 if there is no page in this place of the pool.
+ */
+struct zpage {
+	vaddr_t zp_kva;
+	uint32_t zp_used;
+};
+
+/*
+ * What the tier has for each swap slot. Stored pages are on a list
+ * from oldest to newest, linked by slot number.
+ */
+struct zentry {
+	unsigned ze_older, ze_newer;	/* age list */
+	uint16_t ze_len;		/* compressed size */
+	uint16_t ze_page;		/* index in zswap_pages */
+	uint8_t ze_chunk;		/* first chunk in that page */
+	uint8_t ze_flags;
+};
+
+#define ZE_STORED    1		/* the slot's page is here */
+#define ZE_SPILLING  2		/* ...and on its way to disk */
+#define ZE_FREED     4		/* the slot was freed while spilling */
+
+/*
+ * zswap_lock protects the table, the pool and the age list, and is a
+ * spinlock so that zswap_free can be called from swap_free. Nothing
+ * that takes the coremap lock is called while holding it.
+ */
+static struct zentry *zswap_tab;
+static unsigned zswap_nslots;
+static struct zpage *zswap_pages;
+static unsigned zswap_maxpages;		/* size of zswap_pages */
+static unsigned zswap_npages;		/* pool pages present */
+static unsigned zswap_nempty;		/* ...with no chunk in use */
+static unsigned zswap_oldest, zswap_newest;
+static struct spinlock zswap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Compression scratch space: too big for a kernel stack, and no good
+ * to allocate while evicting. zswap_buflock protects it.
+ */
+static uint8_t zswap_buf[ZSWAP_MAXLEN];
+static uint16_t zswap_work[LZ_WORKSIZE / sizeof(uint16_t)];
+static struct lock *zswap_buflock;
+
+#define ZE_ADDR(ze) \
+	(zswap_pages[(ze)->ze_page].zp_kva + (ze)->ze_chunk * ZSWAP_CHUNK)
+
+void
+zswap_bootstrap(unsigned nslots)
+{
+	unsigned i;
+
+	zswap_nslots = nslots;
+	zswap_tab = kmalloc(nslots * sizeof(struct zentry));
+	if (zswap_tab == NULL) {
+		panic("zswap: Could not allocate slot table\n");
+	}
+	for (i=0; i<nslots; i++) {
+		zswap_tab[i].ze_flags = 0;
+	}
+
+	zswap_maxpages = coremap_totalpages() / ZSWAP_DIV;
+	zswap_pages = kmalloc(zswap_maxpages * sizeof(struct zpage));
+	if (zswap_pages == NULL) {
+		panic("zswap: Could not allocate pool\n");
+	}
+	for (i=0; i<zswap_maxpages; i++) {
+		zswap_pages[i].zp_kva = 0;
+		zswap_pages[i].zp_used = 0;
+	}
+	zswap_npages = zswap_nempty = 0;
+	zswap_oldest = zswap_newest = NOSLOT;
+
+	zswap_buflock = lock_create("zswap");
+	if (zswap_buflock == NULL) {
+		panic("zswap: Could not create lock\n");
+	}
+
+	kprintf("zswap: up to %u pages of compressed swap\n", zswap_maxpages);
+}
+
+/*
+ * Add microseconds since S0/NS0 to the compression time.
+ */
+static
+void
+zswap_count_time(time_t s0, uint32_t ns0)
+{
+	time_t s1, ds;
+	uint32_t ns1, dns;
+
+	gettime(&s1, &ns1);
+	getinterval(s0, ns0, s1, ns1, &ds, &dns);
+	vmstats_add(VMSTAT_ZSWAP_USEC, ds * 1000000 + dns / 1000);
+}
+
+/*
+ * Find NCHUNKS free chunks in a row in some pool page, mark them in
+ * use, and put where they are in ZE. Returns false if there is no
+ * room. Called with zswap_lock held.
+ */
+static
+bool
+zswap_chunk_alloc(struct zentry *ze, unsigned nchunks)
+{
+	struct zpage *zp;
+	uint32_t mask;
+	unsigned i, c;
+
+	KASSERT(spinlock_do_i_hold(&zswap_lock));
+	KASSERT(nchunks > 0 && nchunks < 32);
+
+	mask = (1U << nchunks) - 1;
+	for (i=0; i<zswap_maxpages; i++) {
+		zp = &zswap_pages[i];
+		if (zp->zp_kva == 0) {
+			continue;
+		}
+		for (c=0; c+nchunks <= ZSWAP_NCHUNKS; c++) {
+			if (zp->zp_used & (mask << c)) {
+				continue;
+			}
+			if (zp->zp_used == 0) {
+				zswap_nempty--;
+			}
+			zp->zp_used |= mask << c;
+			ze->ze_page = i;
+			ze->ze_chunk = c;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Give back the chunks of ZE. Called with zswap_lock held.
+ */
+static
+void
+zswap_chunk_free(struct zentry *ze)
+{
+	struct zpage *zp;
+	uint32_t mask;
+
+	KASSERT(spinlock_do_i_hold(&zswap_lock));
+
+	zp = &zswap_pages[ze->ze_page];
+	mask = (1U << DIVROUNDUP(ze->ze_len, ZSWAP_CHUNK)) - 1;
+	KASSERT((zp->zp_used & (mask << ze->ze_chunk)) ==
+		mask << ze->ze_chunk);
+	zp->zp_used &= ~(mask << ze->ze_chunk);
+	if (zp->zp_used == 0) {
+		zswap_nempty++;
+	}
+}
+
+/*
+ * Take SLOT off the age list. Called with zswap_lock held.
+ */
+static
+void
+zswap_unlink(unsigned slot)
+{
+	struct zentry *ze;
+
+	KASSERT(spinlock_do_i_hold(&zswap_lock));
+
+	ze = &zswap_tab[slot];
+	if (ze->ze_older == NOSLOT) {
+		zswap_oldest = ze->ze_newer;
+	}
+	else {
+		zswap_tab[ze->ze_older].ze_newer = ze->ze_newer;
+	}
+	if (ze->ze_newer == NOSLOT) {
+		zswap_newest = ze->ze_older;
+	}
+	else {
+		zswap_tab[ze->ze_newer].ze_older = ze->ze_older;
+	}
+}
+
+/*
+ * Free pool pages that have emptied out, keeping one for the next
+ * store.
+ */
+static
+void
+zswap_trim(void)
+{
+	vaddr_t dead[ZSWAP_TRIMMAX];
+	unsigned i, n;
+
+	n = 0;
+	spinlock_acquire(&zswap_lock);
+	for (i=0; i<zswap_maxpages && zswap_nempty > 1 &&
+		     n < ZSWAP_TRIMMAX; i++) {
+		if (zswap_pages[i].zp_kva != 0 &&
+		    zswap_pages[i].zp_used == 0) {
+			dead[n++] = zswap_pages[i].zp_kva;
+			zswap_pages[i].zp_kva = 0;
+			zswap_npages--;
+			zswap_nempty--;
+		}
+	}
+	spinlock_release(&zswap_lock);
+
+	for (i=0; i<n; i++) {
+		free_kpages(dead[i]);
+	}
+}
+
+/*
+ * Add the free page at KVA to the pool. Called with zswap_lock held,
+ * and only when there is room.
+ */
+static
+void
+zswap_addpage(vaddr_t kva)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&zswap_lock));
+
+	for (i=0; i<zswap_maxpages; i++) {
+		if (zswap_pages[i].zp_kva == 0) {
+			zswap_pages[i].zp_kva = kva;
+			zswap_pages[i].zp_used = 0;
+			zswap_npages++;
+			zswap_nempty++;
+			return;
+		}
+	}
+	panic("zswap: No room for a pool page\n");
+}
+
+int
+zswap_store(vaddr_t kva, unsigned slot)
+{
+	struct zentry *ze;
+	size_t len;
+	unsigned nchunks;
+	paddr_t pa;
+	bool room;
+	time_t s0;
+	uint32_t ns0;
+
+	KASSERT(slot < zswap_nslots);
+
+	zswap_trim();
+
+	lock_acquire(zswap_buflock);
+
+	gettime(&s0, &ns0);
+	len = lz_compress((void *)kva, PAGE_SIZE, zswap_buf, ZSWAP_MAXLEN,
+			  zswap_work);
+	zswap_count_time(s0, ns0);
+	if (len == 0) {
+		lock_release(zswap_buflock);
+		return E2BIG;
+	}
+	nchunks = DIVROUNDUP(len, ZSWAP_CHUNK);
+
+	ze = &zswap_tab[slot];
+	spinlock_acquire(&zswap_lock);
+	KASSERT(ze->ze_flags == 0);
+	room = zswap_chunk_alloc(ze, nchunks);
+	if (!room && zswap_npages < zswap_maxpages) {
+		/*
+		 * Grow the pool. Only stores add pages, and we hold the
+		 * buffer lock, so there will still be room afterwards.
+		 */
+		spinlock_release(&zswap_lock);
+		pa = coremap_try_kpage();
+		spinlock_acquire(&zswap_lock);
+		if (pa != 0) {
+			zswap_addpage(PADDR_TO_KVADDR(pa));
+			room = zswap_chunk_alloc(ze, nchunks);
+			KASSERT(room);
+		}
+	}
+	if (!room) {
+		spinlock_release(&zswap_lock);
+		lock_release(zswap_buflock);
+		return ENOSPC;
+	}
+
+	memcpy((void *)ZE_ADDR(ze), zswap_buf, len);
+	ze->ze_len = len;
+	ze->ze_flags = ZE_STORED;
+	ze->ze_newer = NOSLOT;
+	ze->ze_older = zswap_newest;
+	if (zswap_newest == NOSLOT) {
+		zswap_oldest = slot;
+	}
+	else {
+		zswap_tab[zswap_newest].ze_newer = slot;
+	}
+	zswap_newest = slot;
+
+	spinlock_release(&zswap_lock);
+	lock_release(zswap_buflock);
+
+	vmstats_inc(VMSTAT_ZSWAP_STORE);
+	vmstats_add(VMSTAT_ZSWAP_BYTES, len);
+	return 0;
+}
+
+/*
+ * Decompress ZE, the entry of SLOT, into KVA. Called with the buffer
+ * lock held; the compressed data is copied out under zswap_lock, so
+ * that the entry may go away (see zswap_spill_end) meanwhile.
+ */
+static
+void
+zswap_unpack(struct zentry *ze, unsigned slot, vaddr_t kva)
+{
+	size_t len;
+	time_t s0;
+	uint32_t ns0;
+
+	KASSERT(lock_do_i_hold(zswap_buflock));
+	KASSERT(spinlock_do_i_hold(&zswap_lock));
+
+	len = ze->ze_len;
+	memcpy(zswap_buf, (void *)ZE_ADDR(ze), len);
+	spinlock_release(&zswap_lock);
+
+	gettime(&s0, &ns0);
+	if (lz_decompress(zswap_buf, len, (void *)kva, PAGE_SIZE) !=
+	    PAGE_SIZE) {
+		panic("zswap: Slot %u is corrupt\n", slot);
+	}
+	zswap_count_time(s0, ns0);
+}
+
+int
+zswap_load(vaddr_t kva, unsigned slot)
+{
+	struct zentry *ze;
+
+	KASSERT(slot < zswap_nslots);
+
+	lock_acquire(zswap_buflock);
+	spinlock_acquire(&zswap_lock);
+	ze = &zswap_tab[slot];
+	if ((ze->ze_flags & ZE_STORED) == 0) {
+		spinlock_release(&zswap_lock);
+		lock_release(zswap_buflock);
+		return ENOENT;
+	}
+	zswap_unpack(ze, slot, kva);
+	lock_release(zswap_buflock);
+	return 0;
+}
+
+bool
+zswap_free(unsigned slot)
+{
+	struct zentry *ze;
+
+	KASSERT(slot < zswap_nslots);
+
+	spinlock_acquire(&zswap_lock);
+	ze = &zswap_tab[slot];
+	if (ze->ze_flags & ZE_SPILLING) {
+		ze->ze_flags |= ZE_FREED;
+		spinlock_release(&zswap_lock);
+		return false;
+	}
+	if (ze->ze_flags & ZE_STORED) {
+		zswap_unlink(slot);
+		zswap_chunk_free(ze);
+		ze->ze_flags = 0;
+	}
+	spinlock_release(&zswap_lock);
+	return true;
+}
+
+int
+zswap_spill_begin(vaddr_t kva, unsigned *slot)
+{
+	struct zentry *ze;
+	unsigned victim;
+
+	lock_acquire(zswap_buflock);
+	spinlock_acquire(&zswap_lock);
+	victim = zswap_oldest;
+	if (victim == NOSLOT) {
+		spinlock_release(&zswap_lock);
+		lock_release(zswap_buflock);
+		return ENOENT;
+	}
+	ze = &zswap_tab[victim];
+	KASSERT(ze->ze_flags == ZE_STORED);
+	zswap_unlink(victim);
+	ze->ze_flags |= ZE_SPILLING;
+	zswap_unpack(ze, victim, kva);
+	lock_release(zswap_buflock);
+
+	*slot = victim;
+	return 0;
+}
+
+bool
+zswap_spill_end(unsigned slot)
+{
+	struct zentry *ze;
+	bool freed;
+
+	KASSERT(slot < zswap_nslots);
+
+	spinlock_acquire(&zswap_lock);
+	ze = &zswap_tab[slot];
+	KASSERT(ze->ze_flags & ZE_SPILLING);
+	freed = (ze->ze_flags & ZE_FREED) != 0;
+	zswap_chunk_free(ze);
+	ze->ze_flags = 0;
+	spinlock_release(&zswap_lock);
+
+	zswap_trim();
+	return freed;
+}
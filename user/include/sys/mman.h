@@ -0,0 +1,30 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+/*
+ * Memory-mapped files, and shared memory.
+ *
+ * OS/161 has no file descriptors to hand to mmap, so the file to map
+ * is named by its path instead. OFFSET must be a multiple of the page
+ * size. The mapping is placed wherever the kernel finds room.
+ */
+
+#include <sys/types.h>
+#include <kern/mman.h>
+
+void *mmap(const char *path, size_t len, int prot, int flags, off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+
+/*
+ * Shared memory segments, named by integer keys. shm_attach maps the
+ * whole segment readable and writable, and returns MAP_FAILED on
+ * error. A segment lasts until it has been removed and every process
+ * has detached it; fork shares attached segments with the child.
+ */
+int shm_create(int key, size_t len);
+void *shm_attach(int key);
+int shm_detach(void *addr);
+int shm_remove(int key);
+
+#endif /* _SYS_MMAN_H_ */
@@ -43,6 +43,7 @@
 #include <kern/seek.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
+#include <kern/vmstats.h>
 #include <kern/wait.h>
 
 
@@ -154,6 +155,7 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+int __vmstats(unsigned *counts, size_t ncounts, int flags);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -0,0 +1,636 @@
+/*
+ * vmsim - replay a page reference trace against the kernel's page
+ * replacement policies.
+ *
+ * Usage: vmsim [-f frames] [-p policy] tracefile
+ *
+ * The trace comes from the kernel's "vmtrace" menu command (see
+ * <kern/vmtrace.h>). Each policy is run over it in turn with FRAMES
+ * frames of memory (by default, as many as the kernel that recorded
+ * it had) and the page faults and writebacks of dirty pages it would
+ * have caused are printed, along with the faults the kernel took.
+ *
+ * The policies are those of kern/vm/vmpolicy.c, and see the same
+ * things: one reference per TLB miss, with the page's reference bit
+ * set and its dirty bit set on a write. Unlike the kernel, the
+ * simulator has no pinned or shared pages and never runs out of swap,
+ * so every page can be evicted.
+ *
+ * Builds for the host as well as for OS/161; the trace is big-endian
+ * either way.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include "kern/vmtrace.h"
+
+#ifdef HOST
+
+#include <netinet/in.h> // for arpa/inet.h
+#include <arpa/inet.h>  // for ntohl
+#include "hostcompat.h"
+#define SWAPL(x) ntohl(x)
+
+#else
+
+#define SWAPL(x) (x)
+
+#endif
+
+#define NOFRAME ((unsigned)-1)
+
+/* Records read at a time. */
+#define NRECORDS 1024
+
+/* Share of memory for 2Q's FIFO queue, and pages remembered. */
+#define TWOQ_INDIV   4
+#define TWOQ_OUTDIV  2
+
+////////////////////////////////////////////////////////////
+// Simulated memory
+
+struct frame {
+	uint32_t f_space;
+	uint32_t f_page;
+	int f_inuse;
+	int f_ref;
+	int f_dirty;
+	unsigned f_hnext;		/* page lookup chain */
+	unsigned f_older, f_newer;	/* queue links */
+	int f_queue;
+};
+
+static struct frame *frames;
+static unsigned nframes;
+static unsigned *hashtab;
+static unsigned hashsize;
+static unsigned freeframes;		/* freed by exits, through f_hnext */
+static unsigned nextfree;		/* frames never used start here */
+
+/* Results of one run. */
+static unsigned long nrefs, nfaults, nwritebacks;
+
+static
+unsigned
+hashpage(uint32_t space, uint32_t page)
+{
+	return ((space >> 4) ^ (page / 4096) ^ (page >> 20)) % hashsize;
+}
+
+static
+unsigned
+lookup(uint32_t space, uint32_t page)
+{
+	unsigned f;
+
+	for (f = hashtab[hashpage(space, page)]; f != NOFRAME;
+	     f = frames[f].f_hnext) {
+		if (frames[f].f_space == space && frames[f].f_page == page) {
+			return f;
+		}
+	}
+	return NOFRAME;
+}
+
+static
+void
+unhash(unsigned f)
+{
+	unsigned *fp;
+
+	fp = &hashtab[hashpage(frames[f].f_space, frames[f].f_page)];
+	while (*fp != f) {
+		fp = &frames[*fp].f_hnext;
+	}
+	*fp = frames[f].f_hnext;
+}
+
+////////////////////////////////////////////////////////////
+// Queues, as in the kernel
+
+#define Q_NONE  0
+#define Q_FIFO  1
+#define Q_A1IN  2
+#define Q_AM    3
+#define Q_COUNT 4
+
+static struct {
+	unsigned oldest, newest, count;
+} queues[Q_COUNT];
+
+static
+void
+q_push(int q, unsigned f)
+{
+	frames[f].f_older = queues[q].newest;
+	frames[f].f_newer = NOFRAME;
+	if (queues[q].newest != NOFRAME) {
+		frames[queues[q].newest].f_newer = f;
+	}
+	else {
+		queues[q].oldest = f;
+	}
+	queues[q].newest = f;
+	queues[q].count++;
+	frames[f].f_queue = q;
+}
+
+static
+void
+q_remove(unsigned f)
+{
+	int q;
+
+	q = frames[f].f_queue;
+	if (q == Q_NONE) {
+		return;
+	}
+	if (frames[f].f_older != NOFRAME) {
+		frames[frames[f].f_older].f_newer = frames[f].f_newer;
+	}
+	else {
+		queues[q].oldest = frames[f].f_newer;
+	}
+	if (frames[f].f_newer != NOFRAME) {
+		frames[frames[f].f_newer].f_older = frames[f].f_older;
+	}
+	else {
+		queues[q].newest = frames[f].f_older;
+	}
+	queues[q].count--;
+	frames[f].f_queue = Q_NONE;
+}
+
+/*
+ * Oldest frame of queue Q, giving used ones a second chance if
+ * SECONDCHANCE.
+ */
+static
+unsigned
+q_victim(int q, int secondchance)
+{
+	unsigned f;
+
+	while ((f = queues[q].oldest) != NOFRAME) {
+		if (!secondchance || !frames[f].f_ref) {
+			return f;
+		}
+		frames[f].f_ref = 0;
+		q_remove(f);
+		q_push(q, f);
+	}
+	return NOFRAME;
+}
+
+////////////////////////////////////////////////////////////
+// 2Q ghosts
+
+struct ghost {
+	uint32_t g_space;
+	uint32_t g_page;
+	int g_valid;
+	unsigned g_next;
+};
+
+static struct ghost *ghosts;
+static unsigned *ghosthash;
+static unsigned nghosts;
+static unsigned ghostnext;
+static unsigned inmax;
+
+static
+void
+ghost_unlink(unsigned g)
+{
+	unsigned *gp;
+
+	gp = &ghosthash[hashpage(ghosts[g].g_space, ghosts[g].g_page)];
+	while (*gp != g) {
+		gp = &ghosts[*gp].g_next;
+	}
+	*gp = ghosts[g].g_next;
+	ghosts[g].g_valid = 0;
+}
+
+static
+int
+ghost_take(uint32_t space, uint32_t page)
+{
+	unsigned g;
+
+	for (g = ghosthash[hashpage(space, page)]; g != NOFRAME;
+	     g = ghosts[g].g_next) {
+		if (ghosts[g].g_space == space && ghosts[g].g_page == page) {
+			ghost_unlink(g);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static
+void
+ghost_add(uint32_t space, uint32_t page)
+{
+	unsigned g, h;
+
+	g = ghostnext;
+	ghostnext = (g + 1) % nghosts;
+	if (ghosts[g].g_valid) {
+		ghost_unlink(g);
+	}
+	h = hashpage(space, page);
+	ghosts[g].g_space = space;
+	ghosts[g].g_page = page;
+	ghosts[g].g_valid = 1;
+	ghosts[g].g_next = ghosthash[h];
+	ghosthash[h] = g;
+}
+
+////////////////////////////////////////////////////////////
+// Policies
+
+struct policy {
+	const char *name;
+	void (*insert)(unsigned f);
+	void (*touch)(unsigned f);
+	void (*evict)(unsigned f);
+	unsigned (*victim)(void);
+};
+
+static unsigned hand;
+
+static
+void
+ignore(unsigned f)
+{
+	(void)f;
+}
+
+static
+void
+fifo_insert(unsigned f)
+{
+	q_push(Q_FIFO, f);
+}
+
+static
+unsigned
+fifo_victim(void)
+{
+	return q_victim(Q_FIFO, 0);
+}
+
+static
+unsigned
+advance(void)
+{
+	unsigned f;
+
+	f = hand;
+	hand = (hand + 1) % nframes;
+	return f;
+}
+
+static
+unsigned
+clock_victim(void)
+{
+	unsigned f;
+
+	while (1) {
+		f = advance();
+		if (!frames[f].f_ref) {
+			return f;
+		}
+		frames[f].f_ref = 0;
+	}
+}
+
+static
+unsigned
+eclock_victim(void)
+{
+	unsigned lap, i, f;
+
+	for (lap=0; lap<4; lap++) {
+		for (i=0; i<nframes; i++) {
+			f = advance();
+			if (frames[f].f_ref) {
+				if (lap % 2 == 1) {
+					frames[f].f_ref = 0;
+				}
+				continue;
+			}
+			if (frames[f].f_dirty && lap % 2 == 0) {
+				continue;
+			}
+			return f;
+		}
+	}
+	/* Not reached: the fourth lap finds everything clear. */
+	return advance();
+}
+
+static
+void
+twoq_insert(unsigned f)
+{
+	if (ghost_take(frames[f].f_space, frames[f].f_page)) {
+		q_push(Q_AM, f);
+	}
+	else {
+		q_push(Q_A1IN, f);
+	}
+}
+
+static
+void
+twoq_touch(unsigned f)
+{
+	if (frames[f].f_queue == Q_AM) {
+		q_remove(f);
+		q_push(Q_AM, f);
+	}
+}
+
+static
+void
+twoq_evict(unsigned f)
+{
+	if (frames[f].f_queue == Q_A1IN) {
+		ghost_add(frames[f].f_space, frames[f].f_page);
+	}
+	q_remove(f);
+}
+
+static
+unsigned
+twoq_victim(void)
+{
+	if (queues[Q_A1IN].count > inmax || queues[Q_AM].count == 0) {
+		return q_victim(Q_A1IN, 0);
+	}
+	return q_victim(Q_AM, 1);
+}
+
+static const struct policy policies[] = {
+	{ "fifo",   fifo_insert, ignore,     q_remove,   fifo_victim },
+	{ "clock",  ignore,      ignore,     ignore,     clock_victim },
+	{ "eclock", ignore,      ignore,     ignore,     eclock_victim },
+	{ "2q",     twoq_insert, twoq_touch, twoq_evict, twoq_victim },
+};
+#define NPOLICIES (sizeof(policies) / sizeof(policies[0]))
+
+////////////////////////////////////////////////////////////
+// Replay
+
+static
+void
+reset(void)
+{
+	unsigned i;
+
+	for (i=0; i<nframes; i++) {
+		frames[i].f_inuse = 0;
+		frames[i].f_queue = Q_NONE;
+	}
+	for (i=0; i<hashsize; i++) {
+		hashtab[i] = NOFRAME;
+		ghosthash[i] = NOFRAME;
+	}
+	for (i=0; i<Q_COUNT; i++) {
+		queues[i].oldest = queues[i].newest = NOFRAME;
+		queues[i].count = 0;
+	}
+	for (i=0; i<nghosts; i++) {
+		ghosts[i].g_valid = 0;
+	}
+	ghostnext = 0;
+	freeframes = NOFRAME;
+	nextfree = 0;
+	hand = 0;
+	nrefs = nfaults = nwritebacks = 0;
+}
+
+static
+void
+reference(const struct policy *p, uint32_t space, uint32_t page, int write)
+{
+	unsigned f;
+
+	nrefs++;
+	f = lookup(space, page);
+	if (f != NOFRAME) {
+		frames[f].f_ref = 1;
+		frames[f].f_dirty |= write;
+		p->touch(f);
+		return;
+	}
+
+	nfaults++;
+	if (freeframes != NOFRAME) {
+		f = freeframes;
+		freeframes = frames[f].f_hnext;
+	}
+	else if (nextfree < nframes) {
+		f = nextfree++;
+	}
+	else {
+		f = p->victim();
+		if (frames[f].f_dirty) {
+			nwritebacks++;
+		}
+		p->evict(f);
+		unhash(f);
+	}
+
+	frames[f].f_space = space;
+	frames[f].f_page = page;
+	frames[f].f_inuse = 1;
+	frames[f].f_ref = 1;
+	frames[f].f_dirty = write;
+	frames[f].f_hnext = hashtab[hashpage(space, page)];
+	hashtab[hashpage(space, page)] = f;
+	p->insert(f);
+}
+
+static
+void
+spaceexit(uint32_t space)
+{
+	unsigned f;
+
+	for (f=0; f<nextfree; f++) {
+		if (frames[f].f_inuse && frames[f].f_space == space) {
+			/* Not evicted, so not remembered by 2Q. */
+			q_remove(f);
+			unhash(f);
+			frames[f].f_inuse = 0;
+			frames[f].f_hnext = freeframes;
+			freeframes = f;
+		}
+	}
+}
+
+/*
+ * Run policy P over the trace in file FD, counting the faults the
+ * kernel took in KFAULTS.
+ */
+static
+void
+replay(int fd, const struct policy *p, unsigned long *kfaults)
+{
+	struct vmtrace_record recs[NRECORDS];
+	uint32_t space, page;
+	ssize_t len;
+	int i, n;
+
+	reset();
+	*kfaults = 0;
+	if (lseek(fd, sizeof(struct vmtrace_header), SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	while ((len = read(fd, recs, sizeof(recs))) > 0) {
+		n = len / sizeof(recs[0]);
+		for (i=0; i<n; i++) {
+			space = SWAPL(recs[i].vtr_space);
+			page = SWAPL(recs[i].vtr_page);
+			switch (VMTRACE_TYPE(page)) {
+			    case VMTRACE_FAULT:
+				(*kfaults)++;
+				/* fall through */
+			    case VMTRACE_REF:
+				reference(p, space, page & ~0xfffU,
+					  (page & VMTRACE_WRITE) != 0);
+				break;
+			    case VMTRACE_EXIT:
+				spaceexit(space);
+				break;
+			}
+		}
+	}
+	if (len < 0) {
+		err(1, "read");
+	}
+}
+
+/*
+ * Print N out of D as a percentage, to one decimal place.
+ */
+static
+void
+printpercent(unsigned long n, unsigned long d)
+{
+	unsigned long permille;
+
+	permille = d == 0 ? 0 : (n * 1000 + d / 2) / d;
+	printf("%4lu.%lu%%", permille / 10, permille % 10);
+}
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: vmsim [-f frames] [-p policy] tracefile");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct vmtrace_header vth;
+	const char *file, *only;
+	unsigned long kfaults;
+	unsigned i;
+	int fd;
+
+#ifdef HOST
+	hostcompat_init(argc, argv);
+#endif
+
+	file = NULL;
+	only = NULL;
+	nframes = 0;
+	for (i=1; i<(unsigned)argc; i++) {
+		if (!strcmp(argv[i], "-f") && i+1 < (unsigned)argc) {
+			nframes = atoi(argv[++i]);
+			if (nframes == 0) {
+				usage();
+			}
+		}
+		else if (!strcmp(argv[i], "-p") && i+1 < (unsigned)argc) {
+			only = argv[++i];
+		}
+		else if (argv[i][0] != '-' && file == NULL) {
+			file = argv[i];
+		}
+		else {
+			usage();
+		}
+	}
+	if (file == NULL) {
+		usage();
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	if (read(fd, &vth, sizeof(vth)) != sizeof(vth) ||
+	    SWAPL(vth.vth_magic) != VMTRACE_MAGIC) {
+		errx(1, "%s: Not a page reference trace", file);
+	}
+	if (SWAPL(vth.vth_version) != VMTRACE_VERSION) {
+		errx(1, "%s: Trace version %u; I only know version %u", file,
+		     SWAPL(vth.vth_version), VMTRACE_VERSION);
+	}
+	if (nframes == 0) {
+		nframes = SWAPL(vth.vth_nframes);
+	}
+
+	hashsize = nframes;
+	frames = malloc(nframes * sizeof(struct frame));
+	hashtab = malloc(hashsize * sizeof(unsigned));
+	nghosts = nframes / TWOQ_OUTDIV > 0 ? nframes / TWOQ_OUTDIV : 1;
+	inmax = nframes / TWOQ_INDIV;
+	ghosts = malloc(nghosts * sizeof(struct ghost));
+	ghosthash = malloc(hashsize * sizeof(unsigned));
+	if (frames == NULL || hashtab == NULL || ghosts == NULL ||
+	    ghosthash == NULL) {
+		errx(1, "Out of memory");
+	}
+
+	kfaults = 0;
+	for (i=0; i<NPOLICIES; i++) {
+		if (only == NULL || !strcmp(only, policies[i].name)) {
+			break;
+		}
+	}
+	if (i == NPOLICIES) {
+		errx(1, "%s: No such policy", only);
+	}
+
+	printf("%s: %u frames\n", file, nframes);
+	printf("policy       faults   rate   writebacks\n");
+	for (i=0; i<NPOLICIES; i++) {
+		if (only != NULL && strcmp(only, policies[i].name)) {
+			continue;
+		}
+		replay(fd, &policies[i], &kfaults);
+		printf("%-8s %10lu ", policies[i].name, nfaults);
+		printpercent(nfaults, nrefs);
+		printf(" %10lu\n", nwritebacks);
+	}
+	printf("(%lu references; the kernel took %lu faults with %u frames)\n",
+	       nrefs, kfaults, SWAPL(vth.vth_nframes));
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * sched-rt1.c
+ *
+ * 	Measures the response time of an interactive process, alone
+ *      and then running next to CPU hogs. Each round writes one
+ *      character to the console, which puts the process to sleep
+ *      until the output interrupt comes in; how long the write takes
+ *      is mostly how long the process then waits to be run again.
+ *
+ *      Alone, that is about the time to send one character. With the
+ *      hogs about, a round-robin scheduler makes it wait for each hog
+ *      to use up a time slice, while a scheduler that favours threads
+ *      that block should run it at once. Prints the least, mean and
+ *      most time per round in microseconds, for each case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define Hogs        3
+#define HogSeconds  5	/* long enough to outlast the rounds */
+#define Warmup     10	/* rounds not counted, while the hogs settle */
+#define Rounds     50
+
+static
+unsigned long
+usecs_since(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000000UL + ns1 / 1000 - ns0 / 1000;
+}
+
+static
+void
+hog(void)
+{
+	time_t s0;
+	unsigned long ns0;
+	volatile unsigned i;
+
+	__time(&s0, &ns0);
+	do {
+		for (i=0; i<10000; i++)
+			;
+	} while (usecs_since(s0, ns0) < HogSeconds * 1000000UL);
+	_exit(0);
+}
+
+static
+void
+measure(const char *what)
+{
+	time_t s0;
+	unsigned long ns0, us, min, max, total;
+	int i;
+
+	min = (unsigned long)-1;
+	max = total = 0;
+	for (i=0; i<Warmup+Rounds; i++) {
+		__time(&s0, &ns0);
+		write(STDOUT_FILENO, ".", 1);
+		us = usecs_since(s0, ns0);
+		if (i < Warmup) {
+			continue;
+		}
+		if (us < min) {
+			min = us;
+		}
+		if (us > max) {
+			max = us;
+		}
+		total += us;
+	}
+	printf("\n%s: min %lu us, mean %lu us, max %lu us per round\n",
+	       what, min, total / Rounds, max);
+}
+
+int
+main()
+{
+	pid_t pids[Hogs];
+	int i, status;
+
+	measure("alone");
+
+	for (i=0; i<Hogs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			hog();
+		}
+	}
+
+	measure("with hogs");
+
+	for (i=0; i<Hogs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	return 0;
+}
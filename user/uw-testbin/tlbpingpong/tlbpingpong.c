@@ -0,0 +1,45 @@
+/*
+ * tlbpingpong.c
+ *
+ * 	This program bounces between running in user mode and
+ *      sleeping in the kernel. Each round it touches a small
+ *      working set (which fits in the TLB), then writes one
+ *      character to the console, which puts it to sleep until
+ *      the output interrupt comes in and it is switched back in.
+ *
+ *      If nothing else runs in between, the TLB should still hold
+ *      the working set when it comes back, so the TLB faults
+ *      reported by the VMSTATS at shutdown should be close to
+ *      the number of pages touched, not Rounds times that.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PageSize  4096
+#define Pages       32
+#define Rounds     200
+
+char workingset[Pages*PageSize];
+
+int
+main()
+{
+	int i,j;
+	int sum = 0;
+
+	printf("Starting the tlbpingpong program\n");
+
+	for (i=0; i<Rounds; i++) {
+	  for (j=0; j<Pages; j++) {
+	    workingset[j*PageSize] = 'a' + i % 26;
+	    sum += workingset[j*PageSize];
+	  }
+	  /* one character at a time, so we sleep once per round */
+	  write(STDOUT_FILENO, (i % 50 == 49) ? "\n" : ".", 1);
+	}
+
+	printf("tlbpingpong done (%d)\n", sum);
+	exit(0);
+}
@@ -0,0 +1,59 @@
+/*
+ * vm-heap1.c
+ *
+ * 	Grows the heap with sbrk, writes every page of it, gives
+ *      half of it back, and grows it again. Pages that were given
+ *      back should come back zero-filled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (64)
+
+int
+main()
+{
+	char *base, *p;
+	unsigned int i;
+
+	base = sbrk(PAGES * PAGE_SIZE);
+	if (base == (void *)-1) {
+		printf("FAILED sbrk(%d)\n", PAGES * PAGE_SIZE);
+		exit(1);
+	}
+
+	for (i=0; i<PAGES; i++) {
+		base[i * PAGE_SIZE] = 'a' + i % 26;
+	}
+
+	p = sbrk(-(PAGES / 2) * PAGE_SIZE);
+	if (p != base + PAGES * PAGE_SIZE) {
+		printf("FAILED sbrk returned %p, not %p\n",
+		       p, base + PAGES * PAGE_SIZE);
+		exit(1);
+	}
+
+	p = sbrk((PAGES / 2) * PAGE_SIZE);
+	if (p != base + (PAGES / 2) * PAGE_SIZE) {
+		printf("FAILED sbrk returned %p, not %p\n",
+		       p, base + (PAGES / 2) * PAGE_SIZE);
+		exit(1);
+	}
+
+	for (i=0; i<PAGES; i++) {
+		if (i < PAGES / 2 && base[i * PAGE_SIZE] != 'a' + i % 26) {
+			printf("FAILED page %u lost its contents\n", i);
+			exit(1);
+		}
+		if (i >= PAGES / 2 && base[i * PAGE_SIZE] != 0) {
+			printf("FAILED page %u was not zero-filled\n", i);
+			exit(1);
+		}
+	}
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}
@@ -0,0 +1,171 @@
+/*
+ * vm-mmap1.c
+ *
+ * 	Maps its own executable twice: once shared and read-only, and
+ *      once private and writable. Writes to the private mapping
+ *      must not show through the shared one. A forked child maps
+ *      the file again and must see the same bytes as its parent.
+ *
+ *      Then changes a padding byte of the ELF header through a
+ *      shared writable mapping, and after unmapping it reads the
+ *      file with read() to see that the change was written back.
+ *      The byte is put back the same way afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (4)
+#define PADBYTE   (9)	/* EI_PAD, which nothing reads */
+
+static
+void
+check_elf(const char *what, const char *p)
+{
+	if (p[0] != 0x7f || p[1] != 'E' || p[2] != 'L' || p[3] != 'F') {
+		printf("FAILED %s mapping does not start with an ELF header\n",
+		       what);
+		exit(1);
+	}
+}
+
+/* Set the padding byte of PATH to C through a shared mapping. */
+static
+void
+patch(const char *path, char c)
+{
+	char *p;
+
+	p = mmap(path, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, 0);
+	if (p == MAP_FAILED) {
+		printf("FAILED mmap(%s, MAP_SHARED) for writing\n", path);
+		exit(1);
+	}
+	p[PADBYTE] = c;
+	if (munmap(p, PAGE_SIZE) != 0) {
+		printf("FAILED munmap of the writable mapping\n");
+		exit(1);
+	}
+}
+
+/* Return the padding byte of PATH, read from the file itself. */
+static
+char
+readback(const char *path)
+{
+	char buf[PADBYTE + 1];
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("FAILED open(%s)\n", path);
+		exit(1);
+	}
+	if (read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+		printf("FAILED read(%s)\n", path);
+		exit(1);
+	}
+	close(fd);
+	return buf[PADBYTE];
+}
+
+int
+main(int argc, char **argv)
+{
+	char *shared, *private, *child;
+	char orig;
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	if (argc < 1 || argv[0] == NULL) {
+		printf("FAILED no program name to map\n");
+		exit(1);
+	}
+
+	shared = mmap(argv[0], PAGES * PAGE_SIZE, PROT_READ, MAP_SHARED, 0);
+	if (shared == MAP_FAILED) {
+		printf("FAILED mmap(%s, MAP_SHARED)\n", argv[0]);
+		exit(1);
+	}
+	check_elf("shared", shared);
+	orig = shared[PADBYTE];
+
+	private = mmap(argv[0], PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE, 0);
+	if (private == MAP_FAILED) {
+		printf("FAILED mmap(%s, MAP_PRIVATE)\n", argv[0]);
+		exit(1);
+	}
+	check_elf("private", private);
+	if (memcmp(shared, private, PAGES * PAGE_SIZE) != 0) {
+		printf("FAILED the two mappings differ\n");
+		exit(1);
+	}
+
+	for (i=0; i<PAGES; i++) {
+		private[i * PAGE_SIZE] = 'a' + i;
+	}
+	check_elf("shared", shared);
+	for (i=0; i<PAGES; i++) {
+		if (private[i * PAGE_SIZE] != (char)('a' + i)) {
+			printf("FAILED page %u of the private mapping lost "
+			       "its contents\n", i);
+			exit(1);
+		}
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		printf("FAILED fork\n");
+		exit(1);
+	}
+	if (pid == 0) {
+		child = mmap(argv[0], PAGES * PAGE_SIZE, PROT_READ,
+			     MAP_SHARED, 0);
+		if (child == MAP_FAILED) {
+			printf("FAILED mmap in child\n");
+			_exit(1);
+		}
+		if (memcmp(child, shared, PAGES * PAGE_SIZE) != 0) {
+			printf("FAILED child sees different file contents\n");
+			_exit(1);
+		}
+		if (private[0] != 'a') {
+			printf("FAILED child lost the private mapping\n");
+			_exit(1);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0 || status != 0) {
+		printf("FAILED child exited with %d\n", status);
+		exit(1);
+	}
+
+	if (munmap(private, PAGES * PAGE_SIZE) != 0 ||
+	    munmap(shared, PAGES * PAGE_SIZE) != 0) {
+		printf("FAILED munmap\n");
+		exit(1);
+	}
+
+	patch(argv[0], orig ^ 0x5a);
+	if (readback(argv[0]) != (char)(orig ^ 0x5a)) {
+		printf("FAILED a write to a shared mapping did not reach "
+		       "the file\n");
+		patch(argv[0], orig);
+		exit(1);
+	}
+	patch(argv[0], orig);
+	if (readback(argv[0]) != orig) {
+		printf("FAILED could not put the file back as it was\n");
+		exit(1);
+	}
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}
@@ -0,0 +1,101 @@
+/*
+ * vm-shm1.c
+ *
+ * 	Creates a shared memory segment and forks a child that
+ *      attaches it by key and fills it in. The parent, attaching it
+ *      on its own, must see what the child wrote. Also checks that
+ *      a key can't be created twice, and is gone once removed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (8)
+#define KEY       (350)
+
+int
+main(void)
+{
+	unsigned int *p;
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	if (shm_create(KEY, PAGES * PAGE_SIZE) != 0) {
+		printf("FAILED shm_create\n");
+		exit(1);
+	}
+	if (shm_create(KEY, PAGE_SIZE) == 0 || errno != EEXIST) {
+		printf("FAILED second shm_create of the same key\n");
+		exit(1);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		printf("FAILED fork\n");
+		exit(1);
+	}
+	if (pid == 0) {
+		p = shm_attach(KEY);
+		if (p == MAP_FAILED) {
+			printf("FAILED shm_attach in child\n");
+			_exit(1);
+		}
+		for (i=0; i<PAGES * PAGE_SIZE / sizeof(*p); i++) {
+			if (p[i] != 0) {
+				printf("FAILED new segment is not zeroed\n");
+				_exit(1);
+			}
+			p[i] = i * 7 + 1;
+		}
+		if (shm_detach(p) != 0) {
+			printf("FAILED shm_detach in child\n");
+			_exit(1);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0 || status != 0) {
+		printf("FAILED child exited with %d\n", status);
+		exit(1);
+	}
+
+	p = shm_attach(KEY);
+	if (p == MAP_FAILED) {
+		printf("FAILED shm_attach\n");
+		exit(1);
+	}
+	for (i=0; i<PAGES * PAGE_SIZE / sizeof(*p); i++) {
+		if (p[i] != i * 7 + 1) {
+			printf("FAILED word %u is %u, child wrote %u\n",
+			       i, p[i], i * 7 + 1);
+			exit(1);
+		}
+	}
+
+	/* Still attached, so the memory stays; the key goes. */
+	if (shm_remove(KEY) != 0) {
+		printf("FAILED shm_remove\n");
+		exit(1);
+	}
+	if (shm_attach(KEY) != MAP_FAILED || errno != ENOENT) {
+		printf("FAILED shm_attach after shm_remove\n");
+		exit(1);
+	}
+	if (p[PAGES * PAGE_SIZE / sizeof(*p) - 1] !=
+	    (PAGES * PAGE_SIZE / sizeof(*p) - 1) * 7 + 1) {
+		printf("FAILED segment lost its contents after shm_remove\n");
+		exit(1);
+	}
+	if (shm_detach(p) != 0) {
+		printf("FAILED shm_detach\n");
+		exit(1);
+	}
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}
@@ -0,0 +1,34 @@
+/*
+ * vm-stack3.c
+ *
+ * 	Uses a stack array much bigger than the initial stack region,
+ *      so the stack has to grow on demand to run this.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (256)
+#define SIZE      (PAGE_SIZE * PAGES / sizeof(int))
+
+int
+main()
+{
+	unsigned int array[SIZE];
+	unsigned int i = 0;
+
+	for (i=0; i<SIZE; i+=PAGE_SIZE/sizeof(int)) {
+		array[i] = i;
+	}
+
+	for (i=0; i<SIZE; i+=PAGE_SIZE/sizeof(int)) {
+		if (array[i] != i) {
+			printf("FAILED array[%d] = %u != %d\n", i, array[i], i);
+			exit(1);
+		}
+	}
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}
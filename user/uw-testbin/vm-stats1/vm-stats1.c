@@ -0,0 +1,61 @@
+/*
+ * vm-stats1.c
+ *
+ * 	Resets the VM counters, touches every page of a freshly grown
+ *      heap, and checks that __vmstats saw a zero-filled heap fault
+ *      for each of them. Prints the counters, as a benchmark would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (32)
+
+int
+main()
+{
+	unsigned counts[VMSTAT_COUNT];
+	char *base;
+	unsigned int i;
+	int n;
+
+	if (__vmstats(counts, VMSTAT_COUNT, VMSTATS_RESET) != VMSTAT_COUNT) {
+		printf("FAILED __vmstats reset\n");
+		exit(1);
+	}
+
+	base = sbrk(PAGES * PAGE_SIZE);
+	if (base == (void *)-1) {
+		printf("FAILED sbrk(%d)\n", PAGES * PAGE_SIZE);
+		exit(1);
+	}
+	for (i=0; i<PAGES; i++) {
+		base[i * PAGE_SIZE] = 1;
+	}
+
+	n = __vmstats(counts, VMSTAT_COUNT, 0);
+	if (n != VMSTAT_COUNT) {
+		printf("FAILED __vmstats returned %d\n", n);
+		exit(1);
+	}
+
+	for (i=0; i<VMSTAT_COUNT; i++) {
+		printf("counter %2u = %u\n", i, counts[i]);
+	}
+
+	if (counts[VMSTAT_FAULT_HEAP] < PAGES) {
+		printf("FAILED %u heap faults for %d pages\n",
+		       counts[VMSTAT_FAULT_HEAP], PAGES);
+		exit(1);
+	}
+	if (counts[VMSTAT_PAGE_FAULT_ZERO] < PAGES) {
+		printf("FAILED %u zero-filled faults for %d pages\n",
+		       counts[VMSTAT_PAGE_FAULT_ZERO], PAGES);
+		exit(1);
+	}
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}